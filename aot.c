@@ -0,0 +1,177 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "aot.h"
+
+// Flush only gets the context, so the check against memory waits for the next execute
+typedef struct {
+    chip8_aot aot;
+    bool recheck;
+} aot_engine;
+
+static bool aot_translated(const chip8_aot_program* program, uint32_t offset) {
+    return (program->code_map[offset >> 3] >> (offset & 7)) & 1;
+}
+
+static void aot_refresh(chip8_aot* aot, const chip8_vm* vm) {
+    const chip8_aot_program* program = aot->program;
+    aot->modified = false;
+    for (uint32_t k = 0; k < program->rom_len; k++) {
+        if (aot_translated(program, k) && vm->ram[PROGRAM_START + k] != program->rom[k]) {
+            aot->modified = true;
+            return;
+        }
+    }
+}
+
+static tick_result aot_engine_execute(void* ctx, chip8_vm* vm, uint32_t n) {
+    aot_engine* engine = ctx;
+    if (engine->recheck) {
+        aot_refresh(&engine->aot, vm);
+        engine->recheck = false;
+    }
+    return engine->aot.program->execute(&engine->aot, vm, n);
+}
+
+static void aot_engine_flush(void* ctx) {
+    ((aot_engine*) ctx)->recheck = true;
+}
+
+chip8_aot* aot_new(const chip8_aot_program* program) {
+    aot_engine* engine = malloc(sizeof(aot_engine));
+    if (engine == NULL) return NULL;
+    engine->aot.program = program;
+    engine->aot.modified = true;
+    engine->recheck = true;
+    return &engine->aot;
+}
+
+void aot_free(chip8_aot* aot) {
+    // The engine starts with the aot it hands out
+    free(aot);
+}
+
+bool aot_attach(chip8_aot* aot, chip8_vm* vm) {
+    if (vm->mode != aot->program->mode) return false;
+    aot_engine* engine = (aot_engine*) aot;
+    aot_refresh(aot, vm);
+    engine->recheck = false;
+    vm->engine.ctx = engine;
+    vm->engine.execute = aot_engine_execute;
+    vm->engine.flush = aot_engine_flush;
+    return true;
+}
+
+bool aot_intact(const chip8_aot* aot, const chip8_vm* vm, uint16_t addr, uint16_t len) {
+    return memcmp(&vm->ram[addr], &aot->program->rom[addr - PROGRAM_START], len) == 0;
+}
+
+tick_result aot_step(chip8_aot* aot, chip8_vm* vm, uint32_t* budget) {
+    uint32_t skipped = vm_skip_idle(vm, *budget);
+    if (skipped > 0) {
+        vm->cycles += skipped;
+        *budget -= skipped;
+        return SUCCESS;
+    }
+    // Note where the instruction writes, like jit_interpret, in case it's over translated code
+    uint16_t opcode = (uint16_t) (vm->ram[vm->pc & vm->addr_mask] << 8) | vm->ram[(vm->pc + 1) & vm->addr_mask];
+    uint16_t write_addr = vm->i;
+    int write_len = instruction_write_len(decode_instruction(opcode, vm->mode));
+    tick_result res = vm_tick(vm);
+    (*budget)--;
+    for (int j = 0; j < write_len && !aot->modified; j++) {
+        uint16_t offset = ((write_addr + j) & vm->addr_mask) - PROGRAM_START;
+        if (offset < aot->program->rom_len && aot_translated(aot->program, offset)) aot->modified = true;
+    }
+    return res;
+}
+
+/*
+ * Runs the program on the interpreter and the translated code side by side in randomly
+ * sized slices, as chip8_c --jit-verify does for the JIT.
+ */
+static int aot_verify(const chip8_aot_program* program, chip8_aot* aot, uint32_t ips, long frames) {
+    static chip8_vm ref, translated;
+    vm_load_program_mode(&ref, program->mode, ips, program->rom, (int) program->rom_len);
+    vm_load_program_mode(&translated, program->mode, ips, program->rom, (int) program->rom_len);
+    aot_attach(aot, &translated);
+    uint32_t slice_seed = 1;
+    uint64_t remaining = (uint64_t) frames * ref.ips / TIMER_HZ;
+    while (remaining > 0) {
+        slice_seed = slice_seed * 1103515245 + 12345;
+        uint32_t slice = 1 + (slice_seed >> 16) % 64;
+        if (slice > remaining) slice = remaining;
+        remaining -= slice;
+        uint16_t pc = ref.pc;
+        tick_result ref_res = vm_run_cycles(&ref, slice);
+        tick_result aot_res = vm_run_cycles(&translated, slice);
+        const char* diff = vm_state_diff(&ref, &translated);
+        if (ref_res != aot_res || diff != NULL) {
+            printf("MISMATCH at cycle %llu, %u instructions from pc=%#05x: %s\n",
+                   (unsigned long long) ref.cycles, slice, pc, diff != NULL ? diff : "result");
+            return 1;
+        }
+        if (ref_res != SUCCESS) {
+            printf("both stopped: %s (cycle %llu)\n", tick_result_str(ref_res), (unsigned long long) ref.cycles);
+            return 0;
+        }
+    }
+    printf("hash: %016llx\n", (unsigned long long) screen_hash(&translated.fb));
+    printf("translated code matched the interpreter for %ld frames (%llu cycles)\n", frames,
+           (unsigned long long) ref.cycles);
+    return 0;
+}
+
+int aot_main(const chip8_aot_program* program, int argc, char* argv[]) {
+    static chip8_vm vm;
+    long frames = 0;
+    uint32_t ips = DEFAULT_IPS;
+    bool verify = false;
+    for (int a = 1; a < argc; a++) {
+        if (strcmp(argv[a], "--frames") == 0 && a + 1 < argc) {
+            frames = strtol(argv[++a], NULL, 10);
+        } else if (strcmp(argv[a], "--ips") == 0 && a + 1 < argc) {
+            ips = (uint32_t) strtoul(argv[++a], NULL, 10);
+        } else if (strcmp(argv[a], "--verify") == 0) {
+            verify = true;
+        } else {
+            frames = 0;
+            break;
+        }
+    }
+    if (frames <= 0) {
+        printf("usage: %s --frames N [--ips N] [--verify]\n", argv[0]);
+        return 1;
+    }
+    chip8_aot* aot = aot_new(program);
+    if (aot == NULL) {
+        puts("ERROR: out of memory");
+        return 1;
+    }
+    if (verify) {
+        int status = aot_verify(program, aot, ips, frames);
+        aot_free(aot);
+        return status;
+    }
+    vm_load_program_mode(&vm, program->mode, ips, program->rom, (int) program->rom_len);
+    aot_attach(aot, &vm);
+    tick_result res = SUCCESS;
+    long frame = 0;
+    clock_t start = clock();
+    while (frame < frames) {
+        res = vm_run_frame(&vm);
+        if (res != SUCCESS) break;
+        frame++;
+    }
+    double elapsed = (double) (clock() - start) / CLOCKS_PER_SEC;
+    if (res != SUCCESS) printf("error: %s (pc=%#05x, frame %ld)\n", tick_result_str(res), vm.pc, frame);
+    printf("frames: %ld\n", frame);
+    printf("cycles: %llu\n", (unsigned long long) (vm.cycles - vm.idle_cycles));
+    printf("idle cycles skipped: %llu\n", (unsigned long long) vm.idle_cycles);
+    printf("seconds: %.6f\n", elapsed);
+    printf("cycles/sec: %.0f\n", elapsed > 0 ? (vm.cycles - vm.idle_cycles) / elapsed : 0.0);
+    printf("hash: %016llx\n", (unsigned long long) screen_hash(&vm.fb));
+    aot_free(aot);
+    return res == SUCCESS ? 0 : 2;
+}
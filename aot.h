@@ -0,0 +1,53 @@
+#ifndef CHIP8_AOT_H
+#define CHIP8_AOT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "vm.h"
+
+/*
+ * Programs translated ahead of time into C by chip8_aot (see recompile.c). Each generated
+ * file defines a chip8_aot_program, and aot_attach makes it the execution engine of a VM
+ * that has the same ROM loaded. Code the translator couldn't follow, and code the program
+ * wrote over, runs on the interpreter.
+ */
+typedef struct chip8_aot chip8_aot;
+
+typedef struct {
+    const char* name;
+    chip8_mode mode;
+    const uint8_t* rom;
+    uint32_t rom_len;
+    // One bit per ROM byte that translated code was built from, bit k & 7 of byte k >> 3
+    const uint8_t* code_map;
+    // Runs n instructions like vm_execute, adding them to vm->cycles
+    tick_result (*execute)(chip8_aot* aot, chip8_vm* vm, uint32_t n);
+} chip8_aot_program;
+
+struct chip8_aot {
+    const chip8_aot_program* program;
+    // Set once memory differs from the ROM somewhere translated code came from. Blocks then
+    // check their own bytes before running.
+    bool modified;
+};
+
+chip8_aot* aot_new(const chip8_aot_program* program);
+void aot_free(chip8_aot* aot);
+// Makes aot the execution engine of vm. Returns false if vm runs in a different mode.
+bool aot_attach(chip8_aot* aot, chip8_vm* vm);
+
+// Used by the generated code: true if the len bytes at addr are still the ones they were translated from
+bool aot_intact(const chip8_aot* aot, const chip8_vm* vm, uint16_t addr, uint16_t len);
+/*
+ * Used by the generated code for instructions it has no block for: skips an idle loop or runs
+ * one instruction on the interpreter, taking them off budget.
+ */
+tick_result aot_step(chip8_aot* aot, chip8_vm* vm, uint32_t* budget);
+
+/*
+ * A main() for generated files built with -DCHIP8_AOT_MAIN: runs the program headless like
+ * chip8_c --headless, or with --verify side by side with the interpreter.
+ */
+int aot_main(const chip8_aot_program* program, int argc, char* argv[]);
+
+#endif
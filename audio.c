@@ -0,0 +1,89 @@
+#include <stdio.h>
+#include <string.h>
+#include "audio.h"
+
+// Where cycle falls on the beeper's sample clock
+static uint64_t audio_time(sdl_audio* audio, uint64_t cycle) {
+    uint64_t time = audio->base_time;
+    if (cycle > audio->base_cycle) time += (uint64_t) ((cycle - audio->base_cycle) * audio->samples_per_cycle);
+    if (time > audio->time) audio->time = time;
+    return audio->time;
+}
+
+static void audio_update(void* ctx, chip8_vm* vm, uint64_t cycle) {
+    sdl_audio* audio = ctx;
+    // Paused, so nothing would take it off the ring. The next rebase sends the tone as it is then.
+    if (audio->samples_per_cycle == 0) return;
+    beeper_tone tone;
+    tone.on = vm->sound > 0;
+    tone.pitch = vm->pitch;
+    memcpy(tone.pattern, vm->pattern, sizeof(tone.pattern));
+    beeper_set_tone(&audio->beeper, audio_time(audio, cycle), &tone);
+}
+
+// Runs on SDL's audio thread
+static void audio_callback(void* ctx, Uint8* stream, int len) {
+    sdl_audio* audio = ctx;
+    beeper_render(&audio->beeper, (int16_t*) stream, (uint32_t) len / sizeof(int16_t));
+}
+
+bool audio_open(sdl_audio* audio, chip8_vm* vm, uint32_t polls) {
+    if (SDL_InitSubSystem(SDL_INIT_AUDIO) < 0) {
+        printf("Audio could not initialize, running without sound. SDL_Error: %s\n", SDL_GetError());
+        return false;
+    }
+    SDL_AudioSpec want, have;
+    SDL_zero(want);
+    want.freq = AUDIO_SAMPLE_RATE;
+    want.format = AUDIO_S16SYS;
+    want.channels = 1;
+    want.samples = AUDIO_BUFFER_SAMPLES;
+    want.callback = audio_callback;
+    want.userdata = audio;
+    // Devices open paused, so the beeper can be set up once the real rate is known
+    audio->device = SDL_OpenAudioDevice(NULL, 0, &want, &have,
+                                        SDL_AUDIO_ALLOW_FREQUENCY_CHANGE | SDL_AUDIO_ALLOW_SAMPLES_CHANGE);
+    if (audio->device == 0) {
+        printf("Audio device could not be opened, running without sound. SDL_Error: %s\n", SDL_GetError());
+        return false;
+    }
+    beeper_init(&audio->beeper, (uint32_t) have.freq, have.samples);
+    audio->buffer_samples = have.samples;
+    audio->polls = polls;
+    audio->base_cycle = vm->cycles;
+    audio->base_time = 0;
+    audio->samples_per_cycle = 0;
+    audio->time = 0;
+    vm->audio.ctx = audio;
+    vm->audio.update = audio_update;
+    return true;
+}
+
+void audio_close(sdl_audio* audio) {
+    SDL_CloseAudioDevice(audio->device);
+    const beeper* b = &audio->beeper;
+    printf("audio: %llu underruns, %llu resyncs, %llu dropped tone changes\n", (unsigned long long) b->underruns,
+           (unsigned long long) b->resyncs, (unsigned long long) b->dropped);
+}
+
+void audio_sync(sdl_audio* audio, const chip8_vm* vm) {
+    beeper_advance(&audio->beeper, audio_time(audio, vm->cycles));
+}
+
+void audio_rebase(sdl_audio* audio, chip8_vm* vm, double speed) {
+    audio->base_cycle = vm->cycles;
+    audio->base_time = audio->time;
+    // Unlimited speed and stalls have no sensible sample clock, so the device just stops until they're over
+    audio->samples_per_cycle = speed > 0 ? audio->beeper.sample_rate / (speed * vm->ips) : 0;
+    /*
+     * The device takes a whole buffer at a time, and the emulation reports its progress once
+     * per poll at normal speed. Otherwise the polls don't wait for their part of the frame, so
+     * it reports a tick's worth of frames at once, or a whole frame spread over several ticks.
+     */
+    double burst = (double) audio->beeper.sample_rate / TIMER_HZ;
+    if (speed == 1) burst /= audio->polls;
+    if (speed > 0 && speed < 1) burst /= speed;
+    beeper_set_latency(&audio->beeper, audio->buffer_samples + (uint32_t) burst);
+    audio_update(audio, vm, vm->cycles);
+    SDL_PauseAudioDevice(audio->device, speed > 0 ? 0 : 1);
+}
@@ -0,0 +1,51 @@
+#ifndef CHIP8_AUDIO_H
+#define CHIP8_AUDIO_H
+
+#include <SDL.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "vm.h"
+#include "beeper.h"
+
+#define AUDIO_SAMPLE_RATE 48000
+// Samples per audio callback, about 5 ms
+#define AUDIO_BUFFER_SAMPLES 256
+
+/*
+ * The sound timer played through an SDL audio device. The VM's audio backend stamps
+ * tone changes with their emulated cycle, converted to the beeper's sample clock at the
+ * current speed, and the SDL audio callback renders them from the beeper's ring.
+ */
+typedef struct {
+    SDL_AudioDeviceID device;
+    beeper beeper;
+    // The sample clock is base_time at base_cycle and runs samples_per_cycle from there.
+    // It stands still at 0 samples_per_cycle, while the device is paused.
+    uint64_t base_cycle;
+    uint64_t base_time;
+    double samples_per_cycle;
+    // Latest time given to the beeper, so it never goes backwards
+    uint64_t time;
+    // Samples per callback, and emulation polls per frame
+    uint32_t buffer_samples;
+    uint32_t polls;
+} sdl_audio;
+
+/*
+ * Opens the default audio device and attaches to vm's audio backend. polls is the number
+ * of times per frame the emulation reports its progress, which sets how far behind the
+ * audio has to stay. Returns false (and leaves vm alone) if there's no audio device.
+ */
+bool audio_open(sdl_audio* audio, chip8_vm* vm, uint32_t polls);
+// Prints the underrun counters and closes the device
+void audio_close(sdl_audio* audio);
+// Tells the audio thread the emulation has reached vm->cycles
+void audio_sync(sdl_audio* audio, const chip8_vm* vm);
+/*
+ * Restarts the sample clock from vm->cycles at speed times real time, after the VM jumped
+ * to another point (loading a state) or the speed changed. Speed 0 (unlimited, or rewinding)
+ * pauses the device until the next rebase.
+ */
+void audio_rebase(sdl_audio* audio, chip8_vm* vm, double speed);
+
+#endif
@@ -0,0 +1,453 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "vm.h"
+#include "rom.h"
+#include "corpus.h"
+#ifdef CHIP8_HAVE_JIT
+#include "jit.h"
+#else
+typedef struct chip8_jit chip8_jit;
+#endif
+
+/*
+ * chip8_batch runs a manifest of ROM jobs headless across all cores and prints
+ * one JSON object per job, in manifest order.
+ *
+ * Manifest lines are "ROM FRAMES [INPUT]", '#' starts a comment. An input script
+ * has lines "FRAME MASK", where MASK is the hex bitmask of held keys (bit k = key k)
+ * from that frame on, until the next line. Keys that go up while the VM is
+ * waiting for a keypress are reported to it like SDL_KEYUP in the frontend. Every job
+ * runs in the --mode given, plain CHIP-8 by default.
+ *
+ * With --corpus, ROMs are loaded straight out of a packed corpus (see corpus.h) instead
+ * of from files: manifest ROMs are names in it, or "@" and a ROM hash. Without a
+ * manifest, --corpus runs every distinct ROM in it for --frames frames.
+ */
+
+#define MAX_LINE 1024
+
+typedef struct {
+    long frame;
+    uint16_t keys;
+} input_event;
+
+typedef struct {
+    input_event* events;
+    int len;
+} input_script;
+
+typedef struct {
+    const char* rom_path;
+    char* input_path;
+    long frames;
+    // Set when the ROM comes from a corpus, pointing into its mapping
+    const uint8_t* rom;
+    long rom_len;
+} batch_job;
+
+typedef struct {
+    // NULL if the job ran; otherwise why it couldn't be run
+    const char* error;
+    tick_result result;
+    uint16_t pc;
+    long frames;
+    // Instructions run, and the ones vm_skip_idle fast-forwarded through on top of them
+    uint64_t cycles;
+    uint64_t idle;
+    uint64_t hash;
+} job_result;
+
+/*
+ * Each worker owns a deque of job indices. It takes work from the front of its own
+ * deque and, once that's empty, steals from the back of the others. Jobs are whole
+ * ROM runs, so a mutex per deque is never contended enough to matter.
+ */
+typedef struct {
+    pthread_mutex_t lock;
+    int* jobs;
+    int head;
+    int tail;
+} job_deque;
+
+typedef struct {
+    batch_job* jobs;
+    job_result* results;
+    int job_count;
+    job_deque* deques;
+    int worker_count;
+    uint32_t ips;
+    chip8_mode mode;
+    bool use_jit;
+    rom_corpus* corpus;
+} batch;
+
+typedef struct {
+    batch* b;
+    int id;
+    pthread_t thread;
+    int jobs_run;
+    int jobs_stolen;
+} batch_worker;
+
+static int deque_pop_front(job_deque* d) {
+    int job = -1;
+    pthread_mutex_lock(&d->lock);
+    if (d->head < d->tail) job = d->jobs[d->head++];
+    pthread_mutex_unlock(&d->lock);
+    return job;
+}
+
+static int deque_pop_back(job_deque* d) {
+    int job = -1;
+    pthread_mutex_lock(&d->lock);
+    if (d->head < d->tail) job = d->jobs[--d->tail];
+    pthread_mutex_unlock(&d->lock);
+    return job;
+}
+
+// Returns the next job for worker w, or -1 once every deque is empty
+static int next_job(batch_worker* w) {
+    batch* b = w->b;
+    int job = deque_pop_front(&b->deques[w->id]);
+    if (job >= 0) return job;
+    // Nothing is ever pushed after start up, so one empty sweep means all work is taken
+    for (int k = 1; k < b->worker_count; k++) {
+        job = deque_pop_back(&b->deques[(w->id + k) % b->worker_count]);
+        if (job >= 0) {
+            w->jobs_stolen++;
+            return job;
+        }
+    }
+    return -1;
+}
+
+static bool load_input_script(const char* path, input_script* script) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) return false;
+    char line[MAX_LINE];
+    int cap = 0;
+    script->events = NULL;
+    script->len = 0;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        long frame;
+        unsigned int keys;
+        char* hash = strchr(line, '#');
+        if (hash != NULL) *hash = '\0';
+        if (sscanf(line, "%ld %x", &frame, &keys) != 2) continue;
+        if (script->len == cap) {
+            cap = cap ? cap * 2 : 64;
+            script->events = realloc(script->events, cap * sizeof(input_event));
+        }
+        script->events[script->len].frame = frame;
+        script->events[script->len].keys = (uint16_t) keys;
+        script->len++;
+    }
+    fclose(file);
+    return true;
+}
+
+static void run_job(chip8_vm* vm, chip8_jit* jit, const batch* b, const batch_job* job, job_result* out) {
+    memset(out, 0, sizeof(*out));
+    long rom_size = job->rom_len;
+    uint8_t* file = NULL;
+    const uint8_t* rom = job->rom;
+    if (b->corpus != NULL && rom == NULL) {
+        out->error = "ROM not in the corpus";
+        return;
+    }
+    if (rom == NULL) {
+        rom = file = read_binary_file(job->rom_path, &rom_size);
+        if (rom == NULL) {
+            out->error = "could not read ROM";
+            return;
+        }
+    }
+    if (rom_size > MODE_MAX_ROM_SIZE(b->mode)) {
+        out->error = "ROM does not fit in memory";
+        free(file);
+        return;
+    }
+    input_script script = {NULL, 0};
+    if (job->input_path != NULL && !load_input_script(job->input_path, &script)) {
+        out->error = "could not read input script";
+        free(file);
+        return;
+    }
+    // The VM is reused between jobs, so nothing may carry over from the last ROM
+    memset(vm, 0, sizeof(*vm));
+    vm_load_program_mode(vm, b->mode, b->ips, rom, rom_size);
+    free(file);
+#ifdef CHIP8_HAVE_JIT
+    if (jit != NULL) jit_attach(jit, vm);
+#else
+    (void) jit;
+#endif
+    tick_result res = SUCCESS;
+    int next_event = 0;
+    long frame = 0;
+    while (frame < job->frames) {
+        uint16_t old_keys = vm->keys;
+        while (next_event < script.len && script.events[next_event].frame <= frame) {
+            vm->keys = script.events[next_event++].keys;
+        }
+        uint16_t released = old_keys & ~vm->keys;
+        if (released != 0 && vm->waiting_for_keypress) {
+            vm->key_released = (int8_t) __builtin_ctz(released);
+        }
+        res = vm_run_frame(vm);
+        if (res != SUCCESS) break;
+        frame++;
+    }
+    free(script.events);
+    out->result = res;
+    out->pc = vm->pc;
+    out->frames = frame;
+    out->cycles = vm->cycles - vm->idle_cycles;
+    out->idle = vm->idle_cycles;
+    out->hash = screen_hash(&vm->fb);
+}
+
+static void* worker_main(void* arg) {
+    batch_worker* w = arg;
+    batch* b = w->b;
+    chip8_vm* vm = malloc(sizeof(chip8_vm));
+    chip8_jit* jit = NULL;
+#ifdef CHIP8_HAVE_JIT
+    if (b->use_jit) jit = jit_new();
+#endif
+    int job;
+    while ((job = next_job(w)) >= 0) {
+        run_job(vm, jit, b, &b->jobs[job], &b->results[job]);
+        w->jobs_run++;
+    }
+#ifdef CHIP8_HAVE_JIT
+    if (jit != NULL) jit_free(jit);
+#endif
+    free(vm);
+    return NULL;
+}
+
+static const char* tick_result_name(tick_result res) {
+    switch (res) {
+        case SUCCESS:
+            return "SUCCESS";
+        case ERR_STACK_OVERFLOW:
+            return "ERR_STACK_OVERFLOW";
+        case ERR_STACK_UNDERFLOW:
+            return "ERR_STACK_UNDERFLOW";
+        case ERR_INVALID:
+            return "ERR_INVALID";
+        default:
+            return "ERR_UNKNOWN";
+    }
+}
+
+static void print_json_string(const char* s) {
+    putchar('"');
+    for (; *s != '\0'; s++) {
+        if (*s == '"' || *s == '\\') {
+            printf("\\%c", *s);
+        } else if ((unsigned char) *s < 0x20) {
+            printf("\\u%04x", *s);
+        } else {
+            putchar(*s);
+        }
+    }
+    putchar('"');
+}
+
+static void print_result(int index, const batch_job* job, const job_result* r) {
+    printf("{\"job\":%d,\"rom\":", index);
+    print_json_string(job->rom_path);
+    if (r->error != NULL) {
+        printf(",\"result\":\"ERR_LOAD\",\"error\":");
+        print_json_string(r->error);
+        printf("}\n");
+        return;
+    }
+    printf(",\"result\":\"%s\",\"frames\":%ld,\"cycles\":%llu,\"idle\":%llu,\"pc\":%u,\"hash\":\"%016llx\"}\n",
+           tick_result_name(r->result), r->frames, (unsigned long long) r->cycles, (unsigned long long) r->idle, r->pc,
+           (unsigned long long) r->hash);
+}
+
+static char* copy_string(const char* s) {
+    char* copy = malloc(strlen(s) + 1);
+    strcpy(copy, s);
+    return copy;
+}
+
+/*
+ * Returns the number of jobs read into *jobs_out, or -1 if the manifest can't be opened.
+ * ROMs are looked up in corpus if it isn't NULL.
+ */
+static int load_manifest(const char* path, const rom_corpus* corpus, batch_job** jobs_out) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) return -1;
+    char line[MAX_LINE];
+    batch_job* jobs = NULL;
+    int len = 0, cap = 0, line_no = 0;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        char rom[MAX_LINE], input[MAX_LINE];
+        long frames;
+        line_no++;
+        char* hash = strchr(line, '#');
+        if (hash != NULL) *hash = '\0';
+        int fields = sscanf(line, "%s %ld %s", rom, &frames, input);
+        if (fields <= 0) continue;
+        if (fields < 2 || frames < 0) {
+            fprintf(stderr, "%s:%d: expected \"ROM FRAMES [INPUT]\"\n", path, line_no);
+            continue;
+        }
+        if (len == cap) {
+            cap = cap ? cap * 2 : 256;
+            jobs = realloc(jobs, cap * sizeof(batch_job));
+        }
+        jobs[len].rom_path = copy_string(rom);
+        jobs[len].input_path = fields == 3 ? copy_string(input) : NULL;
+        jobs[len].frames = frames;
+        jobs[len].rom = NULL;
+        jobs[len].rom_len = 0;
+        long found = corpus != NULL ? corpus_find(corpus, rom) : -1;
+        if (found >= 0) jobs[len].rom = corpus_rom_data(corpus, (uint32_t) found, &jobs[len].rom_len);
+        len++;
+    }
+    fclose(file);
+    *jobs_out = jobs;
+    return len;
+}
+
+// One job per distinct ROM in the corpus, named by the first of its names
+static int corpus_jobs(const rom_corpus* corpus, long frames, batch_job** jobs_out) {
+    uint32_t count = corpus->header->rom_count;
+    batch_job* jobs = calloc(count > 0 ? count : 1, sizeof(batch_job));
+    for (uint32_t k = 0; k < corpus->header->name_count; k++) {
+        batch_job* job = &jobs[corpus->names[k].rom];
+        if (job->rom_path == NULL) job->rom_path = corpus_name_str(corpus, k);
+    }
+    for (uint32_t k = 0; k < count; k++) {
+        jobs[k].frames = frames;
+        jobs[k].rom = corpus_rom_data(corpus, k, &jobs[k].rom_len);
+        if (jobs[k].rom_path == NULL) jobs[k].rom_path = "";
+    }
+    *jobs_out = jobs;
+    return (int) count;
+}
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void usage(const char* prog) {
+    printf("usage: %s [--threads N] [--ips N] [--mode chip8|schip|xochip] [--corpus FILE] MANIFEST\n", prog);
+    printf("       %s [--threads N] [--ips N] [--mode chip8|schip|xochip] --corpus FILE --frames N\n", prog);
+#ifdef CHIP8_HAVE_JIT
+    printf("       %s [--jit] ...\n", prog);
+#endif
+}
+
+int main(int argc, char *argv[]) {
+    char* manifest_path = NULL;
+    char* corpus_path = NULL;
+    long frames = -1;
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    batch b;
+    b.ips = DEFAULT_IPS;
+    b.mode = MODE_CHIP8;
+    b.use_jit = false;
+    b.corpus = NULL;
+    for (int a = 1; a < argc; a++) {
+        if (strcmp(argv[a], "--threads") == 0 && a + 1 < argc) {
+            threads = strtol(argv[++a], NULL, 10);
+        } else if (strcmp(argv[a], "--ips") == 0 && a + 1 < argc) {
+            b.ips = strtoul(argv[++a], NULL, 10);
+        } else if (strcmp(argv[a], "--mode") == 0 && a + 1 < argc) {
+            if (!chip8_mode_parse(argv[++a], &b.mode)) {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[a], "--corpus") == 0 && a + 1 < argc) {
+            corpus_path = argv[++a];
+        } else if (strcmp(argv[a], "--frames") == 0 && a + 1 < argc) {
+            frames = strtol(argv[++a], NULL, 10);
+#ifdef CHIP8_HAVE_JIT
+        } else if (strcmp(argv[a], "--jit") == 0) {
+            b.use_jit = true;
+#endif
+        } else if (argv[a][0] == '-') {
+            usage(argv[0]);
+            return 1;
+        } else {
+            manifest_path = argv[a];
+        }
+    }
+    if (manifest_path == NULL && (corpus_path == NULL || frames < 0)) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (corpus_path != NULL) {
+        b.corpus = corpus_open(corpus_path);
+        if (b.corpus == NULL) {
+            fprintf(stderr, "Error reading corpus \"%s\"\n", corpus_path);
+            return 1;
+        }
+    }
+    if (manifest_path != NULL) {
+        b.job_count = load_manifest(manifest_path, b.corpus, &b.jobs);
+    } else {
+        b.job_count = corpus_jobs(b.corpus, frames, &b.jobs);
+    }
+    if (b.job_count < 0) {
+        fprintf(stderr, "Error reading \"%s\"\n", manifest_path);
+        return 1;
+    }
+    if (threads < 1) threads = 1;
+    if (threads > b.job_count && b.job_count > 0) threads = b.job_count;
+    b.worker_count = (int) threads;
+    b.results = calloc(b.job_count > 0 ? b.job_count : 1, sizeof(job_result));
+    b.deques = malloc(b.worker_count * sizeof(job_deque));
+    batch_worker* workers = calloc(b.worker_count, sizeof(batch_worker));
+    // Each worker starts with a contiguous share of the manifest
+    for (int w = 0; w < b.worker_count; w++) {
+        job_deque* d = &b.deques[w];
+        int first = (int) ((long) b.job_count * w / b.worker_count);
+        int last = (int) ((long) b.job_count * (w + 1) / b.worker_count);
+        pthread_mutex_init(&d->lock, NULL);
+        d->jobs = malloc((last - first + 1) * sizeof(int));
+        d->head = 0;
+        d->tail = 0;
+        for (int j = first; j < last; j++) d->jobs[d->tail++] = j;
+    }
+    double start = now_seconds();
+    for (int w = 0; w < b.worker_count; w++) {
+        workers[w].b = &b;
+        workers[w].id = w;
+        if (pthread_create(&workers[w].thread, NULL, worker_main, &workers[w]) != 0) {
+            fprintf(stderr, "ERROR: could not start worker thread\n");
+            return 1;
+        }
+    }
+    for (int w = 0; w < b.worker_count; w++) {
+        pthread_join(workers[w].thread, NULL);
+    }
+    double elapsed = now_seconds() - start;
+
+    int failed = 0, stolen = 0;
+    uint64_t cycles = 0;
+    for (int j = 0; j < b.job_count; j++) {
+        print_result(j, &b.jobs[j], &b.results[j]);
+        if (b.results[j].error != NULL || b.results[j].result != SUCCESS) failed++;
+        cycles += b.results[j].cycles;
+    }
+    for (int w = 0; w < b.worker_count; w++) stolen += workers[w].jobs_stolen;
+    fprintf(stderr, "%d jobs (%d failed) on %d threads, %d stolen, %.3f s, %.0f cycles/sec\n",
+            b.job_count, failed, b.worker_count, stolen, elapsed, elapsed > 0 ? cycles / elapsed : 0.0);
+    return failed == 0 ? 0 : 2;
+}
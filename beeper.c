@@ -0,0 +1,90 @@
+#include <string.h>
+#include <math.h>
+#include "beeper.h"
+
+#define BEEPER_VOLUME 3000
+// Pattern bits played per second at the default pitch
+#define BEEPER_BASE_RATE 4000.0
+#define BEEPER_PATTERN_BITS (BEEPER_PATTERN_BYTES * 8)
+
+void beeper_default_tone(beeper_tone* tone) {
+    tone->on = false;
+    tone->pitch = BEEPER_DEFAULT_PITCH;
+    // Four bits on, four off: 500 Hz at the default pitch
+    memset(tone->pattern, 0xF0, sizeof(tone->pattern));
+}
+
+static void beeper_play(beeper* b, const beeper_tone* tone) {
+    b->playing = *tone;
+    b->step = BEEPER_BASE_RATE * pow(2.0, (tone->pitch - 64) / 48.0) / b->sample_rate;
+}
+
+void beeper_init(beeper* b, uint32_t sample_rate, uint32_t latency) {
+    memset(b, 0, sizeof(*b));
+    b->sample_rate = sample_rate;
+    b->latency = latency;
+    b->volume = BEEPER_VOLUME;
+    beeper_default_tone(&b->pushed);
+    beeper_play(b, &b->pushed);
+}
+
+bool beeper_set_tone(beeper* b, uint64_t time, const beeper_tone* tone) {
+    if (memcmp(tone, &b->pushed, sizeof(*tone)) == 0) return true;
+    uint32_t tail = __atomic_load_n(&b->tail, __ATOMIC_ACQUIRE);
+    if (b->head - tail == BEEPER_RING_SIZE) {
+        b->dropped++;
+        return false;
+    }
+    beeper_event* e = &b->ring[b->head & (BEEPER_RING_SIZE - 1)];
+    e->time = time;
+    e->tone = *tone;
+    // The event has to be written before the consumer can see it
+    __atomic_store_n(&b->head, b->head + 1, __ATOMIC_RELEASE);
+    b->pushed = *tone;
+    return true;
+}
+
+void beeper_advance(beeper* b, uint64_t time) {
+    __atomic_store_n(&b->produced, time, __ATOMIC_RELEASE);
+}
+
+void beeper_set_latency(beeper* b, uint32_t latency) {
+    __atomic_store_n(&b->latency, latency, __ATOMIC_RELAXED);
+}
+
+void beeper_render(beeper* b, int16_t* out, uint32_t n) {
+    uint64_t produced = __atomic_load_n(&b->produced, __ATOMIC_ACQUIRE);
+    uint32_t head = __atomic_load_n(&b->head, __ATOMIC_ACQUIRE);
+    uint32_t latency = __atomic_load_n(&b->latency, __ATOMIC_RELAXED);
+    if (b->cursor == 0 && produced < latency) {
+        // Still waiting for the emulation to get far enough ahead to start
+        memset(out, 0, n * sizeof(*out));
+        return;
+    }
+    int64_t lag = (int64_t) (produced - b->cursor);
+    if (lag < (int64_t) n) b->underruns++;
+    // Stalled (rewinding, or a slow frame) or left far behind (running faster than real time)
+    if (lag < 0 || lag > (int64_t) (3 * latency + n)) {
+        b->cursor = produced - latency;
+        b->resyncs++;
+    }
+    uint32_t tail = b->tail;
+    for (uint32_t k = 0; k < n; k++) {
+        while (tail != head && b->ring[tail & (BEEPER_RING_SIZE - 1)].time <= b->cursor + k) {
+            beeper_play(b, &b->ring[tail & (BEEPER_RING_SIZE - 1)].tone);
+            tail++;
+        }
+        if (!b->playing.on) {
+            out[k] = 0;
+            continue;
+        }
+        uint32_t bit = (uint32_t) b->phase;
+        bool high = (b->playing.pattern[bit >> 3] >> (7 - (bit & 7))) & 1;
+        out[k] = high ? b->volume : (int16_t) -b->volume;
+        b->phase += b->step;
+        if (b->phase >= BEEPER_PATTERN_BITS) b->phase -= BEEPER_PATTERN_BITS;
+    }
+    // Hands the slots back to the producer
+    __atomic_store_n(&b->tail, tail, __ATOMIC_RELEASE);
+    b->cursor += n;
+}
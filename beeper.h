@@ -0,0 +1,73 @@
+#ifndef CHIP8_BEEPER_H
+#define CHIP8_BEEPER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Beeper for the sound timer. The emulation thread pushes tone changes stamped with the
+ * sample they happen at, and the audio thread renders samples from them, staying latency
+ * samples behind the point the emulation has reached. The two only share a single
+ * producer, single consumer ring and a couple of counters, so neither ever waits for the other.
+ *
+ * Tones are XO-CHIP style: a 128 bit pattern played in a loop at 4000 * 2^((pitch - 64) / 48)
+ * bits per second. Plain CHIP-8 programs get a square wave at 500 Hz.
+ */
+// Must be a power of two
+#define BEEPER_RING_SIZE 256
+#define BEEPER_PATTERN_BYTES 16
+#define BEEPER_DEFAULT_PITCH 64
+
+typedef struct {
+    bool on;
+    uint8_t pitch;
+    // Most significant bit of the first byte first
+    uint8_t pattern[BEEPER_PATTERN_BYTES];
+} beeper_tone;
+
+typedef struct {
+    // In samples since the beeper started
+    uint64_t time;
+    beeper_tone tone;
+} beeper_event;
+
+typedef struct {
+    uint32_t sample_rate;
+    // Set by the producer, read by the consumer
+    uint32_t latency;
+    int16_t volume;
+    beeper_event ring[BEEPER_RING_SIZE];
+    // Only written by the producer. head and produced are published to the consumer.
+    uint32_t head;
+    uint64_t produced;
+    beeper_tone pushed;
+    uint64_t dropped;
+    // Only written by the consumer. tail is published to the producer.
+    uint32_t tail;
+    uint64_t cursor;
+    beeper_tone playing;
+    // Position in the pattern in bits, and bits per sample for the playing pitch
+    double phase;
+    double step;
+    // Times the audio thread needed samples the emulation hadn't reached yet
+    uint64_t underruns;
+    // Times it was so far off that it jumped back to latency samples behind
+    uint64_t resyncs;
+} beeper;
+
+void beeper_init(beeper* b, uint32_t sample_rate, uint32_t latency);
+// A silent square wave at the default pitch
+void beeper_default_tone(beeper_tone* tone);
+
+// Producer side. Times must not go backwards.
+// Changes the tone from time on. Returns false if the ring was full and the change was dropped.
+bool beeper_set_tone(beeper* b, uint64_t time, const beeper_tone* tone);
+// Tells the consumer the emulation has run up to time
+void beeper_advance(beeper* b, uint64_t time);
+// How far behind the consumer should stay, at least as far apart as beeper_advance calls get
+void beeper_set_latency(beeper* b, uint32_t latency);
+
+// Consumer side: renders the next n samples
+void beeper_render(beeper* b, int16_t* out, uint32_t n);
+
+#endif
@@ -0,0 +1,460 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "vm.h"
+#include "rom.h"
+#ifdef CHIP8_HAVE_JIT
+#include "jit.h"
+#endif
+#ifdef CHIP8_HAVE_LANES
+#include "lanes.h"
+#endif
+#ifdef CHIP8_HAVE_ENV
+#include "env.h"
+#endif
+#ifdef CHIP8_HAVE_SDL
+#include "graphics.h"
+#endif
+
+/*
+ * chip8_bench times the hot paths on their own (decode, single steps, the dispatch loop,
+ * sprite drawing, presenting) and whole programs run unthrottled for a fixed number of
+ * instructions. Every benchmark runs a warm up pass and then --reps timed passes, and
+ * reports the mean and standard deviation of the time per operation. Programs run their idle
+ * loops instruction by instruction, so ROMs that mostly wait still time emulation. Where idle
+ * loops are fast-forwarded (lanes), only the instructions that ran count and the share skipped
+ * is shown separately.
+ * --json prints one JSON object per benchmark instead of the table.
+ */
+
+#ifndef CHIP8_ROM_DIR
+#define CHIP8_ROM_DIR "ROMS"
+#endif
+
+// Instructions per pass of the program benchmarks
+#define PROGRAM_CYCLES 2000000
+
+// V0 += V1, V1 -= V2, V2 ^= V0, V3 += 1, V4 = V3 >> 1, jump back
+static const uint8_t ALU_ROM[] = {
+    0x60, 0x01, 0x61, 0x02, 0x80, 0x14, 0x81, 0x25,
+    0x82, 0x03, 0x73, 0x01, 0x84, 0x36, 0x12, 0x04,
+};
+
+// Draws an 8x8 box at random positions forever
+static const uint8_t SPRITE_ROM[] = {
+    0xA2, 0x0C, 0xC0, 0x3F, 0xC1, 0x1F, 0xD0, 0x18,
+    0x12, 0x02, 0x00, 0x00, 0xFF, 0x81, 0x81, 0x81,
+    0x81, 0x81, 0x81, 0xFF,
+};
+
+// Two levels of nested calls per loop
+static const uint8_t CALL_ROM[] = {
+    0x22, 0x06, 0x12, 0x00, 0x00, 0x00, 0x22, 0x0C,
+    0x70, 0x01, 0x00, 0xEE, 0x71, 0x01, 0x00, 0xEE,
+};
+
+// V0 = a random bit, then V1 or V2 counts it and both paths join up to count in V3
+static const uint8_t BRANCH_ROM[] = {
+    0xC0, 0x01, 0x30, 0x00, 0x12, 0x0A, 0x71, 0x01,
+    0x12, 0x0C, 0x72, 0x01, 0x73, 0x01, 0x12, 0x00,
+};
+
+typedef struct {
+    const char* name;
+    int reps;
+    // Operations per pass, and what an operation is
+    uint64_t ops;
+    const char* unit;
+    double mean_ns;
+    double stddev_ns;
+    double min_ns;
+    // Emulated frames per operation, 0 when frames don't apply
+    double frames_per_op;
+    // Instructions the last pass fast-forwarded through idle loops, which ops leave out
+    uint64_t idle_ops;
+} bench_result;
+
+typedef struct {
+    int reps;
+    bool json;
+    bool use_jit;
+    const char* filter;
+} bench_options;
+
+// One timed pass: does its work and returns the number of operations it did
+typedef uint64_t (*bench_fn)(void* ctx);
+
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Keeps the compiler from dropping work whose result is never used
+static volatile uint64_t sink;
+// Set by passes that run programs to the instructions skipped as idle rather than run
+static uint64_t pass_idle;
+
+static void report(const bench_options* opt, const bench_result* r) {
+    double ops_per_sec = r->mean_ns > 0 ? 1e9 / r->mean_ns : 0;
+    // Skipped instructions still count towards the frames emulated
+    double emulated = r->ops > 0 ? (double) (r->ops + r->idle_ops) / r->ops : 1;
+    double frames_per_sec = ops_per_sec * emulated * r->frames_per_op;
+    if (opt->json) {
+        printf("{\"bench\":\"%s\",\"unit\":\"%s\",\"reps\":%d,\"ops\":%llu,\"ns_per_op\":%.3f,"
+               "\"ns_per_op_stddev\":%.3f,\"ns_per_op_min\":%.3f,\"ops_per_sec\":%.0f",
+               r->name, r->unit, r->reps, (unsigned long long) r->ops, r->mean_ns, r->stddev_ns,
+               r->min_ns, ops_per_sec);
+        if (r->frames_per_op > 0) {
+            printf(",\"idle_ops\":%llu,\"frames_per_sec\":%.1f", (unsigned long long) r->idle_ops, frames_per_sec);
+        }
+        printf("}\n");
+        return;
+    }
+    printf("%-24s %10.2f ns/%-11s +- %5.1f%%  %14.0f %s/sec", r->name, r->mean_ns, r->unit,
+           r->mean_ns > 0 ? 100 * r->stddev_ns / r->mean_ns : 0, ops_per_sec, r->unit);
+    if (r->frames_per_op > 0) {
+        printf("  %10.0f frames/sec  %5.1f%% idle", frames_per_sec,
+               100.0 * r->idle_ops / (r->ops + r->idle_ops > 0 ? r->ops + r->idle_ops : 1));
+    }
+    printf("\n");
+}
+
+static void run_bench(const bench_options* opt, const char* name, const char* unit, bench_fn fn, void* ctx,
+                      double frames_per_op) {
+    if (opt->filter != NULL && strstr(name, opt->filter) == NULL) return;
+    bench_result r = {name, opt->reps, 0, unit, 0, 0, INFINITY, frames_per_op, 0};
+    double sum = 0, sum_sq = 0;
+    fn(ctx);
+    for (int rep = 0; rep < opt->reps; rep++) {
+        pass_idle = 0;
+        double start = now_ns();
+        uint64_t ops = fn(ctx);
+        r.idle_ops = pass_idle;
+        double ns = (now_ns() - start) / (ops > 0 ? ops : 1);
+        r.ops = ops;
+        sum += ns;
+        sum_sq += ns * ns;
+        if (ns < r.min_ns) r.min_ns = ns;
+    }
+    r.mean_ns = sum / opt->reps;
+    double var = sum_sq / opt->reps - r.mean_ns * r.mean_ns;
+    r.stddev_ns = var > 0 ? sqrt(var) : 0;
+    report(opt, &r);
+}
+
+static uint64_t bench_decode(void* ctx) {
+    (void) ctx;
+    uint64_t acc = 0;
+    for (int rep = 0; rep < 16; rep++) {
+        for (uint32_t op = 0; op <= 0xFFFF; op++) {
+            instruction inst = decode_instruction((uint16_t) op, MODE_CHIP8);
+            acc += inst.tag + inst.data;
+        }
+    }
+    sink = acc;
+    return 16 * 0x10000;
+}
+
+typedef struct {
+    chip8_vm* vm;
+    const uint8_t* rom;
+    long rom_len;
+    uint64_t cycles;
+#ifdef CHIP8_HAVE_JIT
+    chip8_jit* jit;
+#endif
+} program_bench;
+
+static void program_reset(program_bench* p) {
+    memset(p->vm, 0, sizeof(chip8_vm));
+    vm_load_program(p->vm, DEFAULT_IPS, p->rom, p->rom_len);
+#ifdef CHIP8_HAVE_JIT
+    if (p->jit != NULL) jit_attach(p->jit, p->vm);
+#endif
+    // ROMs that mostly wait would otherwise time the reset above rather than any emulation
+    p->vm->engine.no_idle_skip = true;
+}
+
+static uint64_t bench_tick(void* ctx) {
+    program_bench* p = ctx;
+    program_reset(p);
+    for (uint64_t k = 0; k < p->cycles; k++) {
+        vm_tick(p->vm);
+    }
+    return p->cycles;
+}
+
+static uint64_t bench_execute(void* ctx) {
+    program_bench* p = ctx;
+    program_reset(p);
+    vm_execute(p->vm, (uint32_t) p->cycles);
+    pass_idle = p->vm->idle_cycles;
+    return p->vm->cycles - p->vm->idle_cycles;
+}
+
+/*
+ * Runs like the frontends do, through vm_run_cycles, so the timers and the engine are included.
+ * Idle loops run instruction by instruction (see program_reset), so every instruction counts.
+ */
+static uint64_t bench_program(void* ctx) {
+    program_bench* p = ctx;
+    program_reset(p);
+    vm_run_cycles(p->vm, p->cycles);
+    pass_idle = p->vm->idle_cycles;
+    return p->vm->cycles - p->vm->idle_cycles;
+}
+
+static uint64_t bench_draw(void* ctx) {
+    framebuffer* fb = ctx;
+    static const uint8_t sprite[15] = {0xFF, 0x81, 0xBD, 0xA5, 0xA5, 0xBD, 0x81, 0xFF,
+                                       0x3C, 0x42, 0x81, 0x81, 0x42, 0x3C, 0x18};
+    uint64_t hits = 0;
+    set_screen_size(fb, SCREEN_WIDTH, SCREEN_HEIGHT);
+    for (uint32_t k = 0; k < 1000000; k++) {
+        hits += draw_sprite(fb, (uint8_t) (k * 7), (uint8_t) (k * 3), sprite, 15);
+    }
+    sink = hits;
+    return 1000000;
+}
+
+#ifdef CHIP8_HAVE_SDL
+static uint64_t bench_display(void* ctx) {
+    sdl_handle* gfx = ctx;
+    static framebuffer fb;
+    set_screen_size(&fb, SCREEN_WIDTH, SCREEN_HEIGHT);
+    for (int k = 0; k < 200; k++) {
+        fb.planes[0][k % SCREEN_HEIGHT][0] ^= 1ULL << (k % 64);
+        fb.dirty_rows = ALL_ROWS_DIRTY;
+        display_screen(gfx, &fb);
+    }
+    return 200;
+}
+#endif
+
+static void bench_rom(const bench_options* opt, program_bench* p, const char* name, const uint8_t* rom,
+                      long rom_len) {
+    char full_name[64];
+    double frames_per_cycle = (double) TIMER_HZ / DEFAULT_IPS;
+    p->rom = rom;
+    p->rom_len = rom_len;
+    p->cycles = PROGRAM_CYCLES;
+    snprintf(full_name, sizeof(full_name), "%s/interp", name);
+#ifdef CHIP8_HAVE_JIT
+    p->jit = NULL;
+#endif
+    run_bench(opt, full_name, "instr", bench_program, p, frames_per_cycle);
+#ifdef CHIP8_HAVE_JIT
+    if (opt->use_jit) {
+        p->jit = jit_new();
+        if (p->jit == NULL) return;
+        snprintf(full_name, sizeof(full_name), "%s/jit", name);
+        run_bench(opt, full_name, "instr", bench_program, p, frames_per_cycle);
+        jit_free(p->jit);
+        p->jit = NULL;
+    }
+#endif
+}
+
+#ifdef CHIP8_HAVE_LANES
+// Copies of a program run at once, each with its own seed
+#define LANE_COUNT 256
+
+typedef struct {
+    const uint8_t* rom;
+    long rom_len;
+    uint32_t frames;
+    chip8_lanes* lanes;
+    chip8_vm* vms;
+} lanes_bench;
+
+static uint64_t bench_lanes(void* ctx) {
+    lanes_bench* b = ctx;
+    lanes_free(b->lanes);
+    b->lanes = lanes_new(LANE_COUNT, DEFAULT_IPS, b->rom, (int) b->rom_len);
+    if (b->lanes == NULL) return 0;
+    for (uint32_t k = 0; k < LANE_COUNT; k++) {
+        lanes_seed(b->lanes, k, k + 1);
+    }
+    for (uint32_t f = 0; f < b->frames; f++) {
+        lanes_run_frame(b->lanes);
+    }
+    uint64_t cycles = 0;
+    for (uint32_t k = 0; k < LANE_COUNT; k++) {
+        uint64_t idle;
+        cycles += lanes_cycles(b->lanes, k, &idle);
+        pass_idle += idle;
+    }
+    return cycles - pass_idle;
+}
+
+// The same, a VM at a time, the way chip8_batch runs them
+static uint64_t bench_vms(void* ctx) {
+    lanes_bench* b = ctx;
+    uint64_t cycles = 0;
+    for (uint32_t k = 0; k < LANE_COUNT; k++) {
+        memset(&b->vms[k], 0, sizeof(chip8_vm));
+        vm_load_program(&b->vms[k], DEFAULT_IPS, b->rom, b->rom_len);
+        vm_seed(&b->vms[k], k + 1);
+    }
+    for (uint32_t f = 0; f < b->frames; f++) {
+        for (uint32_t k = 0; k < LANE_COUNT; k++) {
+            vm_run_frame(&b->vms[k]);
+        }
+    }
+    for (uint32_t k = 0; k < LANE_COUNT; k++) {
+        cycles += b->vms[k].cycles;
+        pass_idle += b->vms[k].idle_cycles;
+    }
+    return cycles - pass_idle;
+}
+
+static void bench_lanes_rom(const bench_options* opt, const char* name, const uint8_t* rom, long rom_len) {
+    char full_name[64];
+    static chip8_vm scratch;
+    lanes_bench b = {rom, rom_len, PROGRAM_CYCLES / (LANE_COUNT * (DEFAULT_IPS / TIMER_HZ)), NULL, NULL};
+    double frames_per_cycle = (double) TIMER_HZ / DEFAULT_IPS;
+    b.vms = calloc(LANE_COUNT, sizeof(chip8_vm));
+    if (b.vms == NULL) return;
+    snprintf(full_name, sizeof(full_name), "%s/lanes", name);
+    run_bench(opt, full_name, "instr", bench_lanes, &b, frames_per_cycle);
+    snprintf(full_name, sizeof(full_name), "%s/vms", name);
+    run_bench(opt, full_name, "instr", bench_vms, &b, frames_per_cycle);
+    // Both ran (unless filtered out), so every lane has to have ended up where its VM did
+    if (b.lanes != NULL && b.vms[0].cycles > 0) {
+        for (uint32_t k = 0; k < LANE_COUNT; k++) {
+            lanes_export(b.lanes, k, &scratch);
+            const char* diff = vm_state_diff(&b.vms[k], &scratch);
+            if (diff != NULL) {
+                fprintf(stderr, "%s: lane %u has a different %s from its VM\n", name, k, diff);
+                break;
+            }
+        }
+    }
+    lanes_free(b.lanes);
+    free(b.vms);
+}
+#endif
+
+#ifdef CHIP8_HAVE_ENV
+// Environments stepped at once, and frames per step, the way a training loop would
+#define ENV_COUNT 1024
+#define ENV_FRAMES 4
+#define ENV_STEPS 50
+
+typedef struct {
+    chip8_env* env;
+    uint16_t actions[ENV_COUNT];
+    float rewards[ENV_COUNT];
+    uint8_t dones[ENV_COUNT];
+} env_bench;
+
+// Episodes carry on from pass to pass, like a training loop that only resets when one ends
+static uint64_t bench_env_step(void* ctx) {
+    env_bench* b = ctx;
+    for (uint32_t step = 0; step < ENV_STEPS; step++) {
+        for (uint32_t k = 0; k < ENV_COUNT; k++) {
+            b->actions[k] = (uint16_t) (1u << ((k + step) % 16));
+        }
+        env_step(b->env, b->actions, b->rewards, b->dones);
+    }
+    return ENV_STEPS;
+}
+#endif
+
+void usage(const char* prog) {
+    printf("usage: %s [--reps N] [--json] [--filter NAME] [--roms DIR]\n", prog);
+#ifdef CHIP8_HAVE_JIT
+    printf("       %s [--no-jit] ...\n", prog);
+#endif
+}
+
+int main(int argc, char *argv[]) {
+    bench_options opt = {10, false, false, NULL};
+    const char* rom_dir = CHIP8_ROM_DIR;
+#ifdef CHIP8_HAVE_JIT
+    opt.use_jit = true;
+#endif
+    for (int a = 1; a < argc; a++) {
+        if (strcmp(argv[a], "--reps") == 0 && a + 1 < argc) {
+            opt.reps = atoi(argv[++a]);
+        } else if (strcmp(argv[a], "--json") == 0) {
+            opt.json = true;
+        } else if (strcmp(argv[a], "--filter") == 0 && a + 1 < argc) {
+            opt.filter = argv[++a];
+        } else if (strcmp(argv[a], "--roms") == 0 && a + 1 < argc) {
+            rom_dir = argv[++a];
+        } else if (strcmp(argv[a], "--no-jit") == 0) {
+            opt.use_jit = false;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (opt.reps < 1) opt.reps = 1;
+
+    // Micro benchmarks
+    run_bench(&opt, "decode_instruction", "decode", bench_decode, NULL, 0);
+    static chip8_vm vm;
+    // Designated, so the JIT (when there is one) starts out NULL
+    program_bench p = {.vm = &vm, .rom = ALU_ROM, .rom_len = sizeof(ALU_ROM), .cycles = 1000000};
+    run_bench(&opt, "vm_tick/alu", "tick", bench_tick, &p, 0);
+    run_bench(&opt, "vm_execute/alu", "instr", bench_execute, &p, 0);
+    static framebuffer fb;
+    run_bench(&opt, "draw_sprite/8x15", "sprite", bench_draw, &fb, 0);
+#ifdef CHIP8_HAVE_SDL
+    if (opt.filter == NULL || strstr("display_screen", opt.filter) != NULL) {
+        sdl_handle gfx = graphics_init();
+        run_bench(&opt, "display_screen", "present", bench_display, &gfx, 0);
+        SDL_Quit();
+    }
+#endif
+
+    // Synthetic programs
+    bench_rom(&opt, &p, "alu_loop", ALU_ROM, sizeof(ALU_ROM));
+    bench_rom(&opt, &p, "sprite_loop", SPRITE_ROM, sizeof(SPRITE_ROM));
+    bench_rom(&opt, &p, "call_return", CALL_ROM, sizeof(CALL_ROM));
+#ifdef CHIP8_HAVE_LANES
+    // Many copies at once, in lanes and as separate VMs
+    bench_lanes_rom(&opt, "alu_loop", ALU_ROM, sizeof(ALU_ROM));
+    bench_lanes_rom(&opt, "sprite_loop", SPRITE_ROM, sizeof(SPRITE_ROM));
+    bench_lanes_rom(&opt, "call_return", CALL_ROM, sizeof(CALL_ROM));
+    bench_lanes_rom(&opt, "branch_loop", BRANCH_ROM, sizeof(BRANCH_ROM));
+#endif
+
+#ifdef CHIP8_HAVE_ENV
+    if (opt.filter == NULL || strstr("env_step/branch_loop", opt.filter) != NULL) {
+        static env_bench eb;
+        env_config config = {MODE_CHIP8, DEFAULT_IPS, ENV_FRAMES, 0, 0, 0, 0};
+        eb.env = env_create(&config, BRANCH_ROM, sizeof(BRANCH_ROM), ENV_COUNT, NULL);
+        if (eb.env != NULL) {
+            run_bench(&opt, "env_step/branch_loop", "step", bench_env_step, &eb, ENV_COUNT * ENV_FRAMES);
+            env_destroy(eb.env);
+        }
+    }
+#endif
+
+    // Real programs
+    const char* roms[] = {"test_opcode.ch8", "IBM_Logo.ch8"};
+    for (int k = 0; k < 2; k++) {
+        char path[1024];
+        long len;
+        snprintf(path, sizeof(path), "%s/%s", rom_dir, roms[k]);
+        uint8_t* rom = read_binary_file(path, &len);
+        if (rom == NULL || len > MAX_ROM_SIZE) {
+            fprintf(stderr, "skipping %s: could not load it\n", path);
+            free(rom);
+            continue;
+        }
+        bench_rom(&opt, &p, roms[k], rom, len);
+#ifdef CHIP8_HAVE_LANES
+        bench_lanes_rom(&opt, roms[k], rom, len);
+#endif
+        free(rom);
+    }
+    return 0;
+}
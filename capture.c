@@ -0,0 +1,349 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include "capture.h"
+
+#define CAPTURE_FPS 60
+// Stored deflate blocks hold at most this many bytes
+#define DEFLATE_STORED_MAX 65535
+
+typedef struct {
+    framebuffer fb;
+    // Times the frame is written: itself, then repeats of it that came in while it was queued
+    uint32_t count;
+    // Only a repeat of the frame written last, fb isn't set
+    bool repeat;
+} capture_item;
+
+struct capture {
+    bool y4m;
+    char* path;
+    FILE* out;
+    uint32_t width;
+    uint32_t height;
+    bool wait_when_full;
+    pthread_t writer;
+    pthread_mutex_t lock;
+    // Signalled when the queue gets an item or the capture closes, and when the writer frees a slot
+    pthread_cond_t filled;
+    pthread_cond_t drained;
+    capture_item queue[CAPTURE_QUEUE_LEN];
+    uint32_t head;
+    uint32_t len;
+    bool closing;
+    // Emulation side: the last frame queued, to spot repeats
+    framebuffer last;
+    bool have_last;
+    // Writer side: the encoded last frame, the scaled pixels it came from, and the totals
+    uint8_t* encoded;
+    size_t encoded_len;
+    uint8_t* pixels;
+    uint64_t frames;
+    uint64_t repeats;
+    uint64_t dropped;
+    uint64_t files;
+    bool failed;
+};
+
+static bool ends_with(const char* s, const char* suffix) {
+    size_t len = strlen(s), suffix_len = strlen(suffix);
+    return len >= suffix_len && strcmp(s + len - suffix_len, suffix) == 0;
+}
+
+/*
+ * Whether a path is safe to number PNGs with as a printf format: exactly one %d, which may be
+ * zero padded to a width of up to two digits (%05d), and no other conversions besides %%.
+ */
+static bool numbered_pattern(const char* path) {
+    int numbers = 0;
+    for (const char* p = strchr(path, '%'); p != NULL; p = strchr(p, '%')) {
+        p++;
+        if (*p == '%') {
+            p++;
+            continue;
+        }
+        if (*p == '0') p++;
+        for (int digits = 0; *p >= '0' && *p <= '9'; digits++, p++) {
+            if (digits == 2) return false;
+        }
+        if (*p != 'd') return false;
+        p++;
+        numbers++;
+    }
+    return numbers == 1;
+}
+
+// Grey levels for the pixel colours, matching the window's palette
+static const uint8_t LEVELS[1 << FB_PLANES] = {0x00, 0xFF, 0xAA, 0x55};
+
+// Nearest neighbour: the colour of every pixel of the output, whatever size the display is
+static void scale_frame(capture* c, const framebuffer* fb) {
+    for (uint32_t y = 0; y < c->height; y++) {
+        uint8_t* row = c->pixels + (size_t) y * c->width;
+        uint32_t fy = y * fb->height / c->height;
+        if (y > 0 && fy == (y - 1) * fb->height / c->height) {
+            memcpy(row, row - c->width, c->width);
+            continue;
+        }
+        for (uint32_t x = 0; x < c->width; x++) {
+            row[x] = screen_pixel(fb, (int) (x * fb->width / c->width), (int) fy);
+        }
+    }
+}
+
+static void encode_y4m(capture* c) {
+    size_t luma = (size_t) c->width * c->height;
+    size_t chroma = luma / 4;
+    static const char header[] = "FRAME\n";
+    size_t len = sizeof(header) - 1;
+    memcpy(c->encoded, header, len);
+    for (size_t k = 0; k < luma; k++) c->encoded[len + k] = LEVELS[c->pixels[k]];
+    // No colour: both chroma planes are neutral
+    memset(c->encoded + len + luma, 0x80, 2 * chroma);
+    c->encoded_len = len + luma + 2 * chroma;
+}
+
+static uint32_t crc_table[256];
+
+static void make_crc_table() {
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t v = n;
+        for (int k = 0; k < 8; k++) v = (v & 1) ? 0xEDB88320u ^ (v >> 1) : v >> 1;
+        crc_table[n] = v;
+    }
+}
+
+static uint32_t crc32(const uint8_t* data, size_t len) {
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t k = 0; k < len; k++) crc = crc_table[(crc ^ data[k]) & 0xFF] ^ (crc >> 8);
+    return crc ^ 0xFFFFFFFFu;
+}
+
+static uint8_t* put_be32(uint8_t* p, uint32_t v) {
+    p[0] = (uint8_t) (v >> 24);
+    p[1] = (uint8_t) (v >> 16);
+    p[2] = (uint8_t) (v >> 8);
+    p[3] = (uint8_t) v;
+    return p + 4;
+}
+
+// Appends a chunk whose data is already at p + 8, returning the end of it
+static uint8_t* finish_png_chunk(uint8_t* p, const char* type, uint32_t len) {
+    put_be32(p, len);
+    memcpy(p + 4, type, 4);
+    return put_be32(p + 8 + len, crc32(p + 4, len + 4));
+}
+
+/*
+ * A 2 bit palette PNG, enough for XO-CHIP's four colours. The pixel data is a handful of
+ * KB at that depth, so it goes in stored (uncompressed) deflate blocks and no zlib is needed.
+ */
+static void encode_png(capture* c) {
+    static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    uint32_t stride = 1 + (c->width + 3) / 4;
+    size_t raw_len = (size_t) stride * c->height;
+    uint8_t* p = c->encoded;
+    memcpy(p, signature, 8);
+    p += 8;
+    uint8_t* d = p + 8;
+    d = put_be32(d, c->width);
+    d = put_be32(d, c->height);
+    // Bit depth 2, colour type 3 (palette), deflate, no filtering, no interlace
+    *d++ = 2; *d++ = 3; *d++ = 0; *d++ = 0; *d++ = 0;
+    p = finish_png_chunk(p, "IHDR", 13);
+    for (int k = 0; k < 1 << FB_PLANES; k++) {
+        memset(p + 8 + 3 * k, LEVELS[k], 3);
+    }
+    p = finish_png_chunk(p, "PLTE", 3 << FB_PLANES);
+    // zlib stream: header, stored blocks of the filtered rows, Adler-32 of the rows
+    uint8_t* idat = p;
+    d = p + 8;
+    *d++ = 0x78;
+    *d++ = 0x01;
+    uint32_t a = 1, b = 0;
+    size_t in_block = 0;
+    size_t left = raw_len;
+    for (uint32_t y = 0; y < c->height; y++) {
+        const uint8_t* pixels = c->pixels + (size_t) y * c->width;
+        for (uint32_t k = 0; k < stride; k++) {
+            uint8_t byte = 0;
+            if (k > 0) {
+                for (uint32_t px = 0; px < 4; px++) {
+                    uint32_t x = (k - 1) * 4 + px;
+                    if (x < c->width) byte |= pixels[x] << (6 - 2 * px);
+                }
+            }
+            if (in_block == 0) {
+                size_t len = left < DEFLATE_STORED_MAX ? left : DEFLATE_STORED_MAX;
+                *d++ = left == len ? 1 : 0;
+                *d++ = (uint8_t) len;
+                *d++ = (uint8_t) (len >> 8);
+                *d++ = (uint8_t) ~len;
+                *d++ = (uint8_t) (~len >> 8);
+                in_block = len;
+            }
+            *d++ = byte;
+            in_block--;
+            left--;
+            a = (a + byte) % 65521;
+            b = (b + a) % 65521;
+        }
+    }
+    d = put_be32(d, (b << 16) | a);
+    p = finish_png_chunk(idat, "IDAT", (uint32_t) (d - (idat + 8)));
+    p = finish_png_chunk(p, "IEND", 0);
+    c->encoded_len = (size_t) (p - c->encoded);
+}
+
+static bool write_encoded(capture* c) {
+    if (c->y4m) return fwrite(c->encoded, 1, c->encoded_len, c->out) == c->encoded_len;
+    char name[4096];
+    snprintf(name, sizeof(name), c->path, (int) c->files);
+    c->files++;
+    FILE* file = fopen(name, "wb");
+    if (file == NULL) return false;
+    bool ok = fwrite(c->encoded, 1, c->encoded_len, file) == c->encoded_len;
+    return fclose(file) == 0 && ok;
+}
+
+static void* writer_main(void* arg) {
+    capture* c = arg;
+    pthread_mutex_lock(&c->lock);
+    for (;;) {
+        while (c->len == 0 && !c->closing) pthread_cond_wait(&c->filled, &c->lock);
+        if (c->len == 0) break;
+        // The item stays in the queue while it's encoded, so the emulation can still add repeats to it
+        capture_item* item = &c->queue[c->head];
+        bool repeat = item->repeat;
+        pthread_mutex_unlock(&c->lock);
+        if (!repeat) {
+            scale_frame(c, &item->fb);
+            if (c->y4m) {
+                encode_y4m(c);
+            } else {
+                encode_png(c);
+            }
+        }
+        pthread_mutex_lock(&c->lock);
+        uint32_t count = item->count;
+        c->head = (c->head + 1) % CAPTURE_QUEUE_LEN;
+        c->len--;
+        pthread_cond_signal(&c->drained);
+        pthread_mutex_unlock(&c->lock);
+        for (uint32_t k = 0; k < count && !c->failed; k++) {
+            if (c->encoded_len > 0 && !write_encoded(c)) c->failed = true;
+        }
+        c->frames += count;
+        c->repeats += repeat ? count : count - 1;
+        pthread_mutex_lock(&c->lock);
+    }
+    pthread_mutex_unlock(&c->lock);
+    return NULL;
+}
+
+capture* capture_open(const char* path, uint32_t width, uint32_t height, bool wait_when_full) {
+    capture* c = calloc(1, sizeof(capture));
+    if (c == NULL) return NULL;
+    c->y4m = ends_with(path, ".y4m");
+    // 4:2:0 chroma needs even sizes
+    c->width = width > 2 ? width + width % 2 : 2;
+    c->height = height > 2 ? height + height % 2 : 2;
+    c->wait_when_full = wait_when_full;
+    c->path = strdup(path);
+    // Y4M takes one byte per pixel plus half that again for chroma, a PNG at most a quarter plus framing
+    size_t luma = (size_t) c->width * c->height;
+    c->encoded = malloc(c->y4m ? 16 + luma + luma / 2 : 128 + luma / 4 + (size_t) c->height * 8);
+    c->pixels = malloc(luma);
+    if (c->y4m) {
+        c->out = fopen(path, "wb");
+        if (c->out != NULL) {
+            fprintf(c->out, "YUV4MPEG2 W%u H%u F%d:1 Ip A1:1 C420jpeg\n", c->width, c->height, CAPTURE_FPS);
+        }
+    } else if (!numbered_pattern(path)) {
+        printf("Capture path \"%s\" needs to end in .y4m, or have exactly one %%d (or %%0Nd) and no other conversions in it for numbered PNGs\n", path);
+        c->failed = true;
+    }
+    if (c->path == NULL || c->encoded == NULL || c->pixels == NULL || c->failed || (c->y4m && c->out == NULL)) {
+        if (c->out != NULL) fclose(c->out);
+        free(c->path);
+        free(c->encoded);
+        free(c->pixels);
+        free(c);
+        return NULL;
+    }
+    make_crc_table();
+    pthread_mutex_init(&c->lock, NULL);
+    pthread_cond_init(&c->filled, NULL);
+    pthread_cond_init(&c->drained, NULL);
+    if (pthread_create(&c->writer, NULL, writer_main, c) != 0) {
+        if (c->out != NULL) fclose(c->out);
+        free(c->path);
+        free(c->encoded);
+        free(c->pixels);
+        free(c);
+        return NULL;
+    }
+    return c;
+}
+
+// Only the visible part of the display counts, and its size
+static bool same_frame(const framebuffer* a, const framebuffer* b) {
+    if (a->width != b->width || a->height != b->height) return false;
+    for (int p = 0; p < FB_PLANES; p++) {
+        for (int y = 0; y < a->height; y++) {
+            if (memcmp(a->planes[p][y], b->planes[p][y], a->width / 8) != 0) return false;
+        }
+    }
+    return true;
+}
+
+void capture_frame(capture* c, const framebuffer* fb) {
+    bool repeat = c->have_last && same_frame(fb, &c->last);
+    pthread_mutex_lock(&c->lock);
+    if (repeat && c->len > 0) {
+        // Still queued, so the repeat costs nothing but a count
+        c->queue[(c->head + c->len - 1) % CAPTURE_QUEUE_LEN].count++;
+        pthread_mutex_unlock(&c->lock);
+        return;
+    }
+    while (c->len == CAPTURE_QUEUE_LEN && c->wait_when_full) pthread_cond_wait(&c->drained, &c->lock);
+    if (c->len == CAPTURE_QUEUE_LEN) {
+        c->dropped++;
+        pthread_mutex_unlock(&c->lock);
+        return;
+    }
+    capture_item* item = &c->queue[(c->head + c->len) % CAPTURE_QUEUE_LEN];
+    item->count = 1;
+    item->repeat = repeat;
+    if (!repeat) item->fb = *fb;
+    c->len++;
+    pthread_cond_signal(&c->filled);
+    pthread_mutex_unlock(&c->lock);
+    if (!repeat) {
+        c->last = *fb;
+        c->have_last = true;
+    }
+}
+
+bool capture_close(capture* c) {
+    pthread_mutex_lock(&c->lock);
+    c->closing = true;
+    pthread_cond_signal(&c->filled);
+    pthread_mutex_unlock(&c->lock);
+    pthread_join(c->writer, NULL);
+    if (c->out != NULL && fclose(c->out) != 0) c->failed = true;
+    printf("capture: %llu frames (%llu repeats) to %s", (unsigned long long) c->frames,
+           (unsigned long long) c->repeats, c->path);
+    if (c->dropped > 0) printf(", %llu dropped because the writer fell behind", (unsigned long long) c->dropped);
+    printf("\n");
+    bool ok = !c->failed;
+    pthread_mutex_destroy(&c->lock);
+    pthread_cond_destroy(&c->filled);
+    pthread_cond_destroy(&c->drained);
+    free(c->path);
+    free(c->encoded);
+    free(c->pixels);
+    free(c);
+    return ok;
+}
@@ -0,0 +1,33 @@
+#ifndef CHIP8_CAPTURE_H
+#define CHIP8_CAPTURE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "framebuffer.h"
+
+/*
+ * Video capture. Frames are queued straight from the framebuffer, one bit per pixel, and a
+ * background thread scales and encodes them, so the emulation only pays for a copy. A frame
+ * the same as the one before it is queued as a repeat and written from the last encoding.
+ *
+ * A path ending in ".y4m" gets one Y4M stream at 60 fps, which ffmpeg and most players read.
+ * Any other path is a printf pattern for numbered PNG files, such as "shots/frame%05d.png".
+ */
+// Distinct frames that can wait for the writer
+#define CAPTURE_QUEUE_LEN 64
+
+typedef struct capture capture;
+
+/*
+ * Starts the writer. Output frames are width by height (even numbers, for Y4M) whatever
+ * the display size, so they should be a multiple of the largest display the program can
+ * switch to. With wait_when_full, capture_frame waits for room in the queue (for runs that
+ * aren't tied to real time), otherwise it drops the frame.
+ * Returns NULL if the output can't be created.
+ */
+capture* capture_open(const char* path, uint32_t width, uint32_t height, bool wait_when_full);
+void capture_frame(capture* c, const framebuffer* fb);
+// Writes out the rest of the queue, stops the writer and prints the totals. Returns false if any write failed.
+bool capture_close(capture* c);
+
+#endif
@@ -0,0 +1,312 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "corpus.h"
+#include "rom.h"
+#include "vm.h"
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define CORPUS_MMAP
+#endif
+
+static bool host_is_little_endian() {
+    uint16_t one = 1;
+    return *(uint8_t*) &one == 1;
+}
+
+// Checks every offset and the sort order, so lookups can trust the file afterwards
+static bool corpus_valid(const rom_corpus* c) {
+    const corpus_header* h = c->header;
+    if (c->size < sizeof(corpus_header) || memcmp(h->magic, CORPUS_MAGIC, 4) != 0) return false;
+    if (h->version != CORPUS_VERSION || h->file_size != c->size) return false;
+    if (h->roms_offset % 8 != 0 || h->names_offset % 4 != 0) return false;
+    if (h->roms_offset + (uint64_t) h->rom_count * sizeof(corpus_rom) > h->names_offset) return false;
+    if (h->names_offset + (uint64_t) h->name_count * sizeof(corpus_name) > h->strings_offset) return false;
+    if (h->strings_offset > h->data_offset || h->data_offset > c->size) return false;
+    uint32_t strings_size = h->data_offset - h->strings_offset;
+    if (h->name_count > 0 && (strings_size == 0 || c->strings[strings_size - 1] != '\0')) return false;
+    for (uint32_t k = 0; k < h->rom_count; k++) {
+        const corpus_rom* r = &c->roms[k];
+        if (r->offset < h->data_offset || r->offset + (uint64_t) r->length > c->size) return false;
+        if (r->length == 0 || r->length > XO_MAX_ROM_SIZE) return false;
+        if (k > 0 && c->roms[k - 1].hash >= r->hash) return false;
+    }
+    for (uint32_t k = 0; k < h->name_count; k++) {
+        const corpus_name* n = &c->names[k];
+        if (n->string >= strings_size || n->rom >= h->rom_count) return false;
+        if (k > 0 && strcmp(c->strings + c->names[k - 1].string, c->strings + n->string) >= 0) return false;
+    }
+    return true;
+}
+
+rom_corpus* corpus_open(const char* path) {
+    if (!host_is_little_endian()) return NULL;
+    rom_corpus* c = calloc(1, sizeof(rom_corpus));
+    if (c == NULL) return NULL;
+#ifdef CORPUS_MMAP
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(corpus_header)) {
+        if (fd >= 0) close(fd);
+        free(c);
+        return NULL;
+    }
+    void* base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping keeps the file alive on its own
+    close(fd);
+    if (base == MAP_FAILED) {
+        free(c);
+        return NULL;
+    }
+#ifdef MADV_WILLNEED
+    madvise(base, st.st_size, MADV_WILLNEED);
+#endif
+    c->base = base;
+    c->size = st.st_size;
+    c->mapped = true;
+#else
+    long size;
+    c->base = read_binary_file(path, &size);
+    c->size = c->base != NULL ? size : 0;
+    if (c->size < sizeof(corpus_header)) {
+        free((void*) c->base);
+        free(c);
+        return NULL;
+    }
+#endif
+    c->header = (const corpus_header*) c->base;
+    // Only dereferenced once corpus_valid has checked the offsets
+    c->roms = (const corpus_rom*) (c->base + c->header->roms_offset);
+    c->names = (const corpus_name*) (c->base + c->header->names_offset);
+    c->strings = (const char*) (c->base + c->header->strings_offset);
+    if (!corpus_valid(c)) {
+        corpus_close(c);
+        return NULL;
+    }
+    return c;
+}
+
+void corpus_close(rom_corpus* corpus) {
+    if (corpus == NULL) return;
+#ifdef CORPUS_MMAP
+    if (corpus->mapped) munmap((void*) corpus->base, corpus->size);
+#endif
+    if (!corpus->mapped) free((void*) corpus->base);
+    free(corpus);
+}
+
+const uint8_t* corpus_rom_data(const rom_corpus* corpus, uint32_t k, long* len) {
+    *len = corpus->roms[k].length;
+    return corpus->base + corpus->roms[k].offset;
+}
+
+long corpus_find_hash(const rom_corpus* corpus, uint64_t hash) {
+    long lo = 0, hi = (long) corpus->header->rom_count - 1;
+    while (lo <= hi) {
+        long mid = lo + (hi - lo) / 2;
+        uint64_t h = corpus->roms[mid].hash;
+        if (h == hash) return mid;
+        if (h < hash) {
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return -1;
+}
+
+long corpus_find_name(const rom_corpus* corpus, const char* name) {
+    long lo = 0, hi = (long) corpus->header->name_count - 1;
+    while (lo <= hi) {
+        long mid = lo + (hi - lo) / 2;
+        int cmp = strcmp(corpus->strings + corpus->names[mid].string, name);
+        if (cmp == 0) return corpus->names[mid].rom;
+        if (cmp < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return -1;
+}
+
+long corpus_find(const rom_corpus* corpus, const char* ref) {
+    if (ref[0] == '@') {
+        char* end;
+        uint64_t hash = strtoull(ref + 1, &end, 16);
+        return *end == '\0' && end != ref + 1 ? corpus_find_hash(corpus, hash) : -1;
+    }
+    return corpus_find_name(corpus, ref);
+}
+
+const char* corpus_name_str(const rom_corpus* corpus, uint32_t name) {
+    return corpus->strings + corpus->names[name].string;
+}
+
+typedef struct {
+    uint64_t hash;
+    uint8_t* data;
+    long len;
+} builder_rom;
+
+typedef struct {
+    char* name;
+    uint32_t rom;
+} builder_name;
+
+struct corpus_builder {
+    builder_rom* roms;
+    uint32_t rom_count;
+    uint32_t rom_cap;
+    builder_name* names;
+    uint32_t name_count;
+    uint32_t name_cap;
+    // ROM index + 1 by hash, open addressing, 0 for an empty slot
+    uint32_t* lookup;
+    uint32_t lookup_size;
+};
+
+corpus_builder* corpus_builder_new() {
+    return calloc(1, sizeof(corpus_builder));
+}
+
+void corpus_builder_free(corpus_builder* builder) {
+    if (builder == NULL) return;
+    for (uint32_t k = 0; k < builder->rom_count; k++) free(builder->roms[k].data);
+    for (uint32_t k = 0; k < builder->name_count; k++) free(builder->names[k].name);
+    free(builder->roms);
+    free(builder->names);
+    free(builder->lookup);
+    free(builder);
+}
+
+// The lookup slot holding hash, or the empty slot where it would go
+static uint32_t* builder_slot(corpus_builder* b, uint64_t hash) {
+    uint32_t slot = (uint32_t) (hash ^ (hash >> 32)) & (b->lookup_size - 1);
+    while (b->lookup[slot] != 0 && b->roms[b->lookup[slot] - 1].hash != hash) {
+        slot = (slot + 1) & (b->lookup_size - 1);
+    }
+    return &b->lookup[slot];
+}
+
+static void builder_grow_lookup(corpus_builder* b) {
+    free(b->lookup);
+    b->lookup_size = b->lookup_size ? b->lookup_size * 2 : 1024;
+    b->lookup = calloc(b->lookup_size, sizeof(uint32_t));
+    for (uint32_t k = 0; k < b->rom_count; k++) *builder_slot(b, b->roms[k].hash) = k + 1;
+}
+
+corpus_add_result corpus_builder_add(corpus_builder* b, const char* name, const uint8_t* rom, long len) {
+    if (len <= 0 || len > XO_MAX_ROM_SIZE) return CORPUS_BAD_SIZE;
+    if ((b->rom_count + 1) * 2 > b->lookup_size) builder_grow_lookup(b);
+    uint64_t hash = rom_hash(rom, len);
+    uint32_t* slot = builder_slot(b, hash);
+    corpus_add_result result = CORPUS_DUPLICATE;
+    if (*slot != 0) {
+        const builder_rom* same = &b->roms[*slot - 1];
+        if (same->len != len || memcmp(same->data, rom, len) != 0) return CORPUS_HASH_COLLISION;
+    } else {
+        if (b->rom_count == b->rom_cap) {
+            b->rom_cap = b->rom_cap ? b->rom_cap * 2 : 256;
+            b->roms = realloc(b->roms, b->rom_cap * sizeof(builder_rom));
+        }
+        builder_rom* r = &b->roms[b->rom_count];
+        r->hash = hash;
+        r->len = len;
+        r->data = malloc(len);
+        memcpy(r->data, rom, len);
+        *slot = ++b->rom_count;
+        result = CORPUS_ADDED;
+    }
+    if (b->name_count == b->name_cap) {
+        b->name_cap = b->name_cap ? b->name_cap * 2 : 256;
+        b->names = realloc(b->names, b->name_cap * sizeof(builder_name));
+    }
+    b->names[b->name_count].name = malloc(strlen(name) + 1);
+    strcpy(b->names[b->name_count].name, name);
+    b->names[b->name_count].rom = *slot - 1;
+    b->name_count++;
+    return result;
+}
+
+static const builder_rom* sort_roms;
+
+static int by_hash(const void* a, const void* b) {
+    uint64_t x = sort_roms[*(const uint32_t*) a].hash;
+    uint64_t y = sort_roms[*(const uint32_t*) b].hash;
+    return (x > y) - (x < y);
+}
+
+static int by_name(const void* a, const void* b) {
+    return strcmp(((const builder_name*) a)->name, ((const builder_name*) b)->name);
+}
+
+bool corpus_builder_write(corpus_builder* b, const char* path) {
+    if (!host_is_little_endian()) return false;
+    // Where each ROM ends up once sorted by hash
+    uint32_t* order = malloc((b->rom_count + 1) * sizeof(uint32_t));
+    uint32_t* position = malloc((b->rom_count + 1) * sizeof(uint32_t));
+    for (uint32_t k = 0; k < b->rom_count; k++) order[k] = k;
+    sort_roms = b->roms;
+    qsort(order, b->rom_count, sizeof(uint32_t), by_hash);
+    for (uint32_t k = 0; k < b->rom_count; k++) position[order[k]] = k;
+    qsort(b->names, b->name_count, sizeof(builder_name), by_name);
+    uint32_t names = 0;
+    uint64_t strings_size = 0;
+    for (uint32_t k = 0; k < b->name_count; k++) {
+        if (names > 0 && strcmp(b->names[names - 1].name, b->names[k].name) == 0) {
+            free(b->names[k].name);
+            continue;
+        }
+        b->names[names++] = b->names[k];
+        strings_size += strlen(b->names[k].name) + 1;
+    }
+    b->name_count = names;
+
+    corpus_header h;
+    memcpy(h.magic, CORPUS_MAGIC, 4);
+    h.version = CORPUS_VERSION;
+    h.rom_count = b->rom_count;
+    h.name_count = b->name_count;
+    h.roms_offset = sizeof(corpus_header);
+    h.names_offset = h.roms_offset + b->rom_count * sizeof(corpus_rom);
+    h.strings_offset = h.names_offset + b->name_count * sizeof(corpus_name);
+    uint64_t data_offset = h.strings_offset + strings_size;
+    uint64_t size = data_offset;
+    for (uint32_t k = 0; k < b->rom_count; k++) size += b->roms[k].len;
+    FILE* file = size <= UINT32_MAX ? fopen(path, "wb") : NULL;
+    if (file == NULL) {
+        free(order);
+        free(position);
+        return false;
+    }
+    h.data_offset = (uint32_t) data_offset;
+    h.file_size = size;
+    fwrite(&h, sizeof(h), 1, file);
+    uint32_t offset = h.data_offset;
+    for (uint32_t k = 0; k < b->rom_count; k++) {
+        const builder_rom* r = &b->roms[order[k]];
+        corpus_rom entry = {r->hash, offset, (uint32_t) r->len};
+        fwrite(&entry, sizeof(entry), 1, file);
+        offset += r->len;
+    }
+    uint32_t string = 0;
+    for (uint32_t k = 0; k < b->name_count; k++) {
+        corpus_name entry = {string, position[b->names[k].rom]};
+        fwrite(&entry, sizeof(entry), 1, file);
+        string += strlen(b->names[k].name) + 1;
+    }
+    for (uint32_t k = 0; k < b->name_count; k++) {
+        fwrite(b->names[k].name, 1, strlen(b->names[k].name) + 1, file);
+    }
+    for (uint32_t k = 0; k < b->rom_count; k++) {
+        fwrite(b->roms[order[k]].data, 1, b->roms[order[k]].len, file);
+    }
+    free(order);
+    free(position);
+    bool ok = !ferror(file);
+    return fclose(file) == 0 && ok;
+}
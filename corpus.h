@@ -0,0 +1,95 @@
+#ifndef CHIP8_CORPUS_H
+#define CHIP8_CORPUS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Packed ROM corpus: a whole ROM library in one file that is memory-mapped and loaded
+ * from in place, so running thousands of ROMs costs one open instead of one per ROM.
+ * Each distinct ROM is stored once, keyed by rom_hash, and any number of names
+ * (usually paths relative to the packed directory) can point at it.
+ *
+ *   corpus_header
+ *   corpus_rom[rom_count]      sorted by hash
+ *   corpus_name[name_count]    sorted by name
+ *   names                      NUL-terminated strings
+ *   ROM data                   in hash order
+ *
+ * Everything is little endian and read in place, so corpora only open on little endian hosts.
+ */
+#define CORPUS_MAGIC "C8PK"
+#define CORPUS_VERSION 1
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t rom_count;
+    uint32_t name_count;
+    // Offsets from the start of the file
+    uint32_t roms_offset;
+    uint32_t names_offset;
+    uint32_t strings_offset;
+    uint32_t data_offset;
+    uint64_t file_size;
+} corpus_header;
+
+typedef struct {
+    uint64_t hash;
+    uint32_t offset;
+    uint32_t length;
+} corpus_rom;
+
+typedef struct {
+    // Offset of the name in the string section
+    uint32_t string;
+    uint32_t rom;
+} corpus_name;
+
+typedef struct {
+    const uint8_t* base;
+    size_t size;
+    // Whether base is a mapping rather than a malloc'd copy of the file
+    bool mapped;
+    const corpus_header* header;
+    const corpus_rom* roms;
+    const corpus_name* names;
+    const char* strings;
+} rom_corpus;
+
+// Maps a corpus and checks its layout. Returns NULL if it can't be read or isn't valid.
+rom_corpus* corpus_open(const char* path);
+void corpus_close(rom_corpus* corpus);
+// The bytes of ROM k (in hash order), pointing into the mapping
+const uint8_t* corpus_rom_data(const rom_corpus* corpus, uint32_t k, long* len);
+// Index of the ROM with this rom_hash, or -1
+long corpus_find_hash(const rom_corpus* corpus, uint64_t hash);
+// Index of the ROM stored under name, or -1
+long corpus_find_name(const rom_corpus* corpus, const char* name);
+// Index of the ROM a manifest or command line refers to: a name, or "@" and a hex rom_hash
+long corpus_find(const rom_corpus* corpus, const char* ref);
+const char* corpus_name_str(const rom_corpus* corpus, uint32_t name);
+
+/*
+ * Builds a corpus in memory and writes it out. ROMs with the same contents are stored
+ * once. Names are expected to be unique; if one is added twice only one is kept.
+ */
+typedef struct corpus_builder corpus_builder;
+
+typedef enum {
+    CORPUS_ADDED,
+    // The same bytes are already stored, only the name was added
+    CORPUS_DUPLICATE,
+    // Empty, or longer than XO_MAX_ROM_SIZE (the most any mode can load)
+    CORPUS_BAD_SIZE,
+    // A different ROM already has this hash, so this one can't be stored
+    CORPUS_HASH_COLLISION,
+} corpus_add_result;
+
+corpus_builder* corpus_builder_new();
+void corpus_builder_free(corpus_builder* builder);
+corpus_add_result corpus_builder_add(corpus_builder* builder, const char* name, const uint8_t* rom, long len);
+bool corpus_builder_write(corpus_builder* builder, const char* path);
+
+#endif
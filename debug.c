@@ -0,0 +1,463 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "debug.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#define MAX_WATCHPOINTS 16
+#define MAX_LINE 256
+// The most a single mem or disasm command prints
+#define MAX_DUMP 4096
+
+typedef struct {
+    uint16_t addr;
+    uint16_t len;
+} watchpoint;
+
+struct chip8_debugger {
+    int listener;
+    // -1 while nobody is connected
+    int client;
+    char line[MAX_LINE];
+    size_t line_len;
+    // Whether the line being read ran past MAX_LINE, so the rest of it is dropped
+    bool overlong;
+    // One bit per address, bit k & 7 of byte k >> 3
+    uint8_t breakpoints[XO_RAM_SIZE / 8];
+    uint32_t breakpoint_count;
+    watchpoint watch[MAX_WATCHPOINTS];
+    int watch_count;
+    bool paused;
+    // Instructions left to step, 0 when not stepping
+    uint32_t stepping;
+    // Set when the VM carries on from pc, so a breakpoint there doesn't stop it straight away
+    bool leaving;
+    // Why the VM last stopped, until the client has been told
+    char stop_reason[96];
+    // The engine the VM had before the stub took over, while it has
+    bool attached;
+    chip8_engine saved;
+    // Removed again on close, for Unix sockets
+    char* unix_path;
+};
+
+static void debug_send(chip8_debugger* dbg, const char* fmt, ...) {
+    if (dbg->client < 0) return;
+    char buf[1024];
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+    if (len <= 0) return;
+    if ((size_t) len >= sizeof(buf)) len = sizeof(buf) - 1;
+    // A client that went away is noticed on the next read
+    for (int sent = 0; sent < len; ) {
+        ssize_t n = send(dbg->client, buf + sent, (size_t) (len - sent), MSG_NOSIGNAL);
+        if (n <= 0) return;
+        sent += (int) n;
+    }
+}
+
+static bool debug_breakpoint_at(const chip8_debugger* dbg, uint16_t addr) {
+    return (dbg->breakpoints[addr >> 3] >> (addr & 7)) & 1;
+}
+
+static void debug_stop(chip8_debugger* dbg, const chip8_vm* vm, const char* fmt, ...) {
+    dbg->paused = true;
+    dbg->stepping = 0;
+    int len = snprintf(dbg->stop_reason, sizeof(dbg->stop_reason), "stopped at 0x%03X: ", vm->pc);
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(dbg->stop_reason + len, sizeof(dbg->stop_reason) - len, fmt, args);
+    va_end(args);
+}
+
+// The watchpoint overlapping len bytes written from addr, or -1
+static int debug_watch_hit(const chip8_debugger* dbg, const chip8_vm* vm, uint16_t addr, int len) {
+    for (int w = 0; w < dbg->watch_count; w++) {
+        for (int j = 0; j < len; j++) {
+            uint16_t offset = (uint16_t) (((addr + j) & vm->addr_mask) - dbg->watch[w].addr);
+            if (offset < dbg->watch[w].len) return w;
+        }
+    }
+    return -1;
+}
+
+/*
+ * The engine while there's anything to check: runs one instruction at a time on the
+ * interpreter, stopping before breakpoints and after writes to watched memory.
+ */
+static tick_result debug_execute(void* ctx, chip8_vm* vm, uint32_t n) {
+    chip8_debugger* dbg = ctx;
+    for (uint32_t k = 0; k < n; k++) {
+        if (dbg->leaving) {
+            dbg->leaving = false;
+        } else if (debug_breakpoint_at(dbg, vm->pc)) {
+            debug_stop(dbg, vm, "breakpoint");
+            return STOPPED;
+        }
+        uint16_t pc = vm->pc;
+        uint16_t opcode = (uint16_t) (vm->ram[pc & vm->addr_mask] << 8) | vm->ram[(pc + 1) & vm->addr_mask];
+        uint16_t write_addr = vm->i;
+        int write_len = instruction_write_len(decode_instruction(opcode, vm->mode));
+        tick_result res = vm_execute(vm, 1);
+        if (res != SUCCESS) {
+            debug_stop(dbg, vm, "%s", tick_result_str(res));
+            return res;
+        }
+        int w = write_len > 0 ? debug_watch_hit(dbg, vm, write_addr, write_len) : -1;
+        if (w >= 0) {
+            debug_stop(dbg, vm, "watchpoint 0x%03X written by 0x%03X", dbg->watch[w].addr, pc);
+            return STOPPED;
+        }
+        if (dbg->stepping > 0 && --dbg->stepping == 0) {
+            debug_stop(dbg, vm, "step");
+            return STOPPED;
+        }
+    }
+    return SUCCESS;
+}
+
+static void debug_flush(void* ctx) {
+    chip8_debugger* dbg = ctx;
+    if (dbg->saved.flush != NULL) dbg->saved.flush(dbg->saved.ctx);
+}
+
+// Takes over as the VM's engine while there's something to check, and hands it back after
+static void debug_update_engine(chip8_debugger* dbg, chip8_vm* vm) {
+    bool needed = dbg->breakpoint_count > 0 || dbg->watch_count > 0 || dbg->stepping > 0;
+    if (needed && !dbg->attached) {
+        dbg->saved = vm->engine;
+        vm->engine.ctx = dbg;
+        vm->engine.execute = debug_execute;
+        vm->engine.flush = debug_flush;
+        vm->engine.no_idle_skip = true;
+        dbg->attached = true;
+    } else if (!needed && dbg->attached) {
+        vm->engine = dbg->saved;
+        // The interpreter may have written over code the engine translated
+        if (vm->engine.flush != NULL) vm->engine.flush(vm->engine.ctx);
+        dbg->attached = false;
+    }
+}
+
+static void debug_disconnect(chip8_debugger* dbg) {
+    close(dbg->client);
+    dbg->client = -1;
+    dbg->line_len = 0;
+    dbg->overlong = false;
+    // Like detaching GDB: everything is cleared and the program carries on
+    memset(dbg->breakpoints, 0, sizeof(dbg->breakpoints));
+    dbg->breakpoint_count = 0;
+    dbg->watch_count = 0;
+    dbg->stepping = 0;
+    dbg->paused = false;
+    dbg->stop_reason[0] = '\0';
+}
+
+static void debug_print_regs(chip8_debugger* dbg, const chip8_vm* vm) {
+    debug_send(dbg, "pc=0x%03X i=0x%03X sp=%u dt=%u st=%u cycles=%llu\n", vm->pc, vm->i, vm->stack.ptr,
+               vm->delay, vm->sound, (unsigned long long) vm->cycles);
+    char line[128];
+    int len = 0;
+    for (int r = 0; r < 16; r++) {
+        len += snprintf(line + len, sizeof(line) - len, "%sv%X=%02X", r > 0 ? " " : "", r, vm->reg[r]);
+    }
+    debug_send(dbg, "%s\n", line);
+}
+
+static void debug_print_mem(chip8_debugger* dbg, const chip8_vm* vm, uint16_t addr, uint32_t len) {
+    for (uint32_t row = 0; row < len; row += 16) {
+        char line[128];
+        int used = snprintf(line, sizeof(line), "0x%03X:", (addr + row) & vm->addr_mask);
+        for (uint32_t j = row; j < len && j < row + 16; j++) {
+            used += snprintf(line + used, sizeof(line) - used, " %02X", vm->ram[(addr + j) & vm->addr_mask]);
+        }
+        debug_send(dbg, "%s\n", line);
+    }
+}
+
+static void debug_print_disasm(chip8_debugger* dbg, const chip8_vm* vm, uint16_t addr, uint32_t count) {
+    for (uint32_t k = 0; k < count; k++) {
+        addr &= vm->addr_mask;
+        uint16_t opcode = (uint16_t) (vm->ram[addr] << 8) | vm->ram[(addr + 1) & vm->addr_mask];
+        uint16_t next = (uint16_t) (vm->ram[(addr + 2) & vm->addr_mask] << 8) | vm->ram[(addr + 3) & vm->addr_mask];
+        char text[32];
+        int len = disassemble_instruction(opcode, next, vm->mode, text, sizeof(text));
+        // => marks the pc and * a breakpoint
+        debug_send(dbg, "%s%c0x%03X  %04X  %s\n", addr == vm->pc ? "=>" : "  ",
+                   debug_breakpoint_at(dbg, addr) ? '*' : ' ', addr, opcode, text);
+        addr += len;
+    }
+}
+
+static const char* HELP =
+        "pause                 stop the VM\n"
+        "continue | c          carry on running\n"
+        "step | s [N]          run N instructions (1)\n"
+        "regs | r              show the registers and timers\n"
+        "stack | bt            show the call stack\n"
+        "mem | x ADDR [LEN]    dump LEN bytes of memory (16)\n"
+        "disasm | l [ADDR] [N] disassemble N instructions (10) from ADDR (the pc)\n"
+        "break | b ADDR        stop before running the instruction at ADDR\n"
+        "delete | d ADDR       remove the breakpoint at ADDR\n"
+        "watch | w ADDR [LEN]  stop after any write to LEN bytes from ADDR (1)\n"
+        "unwatch ADDR          remove the watchpoint at ADDR\n"
+        "info | i              list breakpoints and watchpoints\n"
+        "detach | quit         clear everything, carry on and disconnect\n";
+
+static bool debug_is(const char* word, const char* name, const char* alias) {
+    return strcmp(word, name) == 0 || (alias != NULL && strcmp(word, alias) == 0);
+}
+
+// Parses a hex address, or a decimal count when hex is false
+static bool debug_number(const char* word, bool hex, uint32_t* value) {
+    char* end;
+    unsigned long parsed = strtoul(word, &end, hex ? 16 : 10);
+    if (end == word || *end != '\0' || parsed > 0xFFFF) return false;
+    *value = (uint32_t) parsed;
+    return true;
+}
+
+static void debug_command(chip8_debugger* dbg, chip8_vm* vm, char* line) {
+    char* words[4];
+    int count = 0;
+    for (char* word = strtok(line, " \t\r"); word != NULL && count < 4; word = strtok(NULL, " \t\r")) {
+        words[count++] = word;
+    }
+    if (count == 0) return;
+    const char* cmd = words[0];
+    uint32_t addr = vm->pc;
+    uint32_t n = 0;
+    // Most commands take an address and then a count
+    bool parsed = (count < 2 || debug_number(words[1], true, &addr)) && (count < 3 || debug_number(words[2], false, &n));
+    if (!parsed) {
+        debug_send(dbg, "error: bad number\n");
+        return;
+    }
+    addr &= vm->addr_mask;
+    if (debug_is(cmd, "help", "h")) {
+        debug_send(dbg, "%s", HELP);
+    } else if (debug_is(cmd, "pause", NULL)) {
+        // Reported below, before the ok
+        if (!dbg->paused) debug_stop(dbg, vm, "paused");
+    } else if (debug_is(cmd, "continue", "c")) {
+        dbg->paused = false;
+        dbg->leaving = true;
+    } else if (debug_is(cmd, "step", "s")) {
+        // The count is the first argument here
+        uint32_t steps = 1;
+        if (count >= 2 && (!debug_number(words[1], false, &steps) || steps == 0)) {
+            debug_send(dbg, "error: bad count\n");
+            return;
+        }
+        dbg->stepping = steps;
+        dbg->paused = false;
+        dbg->leaving = true;
+    } else if (debug_is(cmd, "regs", "r")) {
+        debug_print_regs(dbg, vm);
+    } else if (debug_is(cmd, "stack", "bt")) {
+        for (int k = vm->stack.ptr - 1; k >= 0; k--) {
+            debug_send(dbg, "#%d 0x%03X\n", vm->stack.ptr - 1 - k, vm->stack.stack[k]);
+        }
+    } else if (debug_is(cmd, "mem", "x") && count >= 2) {
+        debug_print_mem(dbg, vm, (uint16_t) addr, count >= 3 ? (n < MAX_DUMP ? n : MAX_DUMP) : 16);
+    } else if (debug_is(cmd, "disasm", "l")) {
+        debug_print_disasm(dbg, vm, (uint16_t) addr, count >= 3 ? (n < MAX_DUMP ? n : MAX_DUMP) : 10);
+    } else if (debug_is(cmd, "break", "b") && count >= 2) {
+        if (!debug_breakpoint_at(dbg, (uint16_t) addr)) dbg->breakpoint_count++;
+        dbg->breakpoints[addr >> 3] |= (uint8_t) (1 << (addr & 7));
+    } else if (debug_is(cmd, "delete", "d") && count >= 2) {
+        if (!debug_breakpoint_at(dbg, (uint16_t) addr)) {
+            debug_send(dbg, "error: no breakpoint at 0x%03X\n", addr);
+            return;
+        }
+        dbg->breakpoints[addr >> 3] &= (uint8_t) ~(1 << (addr & 7));
+        dbg->breakpoint_count--;
+    } else if (debug_is(cmd, "watch", "w") && count >= 2) {
+        if (dbg->watch_count == MAX_WATCHPOINTS) {
+            debug_send(dbg, "error: only %d watchpoints\n", MAX_WATCHPOINTS);
+            return;
+        }
+        uint32_t len = count >= 3 ? n : 1;
+        if (len == 0) len = 1;
+        dbg->watch[dbg->watch_count].addr = (uint16_t) addr;
+        dbg->watch[dbg->watch_count].len = (uint16_t) len;
+        dbg->watch_count++;
+    } else if (debug_is(cmd, "unwatch", NULL) && count >= 2) {
+        int w = 0;
+        while (w < dbg->watch_count && dbg->watch[w].addr != addr) w++;
+        if (w == dbg->watch_count) {
+            debug_send(dbg, "error: no watchpoint at 0x%03X\n", addr);
+            return;
+        }
+        dbg->watch[w] = dbg->watch[--dbg->watch_count];
+    } else if (debug_is(cmd, "info", "i")) {
+        for (uint32_t a = 0; a <= vm->addr_mask; a++) {
+            if (debug_breakpoint_at(dbg, (uint16_t) a)) debug_send(dbg, "breakpoint 0x%03X\n", a);
+        }
+        for (int w = 0; w < dbg->watch_count; w++) {
+            debug_send(dbg, "watchpoint 0x%03X, %u bytes\n", dbg->watch[w].addr, dbg->watch[w].len);
+        }
+    } else if (debug_is(cmd, "detach", "quit")) {
+        debug_send(dbg, "ok\n");
+        debug_disconnect(dbg);
+        return;
+    } else {
+        debug_send(dbg, "error: unknown command or missing address, try help\n");
+        return;
+    }
+    if (dbg->paused && dbg->stop_reason[0] != '\0') {
+        debug_send(dbg, "%s\n", dbg->stop_reason);
+        dbg->stop_reason[0] = '\0';
+    }
+    debug_send(dbg, "ok\n");
+}
+
+// Runs every full line the client has sent; false once it has gone away
+static bool debug_read(chip8_debugger* dbg, chip8_vm* vm) {
+    char buf[512];
+    ssize_t got = recv(dbg->client, buf, sizeof(buf), 0);
+    if (got <= 0) return false;
+    for (ssize_t k = 0; k < got && dbg->client >= 0; k++) {
+        if (buf[k] != '\n') {
+            if (dbg->line_len < MAX_LINE - 1) {
+                dbg->line[dbg->line_len++] = buf[k];
+            } else {
+                dbg->overlong = true;
+            }
+            continue;
+        }
+        dbg->line[dbg->line_len] = '\0';
+        if (dbg->overlong) {
+            debug_send(dbg, "error: line too long\n");
+        } else {
+            debug_command(dbg, vm, dbg->line);
+        }
+        dbg->line_len = 0;
+        dbg->overlong = false;
+    }
+    return dbg->client >= 0;
+}
+
+static void debug_accept(chip8_debugger* dbg, const chip8_vm* vm) {
+    int client = accept(dbg->listener, NULL, NULL);
+    if (client < 0) return;
+    if (dbg->client >= 0) {
+        static const char busy[] = "error: another debugger is connected\n";
+        send(client, busy, sizeof(busy) - 1, MSG_NOSIGNAL);
+        close(client);
+        return;
+    }
+    dbg->client = client;
+    debug_send(dbg, "chip8_c debugger, %s mode, type help for commands\n", chip8_mode_str(vm->mode));
+    if (dbg->paused && dbg->stop_reason[0] == '\0') debug_send(dbg, "stopped at 0x%03X: paused\n", vm->pc);
+}
+
+bool debug_poll(chip8_debugger* dbg, chip8_vm* vm, int timeout_ms) {
+    if (dbg->client >= 0 && dbg->stop_reason[0] != '\0') {
+        debug_send(dbg, "%s\n", dbg->stop_reason);
+        dbg->stop_reason[0] = '\0';
+    }
+    int wait = dbg->paused ? timeout_ms : 0;
+    for (;;) {
+        struct pollfd fds[2] = {{dbg->listener, POLLIN, 0}, {dbg->client, POLLIN, 0}};
+        // poll skips the client while it's -1
+        if (poll(fds, 2, wait) <= 0) break;
+        if (fds[0].revents & POLLIN) debug_accept(dbg, vm);
+        if (fds[1].revents != 0 && !debug_read(dbg, vm)) debug_disconnect(dbg);
+        // Drain whatever else came in, then hand back to the caller to wait again
+        wait = 0;
+    }
+    debug_update_engine(dbg, vm);
+    return !dbg->paused;
+}
+
+chip8_debugger* debug_open(const char* addr) {
+    chip8_debugger* dbg = calloc(1, sizeof(chip8_debugger));
+    if (dbg == NULL) return NULL;
+    dbg->client = -1;
+    dbg->paused = true;
+    char* end;
+    unsigned long port = strtoul(addr, &end, 10);
+    if (*addr != '\0' && *end == '\0') {
+        if (port == 0 || port > 65535) {
+            printf("Bad debugger port \"%s\"\n", addr);
+            free(dbg);
+            return NULL;
+        }
+        struct sockaddr_in in;
+        memset(&in, 0, sizeof(in));
+        in.sin_family = AF_INET;
+        in.sin_port = htons((uint16_t) port);
+        // Anyone who can connect can read and stop the VM, so only this machine can
+        in.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        dbg->listener = socket(AF_INET, SOCK_STREAM, 0);
+        int on = 1;
+        if (dbg->listener >= 0) setsockopt(dbg->listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if (dbg->listener < 0 || bind(dbg->listener, (struct sockaddr*) &in, sizeof(in)) < 0) {
+            printf("Debugger can't listen on port %lu: %s\n", port, strerror(errno));
+            if (dbg->listener >= 0) close(dbg->listener);
+            free(dbg);
+            return NULL;
+        }
+    } else {
+        struct sockaddr_un un;
+        memset(&un, 0, sizeof(un));
+        un.sun_family = AF_UNIX;
+        if (strlen(addr) >= sizeof(un.sun_path)) {
+            printf("Debugger socket path \"%s\" is too long\n", addr);
+            free(dbg);
+            return NULL;
+        }
+        strcpy(un.sun_path, addr);
+        // A socket left behind by an earlier run is replaced, anything else is left alone
+        struct stat st;
+        if (lstat(addr, &st) == 0) {
+            if (!S_ISSOCK(st.st_mode)) {
+                printf("Debugger socket path \"%s\" already exists and isn't a socket\n", addr);
+                free(dbg);
+                return NULL;
+            }
+            unlink(addr);
+        }
+        dbg->listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (dbg->listener < 0 || bind(dbg->listener, (struct sockaddr*) &un, sizeof(un)) < 0) {
+            printf("Debugger can't listen on \"%s\": %s\n", addr, strerror(errno));
+            if (dbg->listener >= 0) close(dbg->listener);
+            free(dbg);
+            return NULL;
+        }
+        dbg->unix_path = strdup(addr);
+    }
+    if (listen(dbg->listener, 1) < 0) {
+        printf("Debugger can't listen: %s\n", strerror(errno));
+        debug_close(dbg);
+        return NULL;
+    }
+    printf("Debugger listening on %s, the program starts paused\n", addr);
+    return dbg;
+}
+
+void debug_close(chip8_debugger* dbg) {
+    if (dbg == NULL) return;
+    if (dbg->client >= 0) close(dbg->client);
+    close(dbg->listener);
+    if (dbg->unix_path != NULL) {
+        unlink(dbg->unix_path);
+        free(dbg->unix_path);
+    }
+    free(dbg);
+}
@@ -0,0 +1,32 @@
+#ifndef CHIP8_DEBUG_H
+#define CHIP8_DEBUG_H
+
+#include <stdbool.h>
+#include "vm.h"
+
+/*
+ * Remote debugger stub. It serves a line protocol on a TCP port on localhost, or on a Unix
+ * socket, to one client at a time, so `nc localhost PORT` is enough to drive it. Each reply
+ * ends with a line "ok" or "error: ...", and whenever the VM stops the client is sent
+ * "stopped at ADDR: REASON" without asking. Addresses are hex, counts decimal. Type "help"
+ * for the commands.
+ *
+ * The VM is left on its own engine (the interpreter or the JIT) while there are no
+ * breakpoints or watchpoints and nothing is being stepped, and the stub only looks at the
+ * socket between frames, so building it in costs nothing until it's used. Otherwise the stub
+ * becomes the VM's engine and runs it an instruction at a time, checking each one.
+ */
+typedef struct chip8_debugger chip8_debugger;
+
+// addr is a port number, or the path of a Unix socket. Prints why and returns NULL if it can't listen.
+chip8_debugger* debug_open(const char* addr);
+void debug_close(chip8_debugger* dbg);
+/*
+ * Called between frames: accepts a client, answers its commands and tells it when the VM
+ * has stopped, waiting up to timeout_ms for something to happen while the VM is paused.
+ * Returns true if the VM should run. It starts out paused, so breakpoints can be set
+ * before the program runs, and carries on when the client goes away.
+ */
+bool debug_poll(chip8_debugger* dbg, chip8_vm* vm, int timeout_ms);
+
+#endif
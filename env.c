@@ -0,0 +1,247 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "env.h"
+
+// Environments a thread takes at a time, enough that handing them out is never the bottleneck
+#define ENV_BATCH 8
+// VMs start on their own cache lines, so threads stepping neighbours don't share any
+#define ENV_ALIGN 64
+
+typedef void (*env_job)(struct chip8_env* env, uint32_t k);
+
+struct chip8_env {
+    env_config config;
+    uint32_t count;
+    uint8_t* arena;
+    // Set if env_create allocated the arena
+    void* owned_arena;
+    // The ROM freshly loaded, copied over a VM to reset it
+    chip8_vm* pristine;
+    // How much of a VM's memory the mode can reach, and so may have been written
+    size_t reach;
+    uint32_t seed;
+    // Per environment: frames into the episode, episodes since env_reset, the reward number
+    // at the end of the last step, and whether the episode ended
+    uint32_t* frames;
+    uint32_t* episodes;
+    uint32_t* score;
+    uint8_t* ended;
+    // What the threads are doing: job for every environment, the next of which is next
+    env_job job;
+    uint32_t next;
+    const uint16_t* actions;
+    float* rewards;
+    uint8_t* dones;
+    // The threads besides the caller's, which wait for generation to change and then help
+    pthread_t* workers;
+    uint32_t worker_count;
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t finish;
+    uint64_t generation;
+    uint32_t running;
+    bool quit;
+};
+
+size_t env_stride(void) {
+    return (sizeof(chip8_vm) + ENV_ALIGN - 1) & ~(size_t) (ENV_ALIGN - 1);
+}
+
+size_t env_arena_size(uint32_t count) {
+    return env_stride() * count;
+}
+
+static chip8_vm* env_at(const chip8_env* env, uint32_t k) {
+    return (chip8_vm*) (env->arena + env_stride() * k);
+}
+
+const chip8_vm* env_vm(const chip8_env* env, uint32_t k) {
+    return env_at(env, k);
+}
+
+uint32_t env_count(const chip8_env* env) {
+    return env->count;
+}
+
+static uint32_t env_score(const chip8_env* env, const chip8_vm* vm) {
+    uint32_t score = 0;
+    for (int j = 0; j < env->config.reward_len; j++) {
+        score = score << 8 | vm->ram[(env->config.reward_addr + j) & vm->addr_mask];
+    }
+    return score;
+}
+
+// Like vm_load_program_mode on a fresh VM, by copying the pristine one and only as much memory as can have changed
+static void env_reset_one(chip8_env* env, uint32_t k) {
+    chip8_vm* vm = env_at(env, k);
+    memcpy(vm->ram, env->pristine->ram, env->reach);
+    memcpy(&vm->mode, &env->pristine->mode, sizeof(chip8_vm) - offsetof(chip8_vm, mode));
+    vm_seed(vm, env->seed + k + env->count * env->episodes[k]);
+    env->frames[k] = 0;
+    env->score[k] = env_score(env, vm);
+    env->ended[k] = 0;
+}
+
+static void env_step_one(chip8_env* env, uint32_t k) {
+    chip8_vm* vm = env_at(env, k);
+    if (env->ended[k]) {
+        env->episodes[k]++;
+        env_reset_one(env, k);
+    }
+    // Keys let go while the program waits for one are reported like chip8_batch's input scripts
+    uint16_t keys = env->actions[k];
+    uint16_t released = vm->keys & ~keys;
+    vm->keys = keys;
+    if (released != 0 && vm->waiting_for_keypress) vm->key_released = (int8_t) __builtin_ctz(released);
+    uint32_t max_frames = env->config.max_frames;
+    tick_result res = SUCCESS;
+    for (uint32_t f = 0; f < env->config.frames_per_step; f++) {
+        if (max_frames > 0 && env->frames[k] >= max_frames) break;
+        res = vm_run_frame(vm);
+        if (res != SUCCESS) break;
+        env->frames[k]++;
+    }
+    uint32_t score = env_score(env, vm);
+    if (env->rewards != NULL) env->rewards[k] = (float) ((int64_t) score - env->score[k]);
+    env->score[k] = score;
+    env->ended[k] = res != SUCCESS || (max_frames > 0 && env->frames[k] >= max_frames);
+    if (env->dones != NULL) env->dones[k] = env->ended[k];
+}
+
+// Runs the job on batches of environments until there are none left
+static void env_work(chip8_env* env) {
+    for (;;) {
+        uint32_t first = __atomic_fetch_add(&env->next, ENV_BATCH, __ATOMIC_RELAXED);
+        if (first >= env->count) return;
+        uint32_t last = first + ENV_BATCH < env->count ? first + ENV_BATCH : env->count;
+        for (uint32_t k = first; k < last; k++) {
+            env->job(env, k);
+        }
+    }
+}
+
+static void* env_worker(void* arg) {
+    chip8_env* env = arg;
+    uint64_t seen = 0;
+    pthread_mutex_lock(&env->lock);
+    for (;;) {
+        while (env->generation == seen && !env->quit) pthread_cond_wait(&env->start, &env->lock);
+        if (env->quit) break;
+        seen = env->generation;
+        pthread_mutex_unlock(&env->lock);
+        env_work(env);
+        pthread_mutex_lock(&env->lock);
+        if (--env->running == 0) pthread_cond_signal(&env->finish);
+    }
+    pthread_mutex_unlock(&env->lock);
+    return NULL;
+}
+
+// Runs job for every environment on all the threads, returning once they're all done
+static void env_run(chip8_env* env, env_job job) {
+    env->job = job;
+    env->next = 0;
+    if (env->worker_count == 0) {
+        env_work(env);
+        return;
+    }
+    pthread_mutex_lock(&env->lock);
+    env->running = env->worker_count;
+    env->generation++;
+    pthread_cond_broadcast(&env->start);
+    pthread_mutex_unlock(&env->lock);
+    env_work(env);
+    pthread_mutex_lock(&env->lock);
+    while (env->running > 0) pthread_cond_wait(&env->finish, &env->lock);
+    pthread_mutex_unlock(&env->lock);
+}
+
+void env_reset(chip8_env* env, uint32_t seed) {
+    env->seed = seed;
+    memset(env->episodes, 0, env->count * sizeof(uint32_t));
+    env_run(env, env_reset_one);
+}
+
+void env_step(chip8_env* env, const uint16_t actions[], float rewards[], uint8_t dones[]) {
+    env->actions = actions;
+    env->rewards = rewards;
+    env->dones = dones;
+    env_run(env, env_step_one);
+}
+
+chip8_env* env_create(const env_config* config, const uint8_t rom[], int rom_len, uint32_t count, void* arena) {
+    if (rom_len > MODE_MAX_ROM_SIZE(config->mode)) {
+        printf("ROM is too big for the environments' memory (%d > %d bytes)\n", rom_len, MODE_MAX_ROM_SIZE(config->mode));
+        return NULL;
+    }
+    chip8_env* env = calloc(1, sizeof(chip8_env));
+    if (env == NULL) return NULL;
+    pthread_mutex_init(&env->lock, NULL);
+    pthread_cond_init(&env->start, NULL);
+    pthread_cond_init(&env->finish, NULL);
+    env->config = *config;
+    if (env->config.frames_per_step == 0) env->config.frames_per_step = 1;
+    if (env->config.reward_len > 4) env->config.reward_len = 4;
+    env->count = count;
+    env->arena = arena;
+    if (arena == NULL && posix_memalign(&env->owned_arena, ENV_ALIGN, env_arena_size(count) + 1) == 0) {
+        env->arena = env->owned_arena;
+    }
+    env->pristine = malloc(sizeof(chip8_vm));
+    env->frames = calloc(count + 1, sizeof(uint32_t));
+    env->episodes = calloc(count + 1, sizeof(uint32_t));
+    env->score = calloc(count + 1, sizeof(uint32_t));
+    env->ended = calloc(count + 1, 1);
+    if (env->arena == NULL || env->pristine == NULL || env->frames == NULL || env->episodes == NULL
+        || env->score == NULL || env->ended == NULL) {
+        printf("Not enough memory for %u environments\n", count);
+        env_destroy(env);
+        return NULL;
+    }
+    memset(env->pristine, 0, sizeof(chip8_vm));
+    vm_load_program_mode(env->pristine, config->mode, config->instructions_per_second, rom, rom_len);
+    env->reach = (size_t) env->pristine->addr_mask + 1;
+
+    long threads = config->threads > 0 ? (long) config->threads : sysconf(_SC_NPROCESSORS_ONLN);
+    long batches = (count + ENV_BATCH - 1) / ENV_BATCH;
+    if (threads > batches) threads = batches;
+    env->workers = malloc((threads > 1 ? threads - 1 : 1) * sizeof(pthread_t));
+    for (long t = 1; t < threads && env->workers != NULL; t++) {
+        if (pthread_create(&env->workers[env->worker_count], NULL, env_worker, env) != 0) {
+            printf("Could not start environment thread %ld\n", t);
+            env_destroy(env);
+            return NULL;
+        }
+        env->worker_count++;
+    }
+    env_reset(env, 0);
+    return env;
+}
+
+void env_destroy(chip8_env* env) {
+    if (env == NULL) return;
+    if (env->worker_count > 0) {
+        pthread_mutex_lock(&env->lock);
+        env->quit = true;
+        pthread_cond_broadcast(&env->start);
+        pthread_mutex_unlock(&env->lock);
+        for (uint32_t t = 0; t < env->worker_count; t++) {
+            pthread_join(env->workers[t], NULL);
+        }
+    }
+    pthread_mutex_destroy(&env->lock);
+    pthread_cond_destroy(&env->start);
+    pthread_cond_destroy(&env->finish);
+    free(env->workers);
+    free(env->owned_arena);
+    free(env->pristine);
+    free(env->frames);
+    free(env->episodes);
+    free(env->score);
+    free(env->ended);
+    free(env);
+}
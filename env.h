@@ -0,0 +1,63 @@
+#ifndef CHIP8_ENV_H
+#define CHIP8_ENV_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "vm.h"
+
+/*
+ * Batched environments for reinforcement learning: count copies of one ROM, stepped together
+ * frames_per_step frames at a time, with the keys to hold down as each one's action. The
+ * steps are spread over a pool of threads started by env_create, and nothing is allocated
+ * after that.
+ *
+ * The VMs live in an arena the caller can provide, e.g. shared memory or a buffer owned by
+ * the training framework, so observations are read straight out of it: environment k's VM is
+ * at arena + k * env_stride(), and its screen is vm->fb (see framebuffer.h). Nothing is
+ * copied out after a step.
+ */
+typedef struct chip8_env chip8_env;
+
+typedef struct {
+    chip8_mode mode;
+    // 0 for DEFAULT_IPS
+    uint32_t instructions_per_second;
+    // Frames each env_step runs, with the same action held. 0 counts as 1.
+    uint32_t frames_per_step;
+    // The reward for a step is how much the reward_len byte (up to 4) big endian number at
+    // reward_addr changed during it, e.g. a score. reward_len 0 gives no rewards.
+    uint16_t reward_addr;
+    uint8_t reward_len;
+    // An episode ends after this many frames, or when the program fails. 0 for no limit.
+    uint32_t max_frames;
+    // Threads to step on, including the caller's. 0 for one per core.
+    uint32_t threads;
+} env_config;
+
+// Bytes between one environment's VM and the next in the arena
+size_t env_stride(void);
+// Size of the arena count environments need
+size_t env_arena_size(uint32_t count);
+/*
+ * arena is env_arena_size(count) bytes aligned for a chip8_vm, or NULL to allocate it. Every
+ * environment starts reset with env_reset(env, 0). Prints why and returns NULL if the ROM
+ * is too big or the threads can't be started.
+ */
+chip8_env* env_create(const env_config* config, const uint8_t rom[], int rom_len, uint32_t count, void* arena);
+// Stops the threads. An arena the caller provided is left alone.
+void env_destroy(chip8_env* env);
+uint32_t env_count(const chip8_env* env);
+// Starts a new episode in every environment, environment k with RAND seeded seed + k
+void env_reset(chip8_env* env, uint32_t seed);
+/*
+ * Runs a step in every environment, holding actions[k] (bit n for key n) in environment k.
+ * Writes its reward to rewards[k], and sets dones[k] when its episode ended. An environment
+ * whose episode ended starts a new one at its next step, so its last screen can be seen.
+ * rewards and dones may be NULL.
+ */
+void env_step(chip8_env* env, const uint16_t actions[], float rewards[], uint8_t dones[]);
+// Environment k's VM, in the arena
+const chip8_vm* env_vm(const chip8_env* env, uint32_t k);
+
+#endif
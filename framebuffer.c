@@ -0,0 +1,190 @@
+#include <string.h>
+#include "framebuffer.h"
+
+void set_screen_size(framebuffer* fb, uint16_t width, uint16_t height) {
+    fb->width = width;
+    fb->height = height;
+    clear_screen(fb);
+    fb->dirty_rows = ALL_ROWS_DIRTY;
+}
+
+void clear_screen(framebuffer* fb) {
+    clear_planes(fb, ALL_PLANES);
+}
+
+void clear_planes(framebuffer* fb, uint8_t planes) {
+    for (int p = 0; p < FB_PLANES; p++) {
+        if (!((planes >> p) & 1)) continue;
+        for (int y = 0; y < FB_MAX_HEIGHT; y++) {
+            for (int w = 0; w < FB_ROW_WORDS; w++) {
+                if (fb->planes[p][y][w] != 0) fb->dirty_rows |= 1ULL << y;
+            }
+        }
+        memset(fb->planes[p], 0, sizeof(fb->planes[p]));
+    }
+}
+
+bool draw_sprite(framebuffer* fb, uint8_t start_x, uint8_t start_y, const uint8_t sprite[], uint8_t sprite_len) {
+    return draw_plane_sprite(fb, 0, start_x, start_y, sprite, sprite_len, false, false) != 0;
+}
+
+int draw_plane_sprite(framebuffer* fb, int plane, uint8_t start_x, uint8_t start_y, const uint8_t sprite[],
+                      uint8_t sprite_len, bool wide, bool wrap) {
+    int x = start_x % fb->width;
+    int top = start_y % fb->height;
+    int words = fb->width / 64;
+    int word = x / 64;
+    int shift = x % 64;
+    // The part of a row past the end of its word goes in the next word, or round to the first one
+    int next = word + 1;
+    bool spills = shift > 64 - (wide ? 16 : 8);
+    if (next == words) {
+        next = 0;
+        spills = spills && wrap;
+    }
+    int rows = sprite_len;
+    if (!wrap && top + rows > fb->height) rows = fb->height - top;
+    int collided = 0;
+    for (int y = 0; y < rows; y++) {
+        int row_y = top + y < fb->height ? top + y : top + y - fb->height;
+        uint64_t* row = fb->planes[plane][row_y];
+        uint64_t bits = wide ? (uint64_t) (sprite[2 * y] << 8 | sprite[2 * y + 1]) << 48 : (uint64_t) sprite[y] << 56;
+        uint64_t part = bits >> shift;
+        fb->dirty_rows |= (uint64_t) (bits != 0) << row_y;
+        uint64_t cleared = row[word] & part;
+        row[word] ^= part;
+        if (spills) {
+            part = bits << (64 - shift);
+            cleared |= row[next] & part;
+            row[next] ^= part;
+        }
+        collided += cleared != 0;
+    }
+    return collided;
+}
+
+// Bits of dirty_rows for the rows that can be seen
+static uint64_t visible_rows(const framebuffer* fb) {
+    return fb->height < 64 ? (1ULL << fb->height) - 1 : ALL_ROWS_DIRTY;
+}
+
+void scroll_down(framebuffer* fb, uint8_t planes, int n) {
+    if (n <= 0) return;
+    if (n > fb->height) n = fb->height;
+    for (int p = 0; p < FB_PLANES; p++) {
+        if (!((planes >> p) & 1)) continue;
+        memmove(fb->planes[p][n], fb->planes[p][0], (fb->height - n) * sizeof(fb->planes[p][0]));
+        memset(fb->planes[p][0], 0, n * sizeof(fb->planes[p][0]));
+    }
+    fb->dirty_rows |= visible_rows(fb);
+}
+
+void scroll_up(framebuffer* fb, uint8_t planes, int n) {
+    if (n <= 0) return;
+    if (n > fb->height) n = fb->height;
+    for (int p = 0; p < FB_PLANES; p++) {
+        if (!((planes >> p) & 1)) continue;
+        memmove(fb->planes[p][0], fb->planes[p][n], (fb->height - n) * sizeof(fb->planes[p][0]));
+        memset(fb->planes[p][fb->height - n], 0, n * sizeof(fb->planes[p][0]));
+    }
+    fb->dirty_rows |= visible_rows(fb);
+}
+
+// Sideways scrolls only ever move a few pixels, so they're a shift and a carry between words
+void scroll_right(framebuffer* fb, uint8_t planes, int n) {
+    if (n <= 0 || n >= 64) return;
+    int words = fb->width / 64;
+    for (int p = 0; p < FB_PLANES; p++) {
+        if (!((planes >> p) & 1)) continue;
+        for (int y = 0; y < fb->height; y++) {
+            uint64_t* row = fb->planes[p][y];
+            for (int w = words - 1; w > 0; w--) {
+                row[w] = row[w] >> n | row[w - 1] << (64 - n);
+            }
+            row[0] >>= n;
+        }
+    }
+    fb->dirty_rows |= visible_rows(fb);
+}
+
+void scroll_left(framebuffer* fb, uint8_t planes, int n) {
+    if (n <= 0 || n >= 64) return;
+    int words = fb->width / 64;
+    for (int p = 0; p < FB_PLANES; p++) {
+        if (!((planes >> p) & 1)) continue;
+        for (int y = 0; y < fb->height; y++) {
+            uint64_t* row = fb->planes[p][y];
+            for (int w = 0; w < words - 1; w++) {
+                row[w] = row[w] << n | row[w + 1] >> (64 - n);
+            }
+            row[words - 1] <<= n;
+        }
+    }
+    fb->dirty_rows |= visible_rows(fb);
+}
+
+// Whether anything is lit on plane p
+static bool plane_used(const framebuffer* fb, int p) {
+    for (int y = 0; y < fb->height; y++) {
+        for (int w = 0; w < fb->width / 64; w++) {
+            if (fb->planes[p][y][w] != 0) return true;
+        }
+    }
+    return false;
+}
+
+uint64_t screen_hash(const framebuffer* fb) {
+    // Words are hashed most significant byte first so the hash doesn't depend on host endianness
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (int p = 0; p < FB_PLANES; p++) {
+        // Planes past the first only count once drawn on, so single plane screens hash the same as ever
+        if (p > 0 && !plane_used(fb, p)) continue;
+        for (int y = 0; y < fb->height; y++) {
+            for (int w = 0; w < fb->width / 64; w++) {
+                uint64_t word = fb->planes[p][y][w];
+                for (int b = 7; b >= 0; b--) {
+                    hash ^= (word >> (b * 8)) & 0xFF;
+                    hash *= 0x100000001b3ULL;
+                }
+            }
+        }
+    }
+    return hash;
+}
+
+void frame_exchange_init(frame_exchange* x, const framebuffer* fb) {
+    for (int k = 0; k < 3; k++) {
+        x->slots[k] = *fb;
+        x->slots[k].dirty_rows = ALL_ROWS_DIRTY;
+    }
+    x->back = 0;
+    x->middle = 1;
+    x->front = 2;
+    x->pending_rows = 0;
+}
+
+void frame_exchange_publish(frame_exchange* x, framebuffer* fb) {
+    framebuffer* out = &x->slots[x->back];
+    uint64_t changed = fb->dirty_rows;
+    x->pending_rows |= changed;
+    *out = *fb;
+    out->dirty_rows = x->pending_rows;
+    fb->dirty_rows = 0;
+    // Releases the copy to the reader, and takes back whichever slot the reader left in the middle
+    uint32_t old = __atomic_exchange_n(&x->middle, x->back | FRAME_FRESH, __ATOMIC_ACQ_REL);
+    x->back = old & ~FRAME_FRESH;
+    // Once the reader has taken the frame before this one, only this one's changes are still
+    // pending. If it's skipping frames they keep adding up until it takes one.
+    if (!(old & FRAME_FRESH)) x->pending_rows = changed;
+}
+
+framebuffer* frame_exchange_take(frame_exchange* x) {
+    if (!(__atomic_load_n(&x->middle, __ATOMIC_ACQUIRE) & FRAME_FRESH)) return NULL;
+    uint32_t old = __atomic_exchange_n(&x->middle, x->front, __ATOMIC_ACQ_REL);
+    x->front = old & ~FRAME_FRESH;
+    return &x->slots[x->front];
+}
+
+framebuffer* frame_exchange_front(frame_exchange* x) {
+    return &x->slots[x->front];
+}
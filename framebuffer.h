@@ -0,0 +1,100 @@
+#ifndef CHIP8_FRAMEBUFFER_H
+#define CHIP8_FRAMEBUFFER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SCREEN_WIDTH   64
+#define SCREEN_HEIGHT  32
+
+// Size of a CHIP-8 pixel when shown, in the window and in captures
+#define PIXEL_WIDTH    15
+#define PIXEL_HEIGHT   15
+
+// Largest display the framebuffer can hold, for 128x64 modes
+#define FB_MAX_WIDTH   128
+#define FB_MAX_HEIGHT  64
+#define FB_ROW_WORDS   (FB_MAX_WIDTH / 64)
+// XO-CHIP draws on two bitplanes, everything else only uses the first
+#define FB_PLANES      2
+#define ALL_PLANES     ((1u << FB_PLANES) - 1)
+
+/*
+ * The CHIP-8 display, packed one bit per pixel in each plane.
+ * Each row is FB_ROW_WORDS 64 bit words, and the leftmost pixel of a word is its top bit,
+ * so drawing a sprite row is a shift, an AND for the collision check and an XOR, and
+ * scrolling is moving whole rows or shifting words. A pixel's colour is its plane bits.
+ */
+typedef struct {
+    uint64_t planes[FB_PLANES][FB_MAX_HEIGHT][FB_ROW_WORDS];
+    uint16_t width;
+    uint16_t height;
+    // Bit y is set when row y changed since the display last showed it
+    uint64_t dirty_rows;
+} framebuffer;
+
+#define ALL_ROWS_DIRTY UINT64_MAX
+
+// Sets the size of the visible display (width must be a multiple of 64) and clears it
+void set_screen_size(framebuffer* fb, uint16_t width, uint16_t height);
+void clear_screen(framebuffer* fb);
+// Clears the planes whose bits are set in planes
+void clear_planes(framebuffer* fb, uint8_t planes);
+// Draws an 8 pixel wide sprite on the first plane, clipped at the edges. Returns true on a collision.
+bool draw_sprite(framebuffer* fb, uint8_t start_x, uint8_t start_y, const uint8_t sprite[], uint8_t sprite_len);
+/*
+ * Draws a sprite of sprite_len rows on one plane, 8 pixels wide or with wide 16 (two bytes
+ * a row). It's clipped at the right and bottom edges, or with wrap continues on the other
+ * side. Returns the number of rows that collided with lit pixels.
+ */
+int draw_plane_sprite(framebuffer* fb, int plane, uint8_t start_x, uint8_t start_y, const uint8_t sprite[],
+                      uint8_t sprite_len, bool wide, bool wrap);
+// Scroll the given planes by n pixels, filling in with unlit pixels
+void scroll_down(framebuffer* fb, uint8_t planes, int n);
+void scroll_up(framebuffer* fb, uint8_t planes, int n);
+void scroll_right(framebuffer* fb, uint8_t planes, int n);
+void scroll_left(framebuffer* fb, uint8_t planes, int n);
+// FNV-1a hash of the screen contents, used to compare runs without a window
+uint64_t screen_hash(const framebuffer* fb);
+
+/*
+ * Lock-free triple buffer for handing finished frames from the thread that emulates them
+ * to the thread that shows them. The writer fills its back slot and swaps it with the
+ * middle one, the reader swaps its front slot with the middle one when there's a new
+ * frame there, and neither ever waits. Each frame is published with every row changed since
+ * the reader last took one, so skipping frames and only uploading dirty rows stays correct.
+ */
+// Set in middle while it holds a frame the reader hasn't taken
+#define FRAME_FRESH 4u
+
+typedef struct {
+    framebuffer slots[3];
+    // Slot index shared by both sides, plus FRAME_FRESH
+    uint32_t middle;
+    // Only touched by the writer
+    uint32_t back;
+    // Rows changed since the frame the reader last took
+    uint64_t pending_rows;
+    // Only touched by the reader
+    uint32_t front;
+} frame_exchange;
+
+// Starts every slot out as fb, so the reader's front slot can be shown right away
+void frame_exchange_init(frame_exchange* x, const framebuffer* fb);
+// Writer: publishes a copy of fb and clears fb->dirty_rows like showing it would
+void frame_exchange_publish(frame_exchange* x, framebuffer* fb);
+// Reader: the newest frame if one came since the last call, otherwise NULL
+framebuffer* frame_exchange_take(frame_exchange* x);
+// Reader: the frame taken last
+framebuffer* frame_exchange_front(frame_exchange* x);
+
+// Colour of a pixel: bit p is set when it's lit on plane p
+static inline uint8_t screen_pixel(const framebuffer* fb, int x, int y) {
+    uint8_t color = 0;
+    for (int p = 0; p < FB_PLANES; p++) {
+        color |= ((fb->planes[p][y][x / 64] >> (63 - x % 64)) & 1) << p;
+    }
+    return color;
+}
+
+#endif
@@ -0,0 +1,155 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+#include "vm.h"
+#ifdef CHIP8_HAVE_JIT
+#include "jit.h"
+#endif
+
+/*
+ * Fuzzing harness. Built with clang and CHIP8_FUZZ it's a libFuzzer target; otherwise main
+ * runs the inputs named on the command line, or stdin, which is what AFL wants (with
+ * afl-clang-fast it loops in persistent mode). An input is:
+ *   byte 0    instruction set in bits 0-1 (mod 3), and bit 2 to run the JIT alongside the
+ *             interpreter and abort if they ever disagree
+ *   byte 1    n, the number of frames of keys that follow
+ *   n * 2     keys held during each frame, little endian, bit k for key k
+ *   the rest  the ROM
+ * and runs for FUZZ_FRAMES frames at the default speed.
+ */
+
+#define FUZZ_FRAMES 60
+
+// A freshly loaded VM with no program, for each mode
+static chip8_vm pristine[CHIP8_MODE_COUNT];
+static chip8_vm vm;
+static bool initialized;
+// How much of each VM's memory its last run could reach, and so may have written to
+static size_t vm_reach = XO_RAM_SIZE;
+#ifdef CHIP8_HAVE_JIT
+static chip8_vm jitted;
+static size_t jitted_reach = XO_RAM_SIZE;
+static chip8_jit* jit;
+#endif
+
+static void fuzz_init(void) {
+    for (int m = 0; m < CHIP8_MODE_COUNT; m++) {
+        vm_load_program_mode(&pristine[m], (chip8_mode) m, DEFAULT_IPS, NULL, 0);
+    }
+#ifdef CHIP8_HAVE_JIT
+    jit = jit_new();
+#endif
+    initialized = true;
+}
+
+/*
+ * The same as vm_load_program_mode on a zeroed VM, but by copying the pristine VM, and only
+ * the memory this run or the last one can reach, which is a lot cheaper than loading it afresh.
+ */
+static void fuzz_reset(chip8_vm* dst, size_t* reach, chip8_mode mode, const uint8_t* rom, size_t len) {
+    const chip8_vm* src = &pristine[mode];
+    size_t reachable = mode == MODE_XOCHIP ? XO_RAM_SIZE : RAM_SIZE;
+    memcpy(dst->ram, src->ram, reachable > *reach ? reachable : *reach);
+    *reach = reachable;
+    memcpy(&dst->mode, &src->mode, sizeof(chip8_vm) - offsetof(chip8_vm, mode));
+    if (len > (size_t) MODE_MAX_ROM_SIZE(mode)) len = MODE_MAX_ROM_SIZE(mode);
+    memcpy(&dst->ram[PROGRAM_START], rom, len);
+}
+
+// Holds keys the way chip8_batch's input scripts do, releasing to Fx0A the lowest key let go
+static void fuzz_set_keys(chip8_vm* v, uint16_t keys) {
+    uint16_t released = v->keys & ~keys;
+    v->keys = keys;
+    if (released != 0 && v->waiting_for_keypress) v->key_released = (int8_t) __builtin_ctz(released);
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    if (size < 2) return 0;
+    if (!initialized) fuzz_init();
+    chip8_mode mode = (chip8_mode) ((data[0] & 3) % CHIP8_MODE_COUNT);
+    size_t frames = data[1];
+    if (2 + frames * 2 > size) frames = (size - 2) / 2;
+    const uint8_t* keys = data + 2;
+    const uint8_t* rom = keys + frames * 2;
+    size_t rom_len = size - 2 - frames * 2;
+    fuzz_reset(&vm, &vm_reach, mode, rom, rom_len);
+#ifdef CHIP8_HAVE_JIT
+    bool differential = (data[0] & 4) && jit != NULL;
+    if (differential) {
+        fuzz_reset(&jitted, &jitted_reach, mode, rom, rom_len);
+        jit_attach(jit, &jitted);
+    }
+#endif
+    for (size_t f = 0; f < FUZZ_FRAMES; f++) {
+        if (f < frames) fuzz_set_keys(&vm, (uint16_t) (keys[f * 2] | keys[f * 2 + 1] << 8));
+        tick_result res = vm_run_frame(&vm);
+#ifdef CHIP8_HAVE_JIT
+        if (differential) {
+            if (f < frames) fuzz_set_keys(&jitted, (uint16_t) (keys[f * 2] | keys[f * 2 + 1] << 8));
+            tick_result jit_res = vm_run_frame(&jitted);
+            // Registers every frame, and the rest (64K of memory, the screen) once the run ends
+            const char* diff = NULL;
+            if (vm.pc != jitted.pc || vm.cycles != jitted.cycles || memcmp(vm.reg, jitted.reg, 16) != 0
+                || res != SUCCESS || f == FUZZ_FRAMES - 1) {
+                diff = vm_state_diff(&vm, &jitted);
+            }
+            if (res != jit_res || diff != NULL) {
+                fprintf(stderr, "JIT MISMATCH in frame %zu: %s\n", f, diff != NULL ? diff : "result");
+                abort();
+            }
+        }
+#endif
+        if (res != SUCCESS) break;
+    }
+    return 0;
+}
+
+#ifndef CHIP8_LIBFUZZER
+static uint8_t input[2 + 255 * 2 + XO_MAX_ROM_SIZE];
+
+static size_t read_input(FILE* file) {
+    return fread(input, 1, sizeof(input), file);
+}
+
+int main(int argc, char* argv[]) {
+    // --repeat N runs each input N times and prints how many runs a second that made
+    long repeat = 1;
+    int first = 1;
+    if (argc > 2 && strcmp(argv[1], "--repeat") == 0) {
+        repeat = strtol(argv[2], NULL, 10);
+        first = 3;
+    }
+    if (first == argc) {
+#ifdef __AFL_LOOP
+        while (__AFL_LOOP(10000)) {
+            LLVMFuzzerTestOneInput(input, read_input(stdin));
+        }
+#else
+        LLVMFuzzerTestOneInput(input, read_input(stdin));
+#endif
+        return 0;
+    }
+    long runs = 0;
+    clock_t start = clock();
+    for (int a = first; a < argc; a++) {
+        FILE* file = fopen(argv[a], "rb");
+        if (file == NULL) {
+            printf("Error reading \"%s\"\n", argv[a]);
+            return 1;
+        }
+        size_t len = read_input(file);
+        fclose(file);
+        for (long r = 0; r < repeat; r++) {
+            LLVMFuzzerTestOneInput(input, len);
+            runs++;
+        }
+    }
+    double elapsed = (double) (clock() - start) / CLOCKS_PER_SEC;
+    printf("%ld runs, %.0f runs/sec\n", runs, elapsed > 0 ? runs / elapsed : 0.0);
+    return 0;
+}
+#endif
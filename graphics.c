@@ -1,118 +1,273 @@
-#include <SDL.h>
+#include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
-#include <stdbool.h>
+#include "graphics.h"
 
-#define SCREEN_WIDTH   64
-#define SCREEN_HEIGHT  32
-#define PIXEL_WIDTH    15
-#define PIXEL_HEIGHT   15
-#define WINDOW_WIDTH   (SCREEN_WIDTH * PIXEL_WIDTH)
-#define WINDOW_HEIGHT  (SCREEN_HEIGHT * PIXEL_HEIGHT)
+// ARGB8888
+#define BLACK 0xFF000000
+#define WHITE 0xFFFFFFFF
+#define LIGHT_GREY 0xFFAAAAAA
+#define DARK_GREY 0xFF555555
 
-#define BLACK 0, 0, 0
-#define WHITE 255, 255, 255
+// If we fall this many frames behind (e.g. the window was being dragged), give up catching up
+#define MAX_FRAMES_BEHIND 8
 
-typedef struct {
-    double fps_millis;
-    double last_tick;
-} fps_clock;
+// Latency overlay: bar width in pixels, bar height per ms, and the tallest bar in ms
+#define OVERLAY_BAR_WIDTH 4
+#define OVERLAY_PX_PER_MS 3
+#define OVERLAY_MAX_MS 100
 
 fps_clock new_fps_clock(uint32_t fps) {
     fps_clock c;
-    c.fps_millis = 1000.0 / (double) fps;
-    c.last_tick = SDL_GetTicks();
+    c.freq = SDL_GetPerformanceFrequency();
+    c.fps = fps;
+    c.start = SDL_GetPerformanceCounter();
+    c.frames = 0;
+    c.last_frame = c.start;
+    c.samples = 0;
+    c.sum = 0;
+    c.sum_sq = 0;
+    c.worst = 0;
+    c.wake = NULL;
     return c;
 }
 
-void fps_clock_tick(fps_clock* clock) {
-    double elapsed = SDL_GetTicks() - clock->last_tick;
-    int32_t diff = lround(clock->fps_millis - elapsed);
-    if (diff > 0) {
-        SDL_Delay((uint32_t) diff);
+// Sleeps until about the performance counter reaches until, without going over by more than SDL_Delay does
+static void clock_sleep_until(const fps_clock* clock, uint64_t until) {
+    uint64_t now = SDL_GetPerformanceCounter();
+    if (until > now) SDL_Delay((uint32_t) ((until - now) * 1000 / clock->freq));
+}
+
+static uint64_t frame_deadline(const fps_clock* clock) {
+    return clock->start + clock->frames * clock->freq / clock->fps;
+}
+
+void fps_clock_tick(fps_clock* clock, bool idle) {
+    clock->frames++;
+    uint64_t deadline = frame_deadline(clock);
+    uint64_t now = SDL_GetPerformanceCounter();
+    if (now > deadline + MAX_FRAMES_BEHIND * clock->freq / clock->fps) {
+        // Start counting again from this frame instead of running a burst of frames to catch up
+        clock->start = now - clock->frames * clock->freq / clock->fps;
+        deadline = now;
     }
-    clock->last_tick = SDL_GetTicks();
+    if (idle) {
+        // Nothing will happen before the next frame unless a key is pressed, so sleep the
+        // whole wait without spinning, and wake early if one is
+        uint32_t ms = deadline > now ? (uint32_t) ((deadline - now) * 1000 / clock->freq) : 0;
+        if (clock->wake != NULL) {
+            SDL_SemWaitTimeout(clock->wake, ms);
+            // One wake up is enough for any number of presses
+            while (SDL_SemTryWait(clock->wake) == 0) {}
+        } else {
+            SDL_Delay(ms);
+        }
+        now = SDL_GetPerformanceCounter();
+    } else {
+        // Sleep for most of the wait, leaving the last couple of milliseconds to a yield loop
+        // because SDL_Delay can oversleep by about a scheduler tick
+        uint64_t margin = clock->freq / 500;
+        if (deadline > now + margin) clock_sleep_until(clock, deadline - margin);
+        while ((now = SDL_GetPerformanceCounter()) < deadline) {
+            SDL_Delay(0);
+        }
+    }
+    double frame_time = (double) (now - clock->last_frame) / clock->freq;
+    double error = frame_time - 1.0 / clock->fps;
+    if (error < 0) error = -error;
+    clock->last_frame = now;
+    clock->samples++;
+    clock->sum += frame_time;
+    clock->sum_sq += frame_time * frame_time;
+    if (error > clock->worst) clock->worst = error;
+}
+
+void fps_clock_wait_part(fps_clock* clock, uint32_t part, uint32_t parts) {
+    uint64_t at = clock->start + (clock->frames * parts + part) * clock->freq / ((uint64_t) clock->fps * parts);
+    clock_sleep_until(clock, at);
 }
 
-typedef struct {
-    SDL_Window* window;
-    SDL_Surface* surf;
-    uint8_t screen[64][32];
-    uint32_t bg;
-    uint32_t fg;
-} sdl_handle;
+void fps_clock_report(const fps_clock* clock) {
+    if (clock->samples == 0) return;
+    double mean = clock->sum / clock->samples;
+    double variance = clock->sum_sq / clock->samples - mean * mean;
+    printf("frame time: mean %.3f ms, jitter (stddev) %.3f ms, worst error %.3f ms over %llu frames\n",
+           mean * 1000, sqrt(variance > 0 ? variance : 0) * 1000, clock->worst * 1000,
+           (unsigned long long) clock->samples);
+}
 
-void clear_screen(sdl_handle*);
+void latency_press(latency_meter* meter, uint32_t ticks) {
+    // Only the oldest unanswered press counts, later ones are answered by the same frame
+    if (meter->waiting) return;
+    meter->waiting = true;
+    meter->pressed = ticks;
+}
+
+// Called with the time a changed frame finished presenting
+static bool latency_shown(latency_meter* meter, uint32_t ticks) {
+    if (!meter->waiting) return false;
+    meter->waiting = false;
+    double ms = (double) (uint32_t) (ticks - meter->pressed);
+    meter->history[meter->next] = (float) ms;
+    meter->next = (meter->next + 1) % LATENCY_HISTORY;
+    meter->samples++;
+    meter->sum += ms;
+    if (ms > meter->worst) meter->worst = ms;
+    return true;
+}
+
+void latency_report(const latency_meter* meter) {
+    if (meter->samples == 0) return;
+    printf("input latency: mean %.1f ms, worst %.0f ms over %llu key presses\n",
+           meter->sum / meter->samples, meter->worst, (unsigned long long) meter->samples);
+}
+
+static void update_title(sdl_handle* gfx) {
+    const latency_meter* m = &gfx->latency;
+    char title[160] = "CHIP-8";
+    size_t len = strlen(title);
+    if (gfx->speed == 0) {
+        len += snprintf(title + len, sizeof(title) - len, " - unlimited speed");
+    } else if (gfx->speed != 1) {
+        len += snprintf(title + len, sizeof(title) - len, " - %gx speed", gfx->speed);
+    }
+    if (gfx->overlay && m->samples > 0) {
+        float last = m->history[(m->next + LATENCY_HISTORY - 1) % LATENCY_HISTORY];
+        snprintf(title + len, sizeof(title) - len, " - input latency %.0f ms (mean %.1f ms, worst %.0f ms)", last,
+                 m->sum / m->samples, m->worst);
+    }
+    SDL_SetWindowTitle(gfx->window, title);
+}
+
+// Bars along the bottom of the window, oldest first, with a line at one frame
+static void draw_overlay(sdl_handle* gfx) {
+    const latency_meter* m = &gfx->latency;
+    int width, height;
+    if (SDL_GetRendererOutputSize(gfx->renderer, &width, &height) != 0) return;
+    int shown = m->samples < LATENCY_HISTORY ? (int) m->samples : LATENCY_HISTORY;
+    for (int k = 0; k < shown; k++) {
+        float ms = m->history[(m->next + LATENCY_HISTORY - shown + k) % LATENCY_HISTORY];
+        if (ms > OVERLAY_MAX_MS) ms = OVERLAY_MAX_MS;
+        int h = (int) (ms * OVERLAY_PX_PER_MS) + 1;
+        SDL_Rect bar = {k * OVERLAY_BAR_WIDTH, height - h, OVERLAY_BAR_WIDTH - 1, h};
+        // Green within a frame, yellow within two, red beyond
+        if (ms <= 1000.0 / 60) {
+            SDL_SetRenderDrawColor(gfx->renderer, 0x40, 0xD0, 0x40, 0xFF);
+        } else if (ms <= 2000.0 / 60) {
+            SDL_SetRenderDrawColor(gfx->renderer, 0xE0, 0xC0, 0x20, 0xFF);
+        } else {
+            SDL_SetRenderDrawColor(gfx->renderer, 0xE0, 0x40, 0x40, 0xFF);
+        }
+        SDL_RenderFillRect(gfx->renderer, &bar);
+    }
+    SDL_Rect frame_line = {0, height - (int) (1000.0 / 60 * OVERLAY_PX_PER_MS) - 1,
+                           LATENCY_HISTORY * OVERLAY_BAR_WIDTH, 1};
+    SDL_SetRenderDrawColor(gfx->renderer, 0x80, 0x80, 0x80, 0xFF);
+    SDL_RenderFillRect(gfx->renderer, &frame_line);
+}
+
+void toggle_overlay(sdl_handle* gfx) {
+    gfx->overlay = !gfx->overlay;
+    gfx->redraw = true;
+    update_title(gfx);
+}
+
+void show_speed(sdl_handle* gfx, double speed) {
+    if (speed == gfx->speed) return;
+    gfx->speed = speed;
+    update_title(gfx);
+}
 
 sdl_handle graphics_init() {
     sdl_handle h;
     SDL_Window* window = NULL;
-    if (SDL_Init(SDL_INIT_EVERYTHING) < 0) {
+    if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_EVENTS | SDL_INIT_TIMER) < 0) {
         printf("SDL could not initialize! SDL_Error: %s\n", SDL_GetError());
         exit(1);
     }
     window = SDL_CreateWindow("CHIP-8", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, \
-                              WINDOW_WIDTH, WINDOW_HEIGHT, SDL_WINDOW_SHOWN);
+                              WINDOW_WIDTH, WINDOW_HEIGHT, SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE);
     if(window == NULL) {
         printf("Window could not be created! SDL_Error: %s\n", SDL_GetError());
         exit(1);
     }
     h.window = window;
-    h.surf = SDL_GetWindowSurface(window);
-    h.bg = SDL_MapRGB(h.surf->format, BLACK);
-    h.fg = SDL_MapRGB(h.surf->format, WHITE);
-    clear_screen(&h);
+    h.renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
+    if (h.renderer == NULL) {
+        // No GPU renderer available, let SDL pick the software one
+        h.renderer = SDL_CreateRenderer(window, -1, 0);
+    }
+    if (h.renderer == NULL) {
+        printf("Renderer could not be created! SDL_Error: %s\n", SDL_GetError());
+        exit(1);
+    }
+    // Keep the pixels sharp when the texture is scaled up
+    SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "0");
+    h.texture = NULL;
+    h.tex_width = 0;
+    h.tex_height = 0;
+    h.bg = BLACK;
+    h.fg = WHITE;
+    h.fg2 = LIGHT_GREY;
+    h.blend = DARK_GREY;
+    h.redraw = true;
+    memset(&h.latency, 0, sizeof(h.latency));
+    h.overlay = false;
+    h.speed = 1;
     return h;
 }
 
-void clear_screen(sdl_handle* gfx) {
-    SDL_FillRect(gfx->surf, NULL, gfx->bg);
-    for (int x = 0; x < 64; x++) {
-        for (int y = 0; y < 32; y++) {
-            gfx->screen[x][y] = 0;
-        }
+static void resize_texture(sdl_handle* gfx, uint16_t width, uint16_t height) {
+    if (gfx->texture != NULL) SDL_DestroyTexture(gfx->texture);
+    gfx->texture = SDL_CreateTexture(gfx->renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, width, height);
+    if (gfx->texture == NULL) {
+        printf("Texture could not be created! SDL_Error: %s\n", SDL_GetError());
+        exit(1);
     }
+    gfx->tex_width = width;
+    gfx->tex_height = height;
 }
 
-bool draw_sprite(sdl_handle* gfx, uint8_t start_x, uint8_t start_y, const uint8_t sprite[], uint8_t sprite_len) {
-    start_x = start_x % SCREEN_WIDTH;
-    start_y = start_y % SCREEN_HEIGHT;
-    uint8_t old;
-    uint16_t new;
-    uint8_t *pix;
-    bool cleared_pixel = false;
-    for (int y = 0; y < sprite_len; y++) {
-        for (int x = 0; x < 8; x++) {
-            if ((start_x + x >= SCREEN_WIDTH) || (start_y + y) >= SCREEN_HEIGHT) break;
-            pix = &gfx->screen[start_x + x][start_y + y];
-            old = *pix;
-            new = (sprite[y] >> (7 - x)) & 0x1;
-            //printf("%s", new ? "#" : "_");
-            // XOR the sprite data to the screen
-            if ((old == 1) && (new == 1)) {
-                *pix = 0;
-                cleared_pixel = true;
-            } else if ((old == 0) && (new == 1)) {
-                *pix = 1;
+void display_screen(sdl_handle* gfx, framebuffer* fb) {
+    if (fb->width != gfx->tex_width || fb->height != gfx->tex_height) {
+        resize_texture(gfx, fb->width, fb->height);
+        fb->dirty_rows = ALL_ROWS_DIRTY;
+    }
+    uint64_t dirty = fb->height < 64 ? fb->dirty_rows & ((1ULL << fb->height) - 1) : fb->dirty_rows;
+    if (dirty == 0 && !gfx->redraw) return;
+    if (dirty != 0) {
+        // Upload the band of rows between the first and last changed ones
+        int first = 0;
+        int last = fb->height - 1;
+        while (!((dirty >> first) & 1)) first++;
+        while (!((dirty >> last) & 1)) last--;
+        SDL_Rect band = {0, first, fb->width, last - first + 1};
+        uint32_t colors[4] = {gfx->bg, gfx->fg, gfx->fg2, gfx->blend};
+        void* pixels;
+        int pitch;
+        if (SDL_LockTexture(gfx->texture, &band, &pixels, &pitch) == 0) {
+            for (int y = first; y <= last; y++) {
+                uint32_t* out = (uint32_t*) ((uint8_t*) pixels + (y - first) * pitch);
+                for (int w = 0; w < fb->width / 64; w++) {
+                    uint64_t row = fb->planes[0][y][w];
+                    uint64_t row2 = fb->planes[1][y][w];
+                    for (int x = 0; x < 64; x++) {
+                        out[w * 64 + x] = colors[((row >> (63 - x)) & 1) | ((row2 >> (63 - x)) & 1) << 1];
+                    }
+                }
             }
+            SDL_UnlockTexture(gfx->texture);
         }
-        //printf("\n");
     }
-    //printf("---\n\n");
-    return cleared_pixel;
-}
-
-void display_screen(sdl_handle* gfx) {
-    uint32_t colors[2] = {gfx->bg, gfx->fg};
-    SDL_Rect pixel;
-    pixel.w = PIXEL_WIDTH;
-    pixel.h = PIXEL_HEIGHT;
-    for (int x = 0; x < SCREEN_WIDTH; x++) {
-        for (int y = 0; y < SCREEN_HEIGHT; y++) {
-            pixel.x = x * PIXEL_WIDTH;
-            pixel.y = y * PIXEL_HEIGHT;
-            SDL_FillRect(gfx->surf, &pixel, colors[gfx->screen[x][y]]);
-        }
+    fb->dirty_rows = 0;
+    SDL_RenderCopy(gfx->renderer, gfx->texture, NULL, NULL);
+    if (gfx->overlay) draw_overlay(gfx);
+    SDL_RenderPresent(gfx->renderer);
+    gfx->redraw = false;
+    if (dirty != 0 && latency_shown(&gfx->latency, SDL_GetTicks()) && gfx->overlay) {
+        // The new bar shows up with the next present
+        update_title(gfx);
+        gfx->redraw = true;
     }
-    SDL_UpdateWindowSurface(gfx->window);
-}
\ No newline at end of file
+}
@@ -0,0 +1,93 @@
+#ifndef CHIP8_GRAPHICS_H
+#define CHIP8_GRAPHICS_H
+
+#include <SDL.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "framebuffer.h"
+
+#define WINDOW_WIDTH   (SCREEN_WIDTH * PIXEL_WIDTH)
+#define WINDOW_HEIGHT  (SCREEN_HEIGHT * PIXEL_HEIGHT)
+
+/*
+ * Frame pacing on the high resolution performance counter.
+ * Deadlines are computed from the start time and the frame count rather than
+ * from the previous frame, so rounding never accumulates into drift.
+ */
+typedef struct {
+    uint64_t freq;
+    uint32_t fps;
+    uint64_t start;
+    uint64_t frames;
+    uint64_t last_frame;
+    // Frame time statistics, in seconds
+    uint64_t samples;
+    double sum;
+    double sum_sq;
+    double worst;
+    // Posted by another thread (on key presses) to end an idle wait early. May be NULL.
+    SDL_sem* wake;
+} fps_clock;
+
+fps_clock new_fps_clock(uint32_t fps);
+// Waits for the next frame. An idle VM gets a cheaper, slightly less exact wait that ends early on clock->wake.
+void fps_clock_tick(fps_clock* clock, bool idle);
+// Waits until part/parts of the way through the current frame. Only sleeps, so it can run a little late.
+void fps_clock_wait_part(fps_clock* clock, uint32_t part, uint32_t parts);
+// Prints the mean frame time, its standard deviation and the worst frame
+void fps_clock_report(const fps_clock* clock);
+
+#define LATENCY_HISTORY 120
+
+/*
+ * Input-to-photon latency: from a CHIP-8 key going down (its SDL event timestamp) until the
+ * first frame that changed after it has been presented. That's the program's reaction time
+ * only if it doesn't animate on its own, otherwise it's a lower bound. It stops when
+ * SDL_RenderPresent returns, so the display's own delay isn't included.
+ */
+typedef struct {
+    bool waiting;
+    // SDL_GetTicks time of the oldest press that hasn't been shown yet
+    uint32_t pressed;
+    // The last LATENCY_HISTORY measurements in ms, next being the oldest
+    float history[LATENCY_HISTORY];
+    int next;
+    uint64_t samples;
+    double sum;
+    double worst;
+} latency_meter;
+
+void latency_press(latency_meter* meter, uint32_t ticks);
+// Prints the mean and worst latency
+void latency_report(const latency_meter* meter);
+
+/*
+ * The window shows a streaming texture the size of the CHIP-8 display, which SDL
+ * scales up to the window. Only rows that changed are uploaded.
+ */
+typedef struct {
+    SDL_Window* window;
+    SDL_Renderer* renderer;
+    SDL_Texture* texture;
+    uint16_t tex_width;
+    uint16_t tex_height;
+    uint32_t bg;
+    uint32_t fg;
+    // XO-CHIP colours for pixels lit on the second plane only, and on both
+    uint32_t fg2;
+    uint32_t blend;
+    // Set when the window needs repainting even though the screen didn't change
+    bool redraw;
+    latency_meter latency;
+    // Draws the latency history over the screen and shows the numbers in the title bar
+    bool overlay;
+    // Emulated frames per shown frame, in the title bar unless it's 1. 0 means unlimited.
+    double speed;
+} sdl_handle;
+
+sdl_handle graphics_init();
+void display_screen(sdl_handle* gfx, framebuffer* fb);
+void toggle_overlay(sdl_handle* gfx);
+void show_speed(sdl_handle* gfx, double speed);
+
+#endif
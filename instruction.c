@@ -1,60 +1,44 @@
-#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "instruction.h"
 
-typedef enum {
-    CLEAR,
-    RET,
-    JMP,
-    CALL,
-    SKP_EQ,
-    SKP_NEQ,
-    SKP_EQ_REG,
-    LOAD,
-    ADD_NUM,
-    MOV,
-    OR,
-    AND,
-    XOR,
-    ADD_REG,
-    SUB_REG,
-    RSHIFT,
-    SUB_FROM,
-    LSHIFT,
-    SKP_NEQ_REG,
-    LOAD_I,
-    JMP_REL,
-    RAND,
-    DRAW,
-    SKP_IF_KEY,
-    SKP_IF_NOT_KEY,
-    STORE_DELAY,
-    WAIT_FOR_KEY,
-    SET_DELAY,
-    SET_SOUND,
-    ADD_I,
-    LOAD_DIGIT_SPRITE,
-    STORE_BCD,
-    SAVE_REG,
-    RESTORE_REG,
-    INVALID,
-} instruction_tag;
+// Decodes the 00xx instructions SUPER-CHIP and XO-CHIP added
+static instruction_tag decode_system(uint16_t i, chip8_mode mode) {
+    if ((i & 0xFFF0) == 0x00C0) return SCROLL_DOWN;
+    if ((i & 0xFFF0) == 0x00D0 && mode == MODE_XOCHIP) return SCROLL_UP;
+    switch (i) {
+        case 0x00E0:
+            return CLEAR;
+        case 0x00EE:
+            return RET;
+        case 0x00FB:
+            return SCROLL_RIGHT;
+        case 0x00FC:
+            return SCROLL_LEFT;
+        case 0x00FD:
+            return EXIT;
+        case 0x00FE:
+            return LORES;
+        case 0x00FF:
+            return HIRES;
+        default:
+            // 0NNN calls into the host's machine code, which can't be emulated
+            return INVALID;
+    }
+}
 
-/*
- * Struct that represents a decoded instruction
- */
-typedef struct {
-    instruction_tag tag;
-    uint8_t reg1;
-    uint8_t reg2;
-    uint16_t data;
-} instruction;
-
-
-instruction decode_instruction(uint16_t i) {
-    instruction inst;
-    inst.tag = INVALID;
+instruction decode_instruction(uint16_t i, chip8_mode mode) {
+    // Fields an instruction doesn't use are 0, so decoding the same opcode always gives the same bytes
+    instruction inst = {INVALID, 0, 0, 0};
     switch (i >> 12) {
         case 0x0:
-            inst.tag = (i == 0x00E0 ? CLEAR : RET);
+            if (mode == MODE_CHIP8) {
+                inst.tag = (i == 0x00E0 ? CLEAR : RET);
+            } else {
+                inst.tag = decode_system(i, mode);
+                inst.data = i & 0x000F;
+            }
             break;
         case 0x1:
             inst.tag = JMP;
@@ -76,6 +60,8 @@ instruction decode_instruction(uint16_t i) {
             break;
         case 0x5:
             inst.tag = SKP_EQ_REG;
+            if (mode == MODE_XOCHIP && (i & 0x000F) == 0x2) inst.tag = SAVE_RANGE;
+            if (mode == MODE_XOCHIP && (i & 0x000F) == 0x3) inst.tag = RESTORE_RANGE;
             inst.reg1 = (i & 0x0F00) >> 8;
             inst.reg2 = (i & 0x00F0) >> 4;
             break;
@@ -137,6 +123,8 @@ instruction decode_instruction(uint16_t i) {
                     inst.reg2 = (i & 0x00F0) >> 4;
                     break;
             };
+            // SUPER-CHIP shifts Vx in place, which is shifting Vy with Vy being Vx
+            if (mode == MODE_SCHIP && (inst.tag == RSHIFT || inst.tag == LSHIFT)) inst.reg2 = inst.reg1;
             break;
         case 0x9:
             inst.tag = SKP_NEQ_REG;
@@ -148,7 +136,9 @@ instruction decode_instruction(uint16_t i) {
             inst.data = i & 0x0FFF;
             break;
         case 0xB:
+            // Jumps relative to V0, or on SUPER-CHIP BXNN to XNN + VX
             inst.tag = JMP_REL;
+            inst.reg1 = mode == MODE_SCHIP ? (i & 0x0F00) >> 8 : 0;
             inst.data = i & 0x0FFF;
             break;
         case 0xC:
@@ -169,6 +159,15 @@ instruction decode_instruction(uint16_t i) {
         case 0xF:
             inst.reg1 = (i & 0x0F00) >> 8;
             switch (i & 0x00FF) {
+                case 0x00:
+                    if (mode == MODE_XOCHIP && i == 0xF000) inst.tag = LOAD_I_LONG;
+                    break;
+                case 0x01:
+                    if (mode == MODE_XOCHIP) inst.tag = SELECT_PLANES;
+                    break;
+                case 0x02:
+                    if (mode == MODE_XOCHIP && i == 0xF002) inst.tag = LOAD_PATTERN;
+                    break;
                 case 0x07:
                     inst.tag = STORE_DELAY;
                     break;
@@ -187,15 +186,128 @@ instruction decode_instruction(uint16_t i) {
                 case 0x29:
                     inst.tag = LOAD_DIGIT_SPRITE;
                     break;
+                case 0x30:
+                    if (mode != MODE_CHIP8) inst.tag = LOAD_BIG_DIGIT_SPRITE;
+                    break;
                 case 0x33:
                     inst.tag = STORE_BCD;
                     break;
+                case 0x3A:
+                    if (mode == MODE_XOCHIP) inst.tag = SET_PITCH;
+                    break;
                 case 0x55:
                     inst.tag = SAVE_REG;
                     break;
                 case 0x65:
                     inst.tag = RESTORE_REG;
+                    break;
+                case 0x75:
+                    if (mode != MODE_CHIP8) inst.tag = SAVE_FLAGS;
+                    break;
+                case 0x85:
+                    if (mode != MODE_CHIP8) inst.tag = RESTORE_FLAGS;
             }
     };
     return inst;
-}
\ No newline at end of file
+}
+
+int instruction_write_len(instruction inst) {
+    if (inst.tag == STORE_BCD) return 3;
+    if (inst.tag == SAVE_REG) return inst.reg1 + 1;
+    if (inst.tag == SAVE_RANGE) return abs(inst.reg1 - inst.reg2) + 1;
+    return 0;
+}
+
+static const char* TAG_NAMES[INSTRUCTION_TAG_COUNT] = {
+        "CLEAR", "RET", "JMP", "CALL", "SKP_EQ", "SKP_NEQ", "SKP_EQ_REG", "LOAD", "ADD_NUM", "MOV",
+        "OR", "AND", "XOR", "ADD_REG", "SUB_REG", "RSHIFT", "SUB_FROM", "LSHIFT", "SKP_NEQ_REG",
+        "LOAD_I", "JMP_REL", "RAND", "DRAW", "SKP_IF_KEY", "SKP_IF_NOT_KEY", "STORE_DELAY",
+        "WAIT_FOR_KEY", "SET_DELAY", "SET_SOUND", "ADD_I", "LOAD_DIGIT_SPRITE", "STORE_BCD",
+        "SAVE_REG", "RESTORE_REG", "SCROLL_DOWN", "SCROLL_RIGHT", "SCROLL_LEFT", "EXIT", "LORES",
+        "HIRES", "LOAD_BIG_DIGIT_SPRITE", "SAVE_FLAGS", "RESTORE_FLAGS", "SCROLL_UP", "SAVE_RANGE",
+        "RESTORE_RANGE", "LOAD_I_LONG", "SELECT_PLANES", "LOAD_PATTERN", "SET_PITCH", "INVALID", "UNDECODED"
+};
+
+static const char* MODE_NAMES[CHIP8_MODE_COUNT] = {"chip8", "schip", "xochip"};
+
+const char* instruction_tag_str(instruction_tag tag) {
+    if ((unsigned) tag >= INSTRUCTION_TAG_COUNT) return "?";
+    return TAG_NAMES[tag];
+}
+
+const char* chip8_mode_str(chip8_mode mode) {
+    if ((unsigned) mode >= CHIP8_MODE_COUNT) return "?";
+    return MODE_NAMES[mode];
+}
+
+bool chip8_mode_parse(const char* name, chip8_mode* mode) {
+    for (int m = 0; m < CHIP8_MODE_COUNT; m++) {
+        if (strcmp(name, MODE_NAMES[m]) == 0) {
+            *mode = (chip8_mode) m;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Cowgod's mnemonics, with Octo's names for XO-CHIP's additions
+int disassemble_instruction(uint16_t opcode, uint16_t next, chip8_mode mode, char* out, size_t size) {
+    instruction inst = decode_instruction(opcode, mode);
+    int x = inst.reg1, y = inst.reg2, data = inst.data;
+    switch (inst.tag) {
+        case CLEAR: snprintf(out, size, "CLS"); break;
+        case RET: snprintf(out, size, "RET"); break;
+        case JMP: snprintf(out, size, "JP 0x%03X", data); break;
+        case CALL: snprintf(out, size, "CALL 0x%03X", data); break;
+        case SKP_EQ: snprintf(out, size, "SE V%X, 0x%02X", x, data); break;
+        case SKP_NEQ: snprintf(out, size, "SNE V%X, 0x%02X", x, data); break;
+        case SKP_EQ_REG: snprintf(out, size, "SE V%X, V%X", x, y); break;
+        case LOAD: snprintf(out, size, "LD V%X, 0x%02X", x, data); break;
+        case ADD_NUM: snprintf(out, size, "ADD V%X, 0x%02X", x, data); break;
+        case MOV: snprintf(out, size, "LD V%X, V%X", x, y); break;
+        case OR: snprintf(out, size, "OR V%X, V%X", x, y); break;
+        case AND: snprintf(out, size, "AND V%X, V%X", x, y); break;
+        case XOR: snprintf(out, size, "XOR V%X, V%X", x, y); break;
+        case ADD_REG: snprintf(out, size, "ADD V%X, V%X", x, y); break;
+        case SUB_REG: snprintf(out, size, "SUB V%X, V%X", x, y); break;
+        case RSHIFT: snprintf(out, size, "SHR V%X, V%X", x, y); break;
+        case SUB_FROM: snprintf(out, size, "SUBN V%X, V%X", x, y); break;
+        case LSHIFT: snprintf(out, size, "SHL V%X, V%X", x, y); break;
+        case SKP_NEQ_REG: snprintf(out, size, "SNE V%X, V%X", x, y); break;
+        case LOAD_I: snprintf(out, size, "LD I, 0x%03X", data); break;
+        case JMP_REL: snprintf(out, size, "JP V%X, 0x%03X", x, data); break;
+        case RAND: snprintf(out, size, "RND V%X, 0x%02X", x, data); break;
+        case DRAW: snprintf(out, size, "DRW V%X, V%X, %d", x, y, data); break;
+        case SKP_IF_KEY: snprintf(out, size, "SKP V%X", x); break;
+        case SKP_IF_NOT_KEY: snprintf(out, size, "SKNP V%X", x); break;
+        case STORE_DELAY: snprintf(out, size, "LD V%X, DT", x); break;
+        case WAIT_FOR_KEY: snprintf(out, size, "LD V%X, K", x); break;
+        case SET_DELAY: snprintf(out, size, "LD DT, V%X", x); break;
+        case SET_SOUND: snprintf(out, size, "LD ST, V%X", x); break;
+        case ADD_I: snprintf(out, size, "ADD I, V%X", x); break;
+        case LOAD_DIGIT_SPRITE: snprintf(out, size, "LD F, V%X", x); break;
+        case STORE_BCD: snprintf(out, size, "LD B, V%X", x); break;
+        case SAVE_REG: snprintf(out, size, "LD [I], V%X", x); break;
+        case RESTORE_REG: snprintf(out, size, "LD V%X, [I]", x); break;
+        case SCROLL_DOWN: snprintf(out, size, "SCD %d", data); break;
+        case SCROLL_RIGHT: snprintf(out, size, "SCR"); break;
+        case SCROLL_LEFT: snprintf(out, size, "SCL"); break;
+        case EXIT: snprintf(out, size, "EXIT"); break;
+        case LORES: snprintf(out, size, "LOW"); break;
+        case HIRES: snprintf(out, size, "HIGH"); break;
+        case LOAD_BIG_DIGIT_SPRITE: snprintf(out, size, "LD HF, V%X", x); break;
+        case SAVE_FLAGS: snprintf(out, size, "LD R, V%X", x); break;
+        case RESTORE_FLAGS: snprintf(out, size, "LD V%X, R", x); break;
+        case SCROLL_UP: snprintf(out, size, "SCU %d", data); break;
+        case SAVE_RANGE: snprintf(out, size, "SAVE V%X - V%X", x, y); break;
+        case RESTORE_RANGE: snprintf(out, size, "LOAD V%X - V%X", x, y); break;
+        case LOAD_I_LONG:
+            snprintf(out, size, "LD I, LONG 0x%04X", next);
+            return 4;
+        case SELECT_PLANES: snprintf(out, size, "PLANE %d", x); break;
+        case LOAD_PATTERN: snprintf(out, size, "AUDIO"); break;
+        case SET_PITCH: snprintf(out, size, "PITCH V%X", x); break;
+        default: snprintf(out, size, "DW 0x%04X", opcode); break;
+    }
+    return 2;
+}
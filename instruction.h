@@ -0,0 +1,106 @@
+#ifndef CHIP8_INSTRUCTION_H
+#define CHIP8_INSTRUCTION_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Instruction sets. SUPER-CHIP adds the 128x64 display, scrolling, 16x16 sprites, a large
+ * font and the RPL flags, and XO-CHIP adds to that a second bitplane, 64K of memory, audio
+ * patterns and a few memory instructions. Each also has its own quirks, see vm.c.
+ */
+typedef enum {
+    MODE_CHIP8,
+    MODE_SCHIP,
+    MODE_XOCHIP,
+} chip8_mode;
+
+#define CHIP8_MODE_COUNT (MODE_XOCHIP + 1)
+
+typedef enum {
+    CLEAR,
+    RET,
+    JMP,
+    CALL,
+    SKP_EQ,
+    SKP_NEQ,
+    SKP_EQ_REG,
+    LOAD,
+    ADD_NUM,
+    MOV,
+    OR,
+    AND,
+    XOR,
+    ADD_REG,
+    SUB_REG,
+    RSHIFT,
+    SUB_FROM,
+    LSHIFT,
+    SKP_NEQ_REG,
+    LOAD_I,
+    JMP_REL,
+    RAND,
+    DRAW,
+    SKP_IF_KEY,
+    SKP_IF_NOT_KEY,
+    STORE_DELAY,
+    WAIT_FOR_KEY,
+    SET_DELAY,
+    SET_SOUND,
+    ADD_I,
+    LOAD_DIGIT_SPRITE,
+    STORE_BCD,
+    SAVE_REG,
+    RESTORE_REG,
+    // SUPER-CHIP
+    SCROLL_DOWN,
+    SCROLL_RIGHT,
+    SCROLL_LEFT,
+    EXIT,
+    LORES,
+    HIRES,
+    LOAD_BIG_DIGIT_SPRITE,
+    SAVE_FLAGS,
+    RESTORE_FLAGS,
+    // XO-CHIP
+    SCROLL_UP,
+    SAVE_RANGE,
+    RESTORE_RANGE,
+    LOAD_I_LONG,
+    SELECT_PLANES,
+    LOAD_PATTERN,
+    SET_PITCH,
+    INVALID,
+    // Never returned by decode_instruction, marks empty slots in the VM's instruction cache
+    UNDECODED,
+} instruction_tag;
+
+#define INSTRUCTION_TAG_COUNT (UNDECODED + 1)
+
+/*
+ * Struct that represents a decoded instruction
+ */
+typedef struct {
+    instruction_tag tag;
+    uint8_t reg1;
+    uint8_t reg2;
+    uint16_t data;
+} instruction;
+
+// Opcodes another mode added decode as they did on plain CHIP-8, usually INVALID
+instruction decode_instruction(uint16_t i, chip8_mode mode);
+/*
+ * Writes opcode as assembly in mode, e.g. "LD V1, 0x20", and returns its length in bytes: 4 for
+ * XO-CHIP's F000 NNNN, which takes its address from next, otherwise 2. Opcodes that aren't
+ * instructions in mode come out as "DW" data.
+ */
+int disassemble_instruction(uint16_t opcode, uint16_t next, chip8_mode mode, char* out, size_t size);
+// How many bytes inst stores to memory starting at I, 0 for instructions that don't store any
+int instruction_write_len(instruction inst);
+const char* instruction_tag_str(instruction_tag tag);
+const char* chip8_mode_str(chip8_mode mode);
+// Accepts "chip8", "schip" or "xochip"
+bool chip8_mode_parse(const char* name, chip8_mode* mode);
+
+#endif
@@ -0,0 +1,707 @@
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "jit.h"
+
+#if !defined(__x86_64__)
+#error "The JIT only targets x86-64"
+#endif
+
+/*
+ * Translated code keeps the VM in fixed host registers:
+ *   rbx = chip8_vm*, r12 = cycles left in this call, r13 = I, r14 = chip8_jit*
+ * V0-VF stay in memory and are used as [rbx + disp] operands, which is cheaper
+ * than spilling sixteen guest registers around every helper call. The CHIP-8 pc
+ * is a constant at every point of a block, so it's only written back on exit.
+ */
+
+#define JIT_CODE_SIZE (4 * 1024 * 1024)
+#define JIT_MAX_BLOCK 64
+// Generous upper bound for one block plus its exit stubs
+#define JIT_MAX_BLOCK_BYTES (JIT_MAX_BLOCK * 96 + 512)
+
+typedef enum {
+    EXIT_LOOKUP,           // No translated block at vm->pc yet
+    EXIT_CHAIN,            // As EXIT_LOOKUP, and patch_site can be linked to the block at vm->pc
+    EXIT_BUDGET,           // Not enough cycles left to run the whole block at vm->pc
+    EXIT_INTERPRET,        // The instruction at vm->pc has to run on the interpreter this time
+    EXIT_STACK_OVERFLOW,
+    EXIT_STACK_UNDERFLOW,
+} jit_exit;
+
+typedef int (*jit_enter_fn)(chip8_vm* vm, chip8_jit* jit, void* code);
+
+struct chip8_jit {
+    uint8_t* code;
+    size_t used;
+    size_t code_start;
+    jit_enter_fn enter;
+    uint8_t* epilogue;
+    int64_t budget;
+    uint8_t* patch_site;
+    // Bumped by jit_flush so stale patch sites are never written to
+    uint32_t generation;
+    // Entry point of the block starting at each address, or NULL
+    void* entry[RAM_SIZE];
+    // Addresses whose first instruction has to go through the interpreter
+    bool untranslatable[RAM_SIZE];
+    // Bytes of ram that some translated block was built from
+    bool translated[RAM_SIZE];
+};
+
+#define VM_OFF(field) ((int32_t) offsetof(chip8_vm, field))
+#define V_OFF(x) (VM_OFF(reg) + (int32_t) (x))
+#define STACK_OFF (VM_OFF(stack) + (int32_t) offsetof(callstack, stack))
+#define STACK_PTR_OFF (VM_OFF(stack) + (int32_t) offsetof(callstack, ptr))
+#define JIT_OFF(field) ((int32_t) offsetof(chip8_jit, field))
+
+// Host register numbers used in ModRM bytes
+#define AL 0
+#define CL 1
+#define DL 2
+
+typedef struct {
+    uint8_t* p;
+} emitter;
+
+static void emit8(emitter* e, uint8_t b) {
+    *e->p++ = b;
+}
+
+static void emit16(emitter* e, uint16_t v) {
+    memcpy(e->p, &v, 2);
+    e->p += 2;
+}
+
+static void emit32(emitter* e, uint32_t v) {
+    memcpy(e->p, &v, 4);
+    e->p += 4;
+}
+
+static void emit64(emitter* e, uint64_t v) {
+    memcpy(e->p, &v, 8);
+    e->p += 8;
+}
+
+static void patch_rel32(uint8_t* site, const uint8_t* target) {
+    int32_t rel = (int32_t) (target - (site + 4));
+    memcpy(site, &rel, 4);
+}
+
+// ModRM + disp32 for a [rbx + disp] operand
+static void emit_rbx_mem(emitter* e, uint8_t reg, int32_t disp) {
+    emit8(e, 0x80 | (reg << 3) | 3);
+    emit32(e, disp);
+}
+
+static void emit_load8(emitter* e, uint8_t reg, int32_t disp) {
+    emit8(e, 0x8A);
+    emit_rbx_mem(e, reg, disp);
+}
+
+static void emit_store8(emitter* e, uint8_t reg, int32_t disp) {
+    emit8(e, 0x88);
+    emit_rbx_mem(e, reg, disp);
+}
+
+static void emit_movzx_eax(emitter* e, int32_t disp) {
+    emit8(e, 0x0F);
+    emit8(e, 0xB6);
+    emit_rbx_mem(e, AL, disp);
+}
+
+static void emit_store_pc(emitter* e, uint16_t pc) {
+    emit8(e, 0x66);
+    emit8(e, 0xC7);
+    emit_rbx_mem(e, 0, VM_OFF(pc));
+    emit16(e, pc);
+}
+
+// Emits a jmp (opcode 0xE9) or jcc (0x0F 0x8?) with an empty rel32 and returns the rel32 address
+static uint8_t* emit_branch(emitter* e, uint8_t cc) {
+    if (cc == 0) {
+        emit8(e, 0xE9);
+    } else {
+        emit8(e, 0x0F);
+        emit8(e, cc);
+    }
+    uint8_t* site = e->p;
+    emit32(e, 0);
+    return site;
+}
+
+static void emit_exit(emitter* e, const chip8_jit* jit, jit_exit code) {
+    emit8(e, 0xB8);
+    emit32(e, code);
+    emit8(e, 0xE9);
+    patch_rel32(e->p, jit->epilogue);
+    e->p += 4;
+}
+
+#define JCC_E  0x84
+#define JCC_NE 0x85
+#define JCC_L  0x8C
+#define JCC_A  0x87
+
+typedef enum {
+    STUB_CHAIN,
+    STUB_EXIT,
+    STUB_ERROR,
+    STUB_BAIL,
+} stub_kind;
+
+// A branch out of a block, resolved to a small exit stub once the block body is done
+typedef struct {
+    uint8_t* site;
+    stub_kind kind;
+    jit_exit code;
+    uint16_t pc;
+    // Index of the instruction in the block, for giving back the cycles it didn't use
+    uint32_t index;
+} stub;
+
+/*
+ * Jumps to the block for the pc in eax through the entry table, or leaves
+ * translated code if there isn't one.
+ */
+static void emit_indirect(emitter* e, const chip8_jit* jit) {
+    // cmp eax, RAM_SIZE ; jae exit
+    emit8(e, 0x3D);
+    emit32(e, RAM_SIZE);
+    emit8(e, 0x73);
+    uint8_t* out_of_range = e->p++;
+    // mov rcx, [r14 + rax*8 + entry] ; test rcx, rcx ; je exit ; jmp rcx
+    emit8(e, 0x49);
+    emit8(e, 0x8B);
+    emit8(e, 0x8C);
+    emit8(e, 0xC6);
+    emit32(e, JIT_OFF(entry));
+    emit8(e, 0x48);
+    emit8(e, 0x85);
+    emit8(e, 0xC9);
+    emit8(e, 0x74);
+    uint8_t* missing = e->p++;
+    emit8(e, 0xFF);
+    emit8(e, 0xE1);
+    *out_of_range = (uint8_t) (e->p - (out_of_range + 1));
+    *missing = (uint8_t) (e->p - (missing + 1));
+    // mov [rbx + pc], ax
+    emit8(e, 0x66);
+    emit8(e, 0x89);
+    emit_rbx_mem(e, AL, VM_OFF(pc));
+    emit_exit(e, jit, EXIT_LOOKUP);
+}
+
+static uint16_t read_opcode(const chip8_vm* vm, uint16_t addr) {
+    return (((uint16_t) vm->ram[addr]) << 8) + (uint16_t) vm->ram[addr+1];
+}
+
+/*
+ * Translates the basic block starting at start. Returns NULL if the first
+ * instruction can't be translated.
+ */
+static void* jit_compile(chip8_jit* jit, const chip8_vm* vm, uint16_t start) {
+    if (jit->used + JIT_MAX_BLOCK_BYTES > JIT_CODE_SIZE) jit_flush(jit);
+    emitter e = {jit->code + jit->used};
+    uint8_t* block = e.p;
+    stub stubs[JIT_MAX_BLOCK + 4];
+    int nstubs = 0;
+    uint32_t count = 0;
+#define ADD_STUB(site_, kind_, code_, pc_) \
+    do { stubs[nstubs].site = (site_); stubs[nstubs].kind = (kind_); stubs[nstubs].code = (code_); \
+         stubs[nstubs].pc = (pc_); stubs[nstubs].index = count; nstubs++; } while (0)
+
+    // cmp r12, count ; jl not_enough_cycles ; sub r12, count
+    emit8(&e, 0x49);
+    emit8(&e, 0x81);
+    emit8(&e, 0xFC);
+    uint8_t* count_cmp = e.p;
+    emit32(&e, 0);
+    ADD_STUB(emit_branch(&e, JCC_L), STUB_EXIT, EXIT_BUDGET, start);
+    emit8(&e, 0x49);
+    emit8(&e, 0x81);
+    emit8(&e, 0xEC);
+    uint8_t* count_sub = e.p;
+    emit32(&e, 0);
+
+    uint16_t pc = start;
+    bool ended = false;
+    while (!ended) {
+        if (count == JIT_MAX_BLOCK || pc > RAM_SIZE - 2) {
+            ADD_STUB(emit_branch(&e, 0), STUB_CHAIN, EXIT_CHAIN, pc);
+            break;
+        }
+        instruction inst = decode_instruction(read_opcode(vm, pc), vm->mode);
+        uint16_t next = pc + 2;
+        switch (inst.tag) {
+            case LOAD:
+                emit8(&e, 0xC6);
+                emit_rbx_mem(&e, 0, V_OFF(inst.reg1));
+                emit8(&e, (uint8_t) inst.data);
+                break;
+            case MOV:
+                emit_load8(&e, AL, V_OFF(inst.reg2));
+                emit_store8(&e, AL, V_OFF(inst.reg1));
+                break;
+            case ADD_NUM:
+                emit8(&e, 0x80);
+                emit_rbx_mem(&e, 0, V_OFF(inst.reg1));
+                emit8(&e, (uint8_t) inst.data);
+                break;
+            case ADD_REG:
+                // al = Vx + Vy, cl = carry; VF is written before Vx like the interpreter does
+                emit_load8(&e, AL, V_OFF(inst.reg1));
+                emit8(&e, 0x02);
+                emit_rbx_mem(&e, AL, V_OFF(inst.reg2));
+                emit8(&e, 0x0F);
+                emit8(&e, 0x92);
+                emit8(&e, 0xC1);
+                emit_store8(&e, CL, V_OFF(0xF));
+                emit_store8(&e, AL, V_OFF(inst.reg1));
+                break;
+            case SUB_REG:
+            case SUB_FROM: {
+                // al - cl with VF = (al > cl)
+                uint8_t a = inst.tag == SUB_REG ? inst.reg1 : inst.reg2;
+                uint8_t b = inst.tag == SUB_REG ? inst.reg2 : inst.reg1;
+                emit_load8(&e, AL, V_OFF(a));
+                emit_load8(&e, CL, V_OFF(b));
+                emit8(&e, 0x38);
+                emit8(&e, 0xC8);
+                emit8(&e, 0x0F);
+                emit8(&e, 0x97);
+                emit8(&e, 0xC2);
+                emit8(&e, 0x28);
+                emit8(&e, 0xC8);
+                emit_store8(&e, DL, V_OFF(0xF));
+                emit_store8(&e, AL, V_OFF(inst.reg1));
+                break;
+            }
+            case AND:
+            case OR:
+            case XOR:
+                emit_load8(&e, AL, V_OFF(inst.reg2));
+                emit8(&e, inst.tag == AND ? 0x20 : inst.tag == OR ? 0x08 : 0x30);
+                emit_rbx_mem(&e, AL, V_OFF(inst.reg1));
+                break;
+            case RSHIFT:
+                // cl = Vy & 1 ; al = Vy >> 1
+                emit_load8(&e, AL, V_OFF(inst.reg2));
+                emit8(&e, 0x88);
+                emit8(&e, 0xC1);
+                emit8(&e, 0x80);
+                emit8(&e, 0xE1);
+                emit8(&e, 0x01);
+                emit8(&e, 0xD0);
+                emit8(&e, 0xE8);
+                emit_store8(&e, AL, V_OFF(inst.reg1));
+                emit_store8(&e, CL, V_OFF(0xF));
+                break;
+            case LSHIFT:
+                // cl = Vy >> 7 ; al = Vy << 1
+                emit_load8(&e, AL, V_OFF(inst.reg2));
+                emit8(&e, 0x88);
+                emit8(&e, 0xC1);
+                emit8(&e, 0xC0);
+                emit8(&e, 0xE9);
+                emit8(&e, 0x07);
+                emit8(&e, 0x00);
+                emit8(&e, 0xC0);
+                emit_store8(&e, AL, V_OFF(inst.reg1));
+                emit_store8(&e, CL, V_OFF(0xF));
+                break;
+            case RAND:
+                // mov rdi, rbx ; mov rax, rand_byte ; call rax ; and al, data
+                emit8(&e, 0x48);
+                emit8(&e, 0x89);
+                emit8(&e, 0xDF);
+                emit8(&e, 0x48);
+                emit8(&e, 0xB8);
+                emit64(&e, (uint64_t) (uintptr_t) &rand_byte);
+                emit8(&e, 0xFF);
+                emit8(&e, 0xD0);
+                emit8(&e, 0x24);
+                emit8(&e, (uint8_t) inst.data);
+                emit_store8(&e, AL, V_OFF(inst.reg1));
+                break;
+            case LOAD_I:
+                // mov r13d, data
+                emit8(&e, 0x41);
+                emit8(&e, 0xBD);
+                emit32(&e, inst.data);
+                break;
+            case ADD_I:
+                // movzx eax, Vx ; add r13w, ax
+                emit_movzx_eax(&e, V_OFF(inst.reg1));
+                emit8(&e, 0x66);
+                emit8(&e, 0x41);
+                emit8(&e, 0x01);
+                emit8(&e, 0xC5);
+                break;
+            case LOAD_DIGIT_SPRITE:
+                // movzx eax, Vx ; lea r13d, [rax + rax*4] ; add r13d, DIGIT_BASE_ADDR
+                emit_movzx_eax(&e, V_OFF(inst.reg1));
+                emit8(&e, 0x44);
+                emit8(&e, 0x8D);
+                emit8(&e, 0x2C);
+                emit8(&e, 0x80);
+                if (DIGIT_BASE_ADDR != 0) {
+                    emit8(&e, 0x41);
+                    emit8(&e, 0x81);
+                    emit8(&e, 0xC5);
+                    emit32(&e, DIGIT_BASE_ADDR);
+                }
+                break;
+            case SET_DELAY:
+                emit_load8(&e, AL, V_OFF(inst.reg1));
+                emit_store8(&e, AL, VM_OFF(delay));
+                break;
+            case STORE_DELAY:
+                emit_load8(&e, AL, VM_OFF(delay));
+                emit_store8(&e, AL, V_OFF(inst.reg1));
+                break;
+            case RESTORE_REG:
+                // Reads past the end of ram are left to the interpreter: cmp r13d, RAM_SIZE - 1 - x ; ja bail
+                emit8(&e, 0x41);
+                emit8(&e, 0x81);
+                emit8(&e, 0xFD);
+                emit32(&e, RAM_SIZE - 1 - inst.reg1);
+                ADD_STUB(emit_branch(&e, JCC_A), STUB_BAIL, EXIT_INTERPRET, pc);
+                for (int j = 0; j <= inst.reg1; j++) {
+                    // mov al, [rbx + r13 + ram + j]
+                    emit8(&e, 0x42);
+                    emit8(&e, 0x8A);
+                    emit8(&e, 0x84);
+                    emit8(&e, 0x2B);
+                    emit32(&e, VM_OFF(ram) + j);
+                    emit_store8(&e, AL, V_OFF(j));
+                }
+                // add r13w, x + 1, except on SUPER-CHIP which leaves I alone
+                if (vm->mode != MODE_SCHIP) {
+                    emit8(&e, 0x66);
+                    emit8(&e, 0x41);
+                    emit8(&e, 0x83);
+                    emit8(&e, 0xC5);
+                    emit8(&e, inst.reg1 + 1);
+                }
+                break;
+            case JMP:
+                ADD_STUB(emit_branch(&e, 0), STUB_CHAIN, EXIT_CHAIN, inst.data);
+                ended = true;
+                break;
+            case JMP_REL:
+                // eax = V0 + data, or VX on SUPER-CHIP
+                emit_movzx_eax(&e, V_OFF(inst.reg1));
+                emit8(&e, 0x05);
+                emit32(&e, inst.data);
+                emit_indirect(&e, jit);
+                ended = true;
+                break;
+            case CALL:
+                // movzx eax, stack.ptr ; cmp al, 255 ; je overflow
+                emit_movzx_eax(&e, STACK_PTR_OFF);
+                emit8(&e, 0x3C);
+                emit8(&e, 0xFF);
+                ADD_STUB(emit_branch(&e, JCC_E), STUB_ERROR, EXIT_STACK_OVERFLOW, next);
+                // mov word [rbx + rax*2 + stack], next ; inc byte stack.ptr
+                emit8(&e, 0x66);
+                emit8(&e, 0xC7);
+                emit8(&e, 0x84);
+                emit8(&e, 0x43);
+                emit32(&e, STACK_OFF);
+                emit16(&e, next);
+                emit8(&e, 0xFE);
+                emit_rbx_mem(&e, 0, STACK_PTR_OFF);
+                ADD_STUB(emit_branch(&e, 0), STUB_CHAIN, EXIT_CHAIN, inst.data);
+                ended = true;
+                break;
+            case RET:
+                // movzx eax, stack.ptr ; test al, al ; je underflow
+                emit_movzx_eax(&e, STACK_PTR_OFF);
+                emit8(&e, 0x84);
+                emit8(&e, 0xC0);
+                ADD_STUB(emit_branch(&e, JCC_E), STUB_ERROR, EXIT_STACK_UNDERFLOW, next);
+                // dec al ; mov stack.ptr, al ; movzx eax, word [rbx + rax*2 + stack]
+                emit8(&e, 0xFE);
+                emit8(&e, 0xC8);
+                emit_store8(&e, AL, STACK_PTR_OFF);
+                emit8(&e, 0x0F);
+                emit8(&e, 0xB7);
+                emit8(&e, 0x84);
+                emit8(&e, 0x43);
+                emit32(&e, STACK_OFF);
+                emit_indirect(&e, jit);
+                ended = true;
+                break;
+            case SKP_EQ:
+            case SKP_NEQ:
+            case SKP_EQ_REG:
+            case SKP_NEQ_REG: {
+                // XO-CHIP skips all 4 bytes of an F000 NNNN, and the block depends on which it is
+                uint16_t skip_to = next + 2;
+                if (vm->mode == MODE_XOCHIP) {
+                    if (read_opcode(vm, next) == 0xF000) skip_to += 2;
+                    jit->translated[next & (RAM_SIZE - 1)] = true;
+                    jit->translated[(next + 1) & (RAM_SIZE - 1)] = true;
+                }
+                if (inst.tag == SKP_EQ || inst.tag == SKP_NEQ) {
+                    // cmp byte Vx, data
+                    emit8(&e, 0x80);
+                    emit_rbx_mem(&e, 7, V_OFF(inst.reg1));
+                    emit8(&e, (uint8_t) inst.data);
+                } else {
+                    // mov al, Vx ; cmp al, Vy
+                    emit_load8(&e, AL, V_OFF(inst.reg1));
+                    emit8(&e, 0x3A);
+                    emit_rbx_mem(&e, AL, V_OFF(inst.reg2));
+                }
+                uint8_t cc = (inst.tag == SKP_EQ || inst.tag == SKP_EQ_REG) ? JCC_E : JCC_NE;
+                ADD_STUB(emit_branch(&e, cc), STUB_CHAIN, EXIT_CHAIN, skip_to);
+                ADD_STUB(emit_branch(&e, 0), STUB_CHAIN, EXIT_CHAIN, next);
+                ended = true;
+                break;
+            }
+            default:
+                // Screen, keyboard and memory writes go through the interpreter, and so does
+                // SET_SOUND, so the audio backend hears about it with an exact cycle count
+                if (count == 0) return NULL;
+                emit_store_pc(&e, pc);
+                emit_exit(&e, jit, EXIT_LOOKUP);
+                ended = true;
+                continue;
+        }
+        jit->translated[pc] = true;
+        jit->translated[pc + 1] = true;
+        count++;
+        pc = next;
+    }
+#undef ADD_STUB
+    memcpy(count_cmp, &count, 4);
+    memcpy(count_sub, &count, 4);
+
+    for (int s = 0; s < nstubs; s++) {
+        patch_rel32(stubs[s].site, e.p);
+        if (stubs[s].kind == STUB_ERROR) {
+            // The failing instruction isn't counted as executed: add r12, 1
+            emit8(&e, 0x49);
+            emit8(&e, 0x83);
+            emit8(&e, 0xC4);
+            emit8(&e, 0x01);
+        } else if (stubs[s].kind == STUB_BAIL) {
+            // Give back the cycles of this and the following instructions: add r12, count - index
+            emit8(&e, 0x49);
+            emit8(&e, 0x81);
+            emit8(&e, 0xC4);
+            emit32(&e, count - stubs[s].index);
+        }
+        emit_store_pc(&e, stubs[s].pc);
+        if (stubs[s].kind == STUB_CHAIN) {
+            // mov rax, site ; mov [r14 + patch_site], rax
+            emit8(&e, 0x48);
+            emit8(&e, 0xB8);
+            emit64(&e, (uint64_t) (uintptr_t) stubs[s].site);
+            emit8(&e, 0x49);
+            emit8(&e, 0x89);
+            emit8(&e, 0x86);
+            emit32(&e, JIT_OFF(patch_site));
+        }
+        emit_exit(&e, jit, stubs[s].code);
+    }
+    jit->used = e.p - jit->code;
+    return block;
+}
+
+/*
+ * Emits the entry trampoline and the shared epilogue at the start of the code buffer.
+ */
+static void jit_emit_runtime(chip8_jit* jit) {
+    emitter e = {jit->code};
+    jit->enter = (jit_enter_fn) (void*) e.p;
+    // push rbx, r12, r13, r14, r15 (also realigns the stack for helper calls)
+    emit8(&e, 0x53);
+    emit8(&e, 0x41);
+    emit8(&e, 0x54);
+    emit8(&e, 0x41);
+    emit8(&e, 0x55);
+    emit8(&e, 0x41);
+    emit8(&e, 0x56);
+    emit8(&e, 0x41);
+    emit8(&e, 0x57);
+    // mov rbx, rdi ; mov r14, rsi
+    emit8(&e, 0x48);
+    emit8(&e, 0x89);
+    emit8(&e, 0xFB);
+    emit8(&e, 0x49);
+    emit8(&e, 0x89);
+    emit8(&e, 0xF6);
+    // mov r12, [r14 + budget]
+    emit8(&e, 0x4D);
+    emit8(&e, 0x8B);
+    emit8(&e, 0xA6);
+    emit32(&e, JIT_OFF(budget));
+    // movzx r13d, word [rbx + i]
+    emit8(&e, 0x44);
+    emit8(&e, 0x0F);
+    emit8(&e, 0xB7);
+    emit_rbx_mem(&e, 5, VM_OFF(i));
+    // jmp rdx
+    emit8(&e, 0xFF);
+    emit8(&e, 0xE2);
+
+    jit->epilogue = e.p;
+    // mov [rbx + i], r13w ; mov [r14 + budget], r12
+    emit8(&e, 0x66);
+    emit8(&e, 0x44);
+    emit8(&e, 0x89);
+    emit_rbx_mem(&e, 5, VM_OFF(i));
+    emit8(&e, 0x4D);
+    emit8(&e, 0x89);
+    emit8(&e, 0xA6);
+    emit32(&e, JIT_OFF(budget));
+    // pop r15, r14, r13, r12, rbx ; ret
+    emit8(&e, 0x41);
+    emit8(&e, 0x5F);
+    emit8(&e, 0x41);
+    emit8(&e, 0x5E);
+    emit8(&e, 0x41);
+    emit8(&e, 0x5D);
+    emit8(&e, 0x41);
+    emit8(&e, 0x5C);
+    emit8(&e, 0x5B);
+    emit8(&e, 0xC3);
+    jit->code_start = e.p - jit->code;
+    jit->used = jit->code_start;
+}
+
+static tick_result jit_engine_execute(void* ctx, chip8_vm* vm, uint32_t n) {
+    return jit_execute((chip8_jit*) ctx, vm, n);
+}
+
+static void jit_engine_flush(void* ctx) {
+    jit_flush((chip8_jit*) ctx);
+}
+
+chip8_jit* jit_new() {
+    chip8_jit* jit = malloc(sizeof(chip8_jit));
+    if (jit == NULL) return NULL;
+    jit->generation = 0;
+    jit->code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (jit->code == MAP_FAILED) {
+        free(jit);
+        return NULL;
+    }
+    jit_emit_runtime(jit);
+    jit_flush(jit);
+    return jit;
+}
+
+void jit_free(chip8_jit* jit) {
+    if (jit == NULL) return;
+    munmap(jit->code, JIT_CODE_SIZE);
+    free(jit);
+}
+
+void jit_attach(chip8_jit* jit, chip8_vm* vm) {
+    jit_flush(jit);
+    vm->engine.ctx = jit;
+    vm->engine.execute = jit_engine_execute;
+    vm->engine.flush = jit_engine_flush;
+}
+
+void jit_flush(chip8_jit* jit) {
+    jit->generation++;
+    jit->used = jit->code_start;
+    memset(jit->entry, 0, sizeof(jit->entry));
+    memset(jit->untranslatable, 0, sizeof(jit->untranslatable));
+    memset(jit->translated, 0, sizeof(jit->translated));
+}
+
+static void* jit_block(chip8_jit* jit, chip8_vm* vm, uint16_t pc) {
+    if (pc > RAM_SIZE - 2 || jit->untranslatable[pc]) return NULL;
+    if (jit->entry[pc] == NULL) {
+        // Idle loops stay on the slow path so jit_execute gets to fast-forward them
+        if (vm_idle_loop_at(vm, pc)) {
+            jit->untranslatable[pc] = true;
+            return NULL;
+        }
+        jit->entry[pc] = jit_compile(jit, vm, pc);
+        if (jit->entry[pc] == NULL) jit->untranslatable[pc] = true;
+    }
+    return jit->entry[pc];
+}
+
+/*
+ * Runs the instruction at vm->pc on the interpreter. If it writes over ram that
+ * was translated, all translated code is dropped.
+ */
+static tick_result jit_interpret(chip8_jit* jit, chip8_vm* vm) {
+    uint16_t write_addr = vm->i;
+    int write_len = 0;
+    if (vm->pc <= RAM_SIZE - 2) {
+        write_len = instruction_write_len(decode_instruction(read_opcode(vm, vm->pc), vm->mode));
+    }
+    tick_result res = vm_tick(vm);
+    for (int j = 0; j < write_len; j++) {
+        // Only the first RAM_SIZE bytes are ever translated
+        uint16_t addr = (write_addr + j) & vm->addr_mask;
+        if (addr < RAM_SIZE && jit->translated[addr]) {
+            jit_flush(jit);
+            break;
+        }
+    }
+    return res;
+}
+
+tick_result jit_execute(chip8_jit* jit, chip8_vm* vm, uint32_t n) {
+    int64_t budget = n;
+    while (budget > 0) {
+        void* code = jit_block(jit, vm, vm->pc);
+        if (code == NULL) {
+            uint32_t skipped = vm_skip_idle(vm, (uint32_t) budget);
+            if (skipped > 0) {
+                vm->cycles += skipped;
+                budget -= skipped;
+                continue;
+            }
+            tick_result res = jit_interpret(jit, vm);
+            if (res != SUCCESS) return res;
+            budget--;
+            continue;
+        }
+        jit->budget = budget;
+        jit_exit reason = jit->enter(vm, jit, code);
+        vm->cycles += budget - jit->budget;
+        budget = jit->budget;
+        switch (reason) {
+            case EXIT_LOOKUP:
+                break;
+            case EXIT_CHAIN: {
+                // Link the branch straight to its target so the next run stays in translated code
+                uint32_t generation = jit->generation;
+                void* target = jit_block(jit, vm, vm->pc);
+                if (target != NULL && generation == jit->generation) patch_rel32(jit->patch_site, target);
+                break;
+            }
+            case EXIT_INTERPRET: {
+                tick_result res = jit_interpret(jit, vm);
+                if (res != SUCCESS) return res;
+                budget--;
+                break;
+            }
+            case EXIT_BUDGET:
+                // Fewer cycles left than the block is long, so finish them one at a time
+                while (budget > 0) {
+                    tick_result res = jit_interpret(jit, vm);
+                    if (res != SUCCESS) return res;
+                    budget--;
+                }
+                break;
+            case EXIT_STACK_OVERFLOW:
+                return ERR_STACK_OVERFLOW;
+            case EXIT_STACK_UNDERFLOW:
+                return ERR_STACK_UNDERFLOW;
+        }
+    }
+    return SUCCESS;
+}
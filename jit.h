@@ -0,0 +1,20 @@
+#ifndef CHIP8_JIT_H
+#define CHIP8_JIT_H
+
+#include "vm.h"
+
+/*
+ * Basic block recompiler from CHIP-8 to x86-64 (System V, POSIX mmap).
+ * Only built when CHIP8_HAVE_JIT is defined by CMake.
+ */
+typedef struct chip8_jit chip8_jit;
+
+chip8_jit* jit_new();
+void jit_free(chip8_jit* jit);
+// Makes jit the execution engine of vm and drops anything compiled for another program
+void jit_attach(chip8_jit* jit, chip8_vm* vm);
+// Throws away all translated code
+void jit_flush(chip8_jit* jit);
+tick_result jit_execute(chip8_jit* jit, chip8_vm* vm, uint32_t n);
+
+#endif
@@ -0,0 +1,67 @@
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include "keymap.h"
+#include "vm.h"
+
+static const SDL_Scancode DEFAULT_KEYS[16] = {
+        SDL_SCANCODE_1, SDL_SCANCODE_2, SDL_SCANCODE_3, SDL_SCANCODE_4,
+        SDL_SCANCODE_Q, SDL_SCANCODE_W, SDL_SCANCODE_E, SDL_SCANCODE_R,
+        SDL_SCANCODE_A, SDL_SCANCODE_S, SDL_SCANCODE_D, SDL_SCANCODE_F,
+        SDL_SCANCODE_Z, SDL_SCANCODE_X, SDL_SCANCODE_C, SDL_SCANCODE_V
+};
+
+static void key_map_clear(key_map* map) {
+    memset(map->key_of, NO_KEY, sizeof(map->key_of));
+    map->len = 0;
+}
+
+void key_map_default(key_map* map) {
+    key_map_clear(map);
+    for (int k = 0; k < 16; k++) {
+        key_map_bind(map, DEFAULT_KEYS[k], (uint8_t) k);
+    }
+}
+
+bool key_map_bind(key_map* map, SDL_Scancode scancode, uint8_t key) {
+    if (scancode <= 0 || scancode >= SDL_NUM_SCANCODES) return false;
+    if (map->key_of[scancode] == NO_KEY) {
+        if (map->len == KEY_MAP_MAX_BINDINGS) return false;
+        map->bound[map->len++] = scancode;
+    }
+    map->key_of[scancode] = (int8_t) (key & 0xF);
+    return true;
+}
+
+bool key_map_load(key_map* map, const char* path) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) return false;
+    static key_map loaded;
+    key_map_clear(&loaded);
+    char line[256];
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), file) != NULL) {
+        char* p = line;
+        while (isspace((unsigned char) *p)) p++;
+        if (*p == '\0' || *p == '#') continue;
+        // The name is the rest of the line, since scancode names can have spaces in them
+        char* end = p + strlen(p);
+        while (end > p && isspace((unsigned char) end[-1])) *--end = '\0';
+        unsigned int key;
+        int name_start = 0;
+        ok = sscanf(p, "%1x %n", &key, &name_start) == 1 && name_start > 1;
+        if (ok) ok = key_map_bind(&loaded, SDL_GetScancodeFromName(p + name_start), (uint8_t) key);
+    }
+    fclose(file);
+    if (ok) *map = loaded;
+    return ok;
+}
+
+uint16_t key_map_sample(const key_map* map) {
+    const uint8_t* state = SDL_GetKeyboardState(NULL);
+    uint16_t keys = 0;
+    for (int k = 0; k < map->len; k++) {
+        if (state[map->bound[k]]) keys |= 1 << map->key_of[map->bound[k]];
+    }
+    return keys;
+}
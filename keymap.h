@@ -0,0 +1,34 @@
+#ifndef CHIP8_KEYMAP_H
+#define CHIP8_KEYMAP_H
+
+#include <SDL.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define KEY_MAP_MAX_BINDINGS 64
+
+/*
+ * Which host keys press which CHIP-8 keys. Any number of scancodes may press the same
+ * CHIP-8 key. The default binds keys 0-F to the 1234/QWER/ASDF/ZXCV block, row by row.
+ */
+typedef struct {
+    // CHIP-8 key for every scancode, or NO_KEY
+    int8_t key_of[SDL_NUM_SCANCODES];
+    // The scancodes that are bound, so sampling doesn't scan the whole keyboard
+    SDL_Scancode bound[KEY_MAP_MAX_BINDINGS];
+    int len;
+} key_map;
+
+void key_map_default(key_map* map);
+// Returns false if there's no room left for another binding
+bool key_map_bind(key_map* map, SDL_Scancode scancode, uint8_t key);
+/*
+ * Replaces the bindings with the ones in a text file, one "KEY NAME" per line where KEY
+ * is a hex digit and NAME an SDL scancode name such as "W", "Up" or "Keypad 5".
+ * '#' starts a comment. Returns false and leaves the map as it was on any bad line.
+ */
+bool key_map_load(key_map* map, const char* path);
+// The bitmask of CHIP-8 keys held right now, from SDL's keyboard state
+uint16_t key_map_sample(const key_map* map);
+
+#endif
@@ -0,0 +1,731 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "lanes.h"
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/*
+ * Lanes of a chunk are the elements of GCC/Clang vector types, so the same code becomes AVX2 or
+ * SSE2 depending on what the compiler is allowed to use. Comparing two vectors gives a mask
+ * vector with -1 in the lanes where it holds and 0 elsewhere.
+ */
+#define LANE_WIDTH 32
+typedef uint8_t lane_u8 __attribute__((vector_size(LANE_WIDTH)));
+typedef int8_t lane_mask __attribute__((vector_size(LANE_WIDTH)));
+typedef uint16_t lane_u16 __attribute__((vector_size(LANE_WIDTH * 2)));
+typedef int16_t lane_mask16 __attribute__((vector_size(LANE_WIDTH * 2)));
+typedef uint32_t lane_u32 __attribute__((vector_size(LANE_WIDTH * 4)));
+typedef int32_t lane_mask32 __attribute__((vector_size(LANE_WIDTH * 4)));
+
+#define CHUNK_ALIGN 128
+
+typedef struct {
+    // Lane k's state is element k of the vectors, or entry k of the arrays
+    lane_u8 reg[16];
+    lane_u8 delay;
+    lane_u8 sound;
+    lane_u16 i;
+    lane_u16 pc;
+    lane_u16 keys;
+    lane_u32 rng;
+    // Instructions each lane has left in the current frame
+    uint32_t remaining[LANE_WIDTH];
+    // Lanes that exist and haven't stopped on an error, bit k for lane k
+    uint32_t live;
+    uint8_t result[LANE_WIDTH];
+    // Where the cycle count and the timer progress of a stopped lane stayed
+    uint64_t stop_cycles[LANE_WIDTH];
+    uint32_t stop_timer_acc[LANE_WIDTH];
+    // Instructions spent spinning in idle loops, like vm->idle_cycles
+    uint64_t idle[LANE_WIDTH];
+    bool waiting[LANE_WIDTH];
+    int8_t key_released[LANE_WIDTH];
+    uint8_t sp[LANE_WIDTH];
+    uint16_t stack[LANE_WIDTH][256];
+    // The 64x32 screen, a word per row. It's never presented, so every row stays dirty.
+    uint64_t fb[LANE_WIDTH][SCREEN_HEIGHT];
+    // Set for the addresses a lane has written to, and the ones before them, so instructions
+    // starting there may differ between lanes and can't come from the shared decode
+    uint8_t written[RAM_SIZE];
+    uint8_t ram[LANE_WIDTH][RAM_SIZE];
+} lane_chunk;
+
+struct chip8_lanes {
+    uint32_t count;
+    uint32_t chunk_count;
+    lane_chunk* chunks;
+    void* allocation;
+    uint32_t ips;
+    // Shared by every lane that's still running, which all run the same number of instructions
+    uint32_t timer_acc;
+    uint64_t cycles;
+    // Instructions in the current frame
+    uint32_t budget;
+    // The program as loaded, decoded at every address
+    instruction icache[RAM_SIZE];
+};
+
+// Bit k set for each lane k where m is -1
+static inline uint32_t lane_bits(const lane_mask* m) {
+#if defined(__AVX2__)
+    return (uint32_t) _mm256_movemask_epi8((__m256i) *m);
+#elif defined(__SSE2__)
+    __m128i half[2];
+    memcpy(half, m, sizeof(*m));
+    return (uint32_t) _mm_movemask_epi8(half[0]) | (uint32_t) _mm_movemask_epi8(half[1]) << 16;
+#else
+    uint32_t bits = 0;
+    for (int k = 0; k < LANE_WIDTH; k++) {
+        bits |= (uint32_t) ((*m)[k] & 1) << k;
+    }
+    return bits;
+#endif
+}
+
+static inline void lane_mask_of(lane_mask* m, uint32_t bits) {
+    for (int k = 0; k < LANE_WIDTH; k++) {
+        (*m)[k] = (bits >> k) & 1 ? -1 : 0;
+    }
+}
+
+static inline uint16_t lane_opcode(const lane_chunk* c, int k, uint16_t addr) {
+    return (uint16_t) (c->ram[k][addr & (RAM_SIZE - 1)] << 8) | c->ram[k][(addr + 1) & (RAM_SIZE - 1)];
+}
+
+static inline instruction lane_decode(const chip8_lanes* l, const lane_chunk* c, int k, uint16_t addr) {
+    if (c->written[addr & (RAM_SIZE - 1)]) return decode_instruction(lane_opcode(c, k, addr), MODE_CHIP8);
+    return l->icache[addr & (RAM_SIZE - 1)];
+}
+
+static void lane_write(lane_chunk* c, int k, uint16_t addr, uint8_t value) {
+    addr &= RAM_SIZE - 1;
+    c->ram[k][addr] = value;
+    c->written[addr] = 1;
+    c->written[(addr - 1) & (RAM_SIZE - 1)] = 1;
+}
+
+// vm_draw's clipping, on one word per row; sprites past the end of memory continue from 0
+static uint8_t lane_draw(lane_chunk* c, int k, uint8_t x, uint8_t y, uint8_t n) {
+    int shift = x % SCREEN_WIDTH;
+    int top = y % SCREEN_HEIGHT;
+    int rows = top + n > SCREEN_HEIGHT ? SCREEN_HEIGHT - top : n;
+    uint64_t cleared = 0;
+    for (int j = 0; j < rows; j++) {
+        uint64_t part = ((uint64_t) c->ram[k][(c->i[k] + j) & (RAM_SIZE - 1)] << 56) >> shift;
+        cleared |= c->fb[k][top + j] & part;
+        c->fb[k][top + j] ^= part;
+    }
+    return cleared != 0;
+}
+
+static void lane_stop(chip8_lanes* l, lane_chunk* c, int k, tick_result res) {
+    uint32_t executed = l->budget - c->remaining[k];
+    c->result[k] = (uint8_t) res;
+    c->stop_cycles[k] = l->cycles + executed;
+    // Short of a tick, or the frame would have ended
+    c->stop_timer_acc[k] = l->timer_acc + executed * TIMER_HZ;
+    c->remaining[k] = 0;
+    c->live &= ~(1u << k);
+}
+
+/*
+ * Uses up the rest of lane k's frame in an idle loop it's at. vm_skip_idle counts the whole
+ * frame as idle if it started there, or else all but the instruction that got there.
+ */
+static void lane_idle(const chip8_lanes* l, lane_chunk* c, int k) {
+    uint32_t left = c->remaining[k];
+    c->idle[k] += left == l->budget ? left : left - 1;
+    c->remaining[k] = 0;
+}
+
+/*
+ * Runs one instruction in lane k by itself, the way vm_execute does. A jump to itself or a
+ * wait for a key that hasn't come uses up the rest of the frame, like vm_skip_idle.
+ */
+static void lane_step(chip8_lanes* l, lane_chunk* c, int k) {
+    uint16_t pc = c->pc[k];
+    instruction inst = lane_decode(l, c, k, pc);
+    uint8_t* v = (uint8_t*) c->reg + k;
+#define V(r) v[(r) * LANE_WIDTH]
+    uint8_t x = inst.reg1, y = inst.reg2;
+    pc += 2;
+    c->pc[k] = pc;
+    switch (inst.tag) {
+        case CLEAR:
+            memset(c->fb[k], 0, sizeof(c->fb[k]));
+            break;
+        case RET:
+            if (c->sp[k] == 0) {
+                lane_stop(l, c, k, ERR_STACK_UNDERFLOW);
+                return;
+            }
+            c->pc[k] = c->stack[k][--c->sp[k]];
+            break;
+        case JMP:
+            c->pc[k] = inst.data;
+            if (inst.data == pc - 2) {
+                lane_idle(l, c, k);
+                return;
+            }
+            break;
+        case CALL:
+            if (c->sp[k] == 255) {
+                lane_stop(l, c, k, ERR_STACK_OVERFLOW);
+                return;
+            }
+            c->stack[k][c->sp[k]++] = pc;
+            c->pc[k] = inst.data;
+            break;
+        case SKP_EQ:
+            if (V(x) == inst.data) c->pc[k] += 2;
+            break;
+        case SKP_NEQ:
+            if (V(x) != inst.data) c->pc[k] += 2;
+            break;
+        case SKP_EQ_REG:
+            if (V(x) == V(y)) c->pc[k] += 2;
+            break;
+        case SKP_NEQ_REG:
+            if (V(x) != V(y)) c->pc[k] += 2;
+            break;
+        case LOAD:
+            V(x) = (uint8_t) inst.data;
+            break;
+        case ADD_NUM:
+            V(x) += (uint8_t) inst.data;
+            break;
+        case MOV:
+            V(x) = V(y);
+            break;
+        case OR:
+            V(x) |= V(y);
+            break;
+        case AND:
+            V(x) &= V(y);
+            break;
+        case XOR:
+            V(x) ^= V(y);
+            break;
+        case ADD_REG: {
+            uint16_t sum = V(x) + V(y);
+            V(0xF) = sum > 255;
+            V(x) = (uint8_t) sum;
+            break;
+        }
+        case SUB_REG: {
+            uint8_t a = V(x), b = V(y);
+            V(0xF) = a > b;
+            V(x) = a - b;
+            break;
+        }
+        case SUB_FROM: {
+            uint8_t a = V(x), b = V(y);
+            V(0xF) = b > a;
+            V(x) = b - a;
+            break;
+        }
+        case RSHIFT: {
+            uint8_t b = V(y);
+            V(x) = b >> 1;
+            V(0xF) = b & 1;
+            break;
+        }
+        case LSHIFT: {
+            uint8_t b = V(y);
+            V(x) = b << 1;
+            V(0xF) = b >> 7;
+            break;
+        }
+        case LOAD_I:
+            c->i[k] = inst.data;
+            break;
+        case JMP_REL:
+            c->pc[k] = inst.data + V(x);
+            break;
+        case RAND: {
+            uint32_t r = c->rng[k];
+            r ^= r << 13;
+            r ^= r >> 17;
+            r ^= r << 5;
+            c->rng[k] = r;
+            V(x) = (uint8_t) (r >> 24) & inst.data;
+            break;
+        }
+        case DRAW:
+            V(0xF) = lane_draw(c, k, V(x), V(y), (uint8_t) inst.data);
+            break;
+        case SKP_IF_KEY:
+            if ((c->keys[k] >> (V(x) & 0xF)) & 1) c->pc[k] += 2;
+            break;
+        case SKP_IF_NOT_KEY:
+            if (!((c->keys[k] >> (V(x) & 0xF)) & 1)) c->pc[k] += 2;
+            break;
+        case STORE_DELAY:
+            V(x) = c->delay[k];
+            break;
+        case WAIT_FOR_KEY:
+            c->waiting[k] = true;
+            if (c->key_released[k] == NO_KEY) {
+                c->pc[k] = pc - 2;
+                lane_idle(l, c, k);
+                return;
+            }
+            V(x) = (uint8_t) c->key_released[k];
+            c->key_released[k] = NO_KEY;
+            c->waiting[k] = false;
+            break;
+        case SET_DELAY:
+            c->delay[k] = V(x);
+            break;
+        case SET_SOUND:
+            c->sound[k] = V(x) > 1 ? V(x) : 0;
+            break;
+        case ADD_I:
+            c->i[k] += V(x);
+            break;
+        case LOAD_DIGIT_SPRITE:
+            c->i[k] = DIGIT_BASE_ADDR + DIGIT_LEN * V(x);
+            break;
+        case STORE_BCD:
+            lane_write(c, k, c->i[k], V(x) / 100);
+            lane_write(c, k, c->i[k] + 1, (V(x) / 10) % 10);
+            lane_write(c, k, c->i[k] + 2, V(x) % 10);
+            break;
+        case SAVE_REG:
+            for (int j = 0; j <= x; j++) {
+                lane_write(c, k, c->i[k] + j, V(j));
+            }
+            c->i[k] += x + 1;
+            break;
+        case RESTORE_REG:
+            for (int j = 0; j <= x; j++) {
+                V(j) = c->ram[k][(c->i[k] + j) & (RAM_SIZE - 1)];
+            }
+            c->i[k] += x + 1;
+            break;
+        default:
+            lane_stop(l, c, k, ERR_INVALID);
+            return;
+    }
+#undef V
+    c->remaining[k]--;
+}
+
+// Leaves the lanes of group at pc with steps fewer instructions left
+static void group_flush(lane_chunk* c, uint32_t group, uint16_t pc, uint32_t steps) {
+    for (uint32_t bits = group; bits != 0; bits &= bits - 1) {
+        int k = __builtin_ctz(bits);
+        c->pc[k] = pc;
+        c->remaining[k] -= steps;
+    }
+}
+
+// The fewest instructions any lane of group has left
+static uint32_t group_steps(const lane_chunk* c, uint32_t group) {
+    uint32_t steps = UINT32_MAX;
+    for (uint32_t bits = group; bits != 0; bits &= bits - 1) {
+        int k = __builtin_ctz(bits);
+        if (c->remaining[k] < steps) steps = c->remaining[k];
+    }
+    return steps;
+}
+
+/*
+ * Runs the lanes of group, which are all at pc, together with one pc between them until
+ * they split up, one runs out of instructions or they get to ahead, where other lanes are
+ * waiting to join them. Arithmetic, loads and skips are vector operations; calls, returns
+ * and drawing loop over the lanes but keep them together. Anything else, or a call or
+ * return that goes different ways, runs lane by lane.
+ */
+static void group_run(chip8_lanes* l, lane_chunk* c, uint32_t group, uint16_t pc, uint32_t ahead) {
+    lane_mask gm;
+    lane_mask_of(&gm, group);
+    lane_u8 g = (lane_u8) gm;
+    lane_u16 g16 = (lane_u16) __builtin_convertvector(gm, lane_mask16);
+    lane_u32 g32 = (lane_u32) __builtin_convertvector(gm, lane_mask32);
+    uint32_t steps = group_steps(c, group);
+    uint32_t done = 0;
+    // Vx = value in the group's lanes
+#define SET(dst, value) ((dst) = ((dst) & ~g) | ((value) & g))
+#define SET16(dst, value) ((dst) = ((dst) & ~g16) | ((value) & g16))
+#define EACH_LANE(k) for (uint32_t bits = group, k; bits != 0 && (k = __builtin_ctz(bits), 1); bits &= bits - 1)
+    while (done < steps) {
+        uint16_t addr = pc & (RAM_SIZE - 1);
+        instruction inst;
+        if (c->written[addr]) {
+            // Only go on together if every lane still has the same instruction here
+            uint16_t opcode = lane_opcode(c, __builtin_ctz(group), pc);
+            EACH_LANE(k) {
+                if (lane_opcode(c, k, pc) != opcode) {
+                    group_flush(c, group, pc, done);
+                    return;
+                }
+            }
+            inst = decode_instruction(opcode, MODE_CHIP8);
+        } else {
+            inst = l->icache[addr];
+        }
+        uint8_t x = inst.reg1, y = inst.reg2;
+        uint16_t next = pc + 2;
+        // Lanes that skip the next instruction, for the skips
+        lane_mask taken = {0};
+        switch (inst.tag) {
+            case LOAD:
+                SET(c->reg[x], (lane_u8) {0} + (uint8_t) inst.data);
+                break;
+            case ADD_NUM:
+                SET(c->reg[x], c->reg[x] + (uint8_t) inst.data);
+                break;
+            case MOV:
+                SET(c->reg[x], c->reg[y]);
+                break;
+            case OR:
+                SET(c->reg[x], c->reg[x] | c->reg[y]);
+                break;
+            case AND:
+                SET(c->reg[x], c->reg[x] & c->reg[y]);
+                break;
+            case XOR:
+                SET(c->reg[x], c->reg[x] ^ c->reg[y]);
+                break;
+            case ADD_REG: {
+                lane_u8 sum = c->reg[x] + c->reg[y];
+                lane_u8 carry = (lane_u8) (sum < c->reg[x]) & 1;
+                SET(c->reg[0xF], carry);
+                SET(c->reg[x], sum);
+                break;
+            }
+            case SUB_REG: {
+                lane_u8 a = c->reg[x], b = c->reg[y];
+                SET(c->reg[0xF], (lane_u8) (a > b) & 1);
+                SET(c->reg[x], a - b);
+                break;
+            }
+            case SUB_FROM: {
+                lane_u8 a = c->reg[x], b = c->reg[y];
+                SET(c->reg[0xF], (lane_u8) (b > a) & 1);
+                SET(c->reg[x], b - a);
+                break;
+            }
+            case RSHIFT: {
+                lane_u8 b = c->reg[y];
+                SET(c->reg[x], b >> 1);
+                SET(c->reg[0xF], b & 1);
+                break;
+            }
+            case LSHIFT: {
+                lane_u8 b = c->reg[y];
+                SET(c->reg[x], b << 1);
+                SET(c->reg[0xF], b >> 7);
+                break;
+            }
+            case LOAD_I:
+                SET16(c->i, (lane_u16) {0} + inst.data);
+                break;
+            case ADD_I:
+                SET16(c->i, c->i + __builtin_convertvector(c->reg[x], lane_u16));
+                break;
+            case LOAD_DIGIT_SPRITE:
+                SET16(c->i, DIGIT_BASE_ADDR + DIGIT_LEN * __builtin_convertvector(c->reg[x], lane_u16));
+                break;
+            case STORE_DELAY:
+                SET(c->reg[x], c->delay);
+                break;
+            case SET_DELAY:
+                SET(c->delay, c->reg[x]);
+                break;
+            case SET_SOUND:
+                SET(c->sound, c->reg[x] & (lane_u8) (c->reg[x] > 1));
+                break;
+            case RAND: {
+                lane_u32 r = c->rng;
+                r ^= r << 13;
+                r ^= r >> 17;
+                r ^= r << 5;
+                c->rng = (c->rng & ~g32) | (r & g32);
+                SET(c->reg[x], __builtin_convertvector(r >> 24, lane_u8) & (uint8_t) inst.data);
+                break;
+            }
+            case SKP_EQ:
+                taken = c->reg[x] == (uint8_t) inst.data;
+                break;
+            case SKP_NEQ:
+                taken = c->reg[x] != (uint8_t) inst.data;
+                break;
+            case SKP_EQ_REG:
+                taken = c->reg[x] == c->reg[y];
+                break;
+            case SKP_NEQ_REG:
+                taken = c->reg[x] != c->reg[y];
+                break;
+            case SKP_IF_KEY:
+            case SKP_IF_NOT_KEY:
+                EACH_LANE(k) {
+                    bool down = (c->keys[k] >> (c->reg[x][k] & 0xF)) & 1;
+                    taken[k] = down == (inst.tag == SKP_IF_KEY) ? -1 : 0;
+                }
+                break;
+            case DRAW:
+                EACH_LANE(k) {
+                    c->reg[0xF][k] = lane_draw(c, k, c->reg[x][k], c->reg[y][k], (uint8_t) inst.data);
+                }
+                break;
+            case JMP:
+                if (inst.data == pc) {
+                    // Spins to the end of the frame, like vm_skip_idle
+                    group_flush(c, group, pc, done);
+                    EACH_LANE(k) {
+                        lane_idle(l, c, k);
+                    }
+                    return;
+                }
+                next = inst.data;
+                break;
+            case CALL:
+                EACH_LANE(k) {
+                    if (c->sp[k] == 255) goto one_by_one;
+                }
+                EACH_LANE(k) {
+                    c->stack[k][c->sp[k]++] = next;
+                }
+                next = inst.data;
+                break;
+            case RET: {
+                int lead = __builtin_ctz(group);
+                if (c->sp[lead] == 0) goto one_by_one;
+                next = c->stack[lead][c->sp[lead] - 1];
+                EACH_LANE(k) {
+                    if (c->sp[k] == 0 || c->stack[k][c->sp[k] - 1] != next) goto one_by_one;
+                }
+                EACH_LANE(k) {
+                    c->sp[k]--;
+                }
+                break;
+            }
+            default:
+            one_by_one: {
+                // One lane at a time, then on together again if they all ended up at the same place
+                group_flush(c, group, pc, done);
+                EACH_LANE(k) {
+                    lane_step(l, c, k);
+                }
+                int lead = __builtin_ctz(group);
+                EACH_LANE(k) {
+                    if (c->remaining[k] == 0 || c->pc[k] != c->pc[lead]) return;
+                }
+                pc = c->pc[lead];
+                if (pc >= ahead) return;
+                steps = group_steps(c, group);
+                done = 0;
+                continue;
+            }
+        }
+        done++;
+        uint32_t skip = lane_bits(&taken) & group;
+        if (skip == group) {
+            next += 2;
+        } else if (skip != 0) {
+            group_flush(c, group, next, done);
+            for (uint32_t bits = skip; bits != 0; bits &= bits - 1) {
+                c->pc[__builtin_ctz(bits)] += 2;
+            }
+            return;
+        }
+        pc = next;
+        if (pc >= ahead) break;
+    }
+#undef SET
+#undef SET16
+#undef EACH_LANE
+    group_flush(c, group, pc, done);
+}
+
+/*
+ * Runs a chunk's frame. The lanes furthest behind go next, so lanes that split up at a
+ * branch meet again where the paths join and carry on together from there.
+ */
+static void chunk_run_frame(chip8_lanes* l, lane_chunk* c) {
+    for (int k = 0; k < LANE_WIDTH; k++) {
+        c->remaining[k] = (c->live >> k) & 1 ? l->budget : 0;
+    }
+    uint32_t pending = c->live;
+    while (pending != 0) {
+        uint32_t lowest = UINT32_MAX;
+        for (uint32_t bits = pending; bits != 0; bits &= bits - 1) {
+            int k = __builtin_ctz(bits);
+            if (c->pc[k] < lowest) lowest = c->pc[k];
+        }
+        uint32_t group = 0;
+        for (uint32_t bits = pending; bits != 0; bits &= bits - 1) {
+            int k = __builtin_ctz(bits);
+            if (c->pc[k] == lowest) group |= 1u << k;
+        }
+        int lead = __builtin_ctz(group);
+        if (c->written[lowest & (RAM_SIZE - 1)]) {
+            // Lanes that wrote something else over the code here go separately
+            uint16_t opcode = lane_opcode(c, lead, (uint16_t) lowest);
+            for (uint32_t bits = group; bits != 0; bits &= bits - 1) {
+                int k = __builtin_ctz(bits);
+                if (lane_opcode(c, k, (uint16_t) lowest) != opcode) group &= ~(1u << k);
+            }
+        }
+        // Where the next lanes not in the group are
+        uint32_t ahead = UINT32_MAX;
+        for (uint32_t bits = pending & ~group; bits != 0; bits &= bits - 1) {
+            int k = __builtin_ctz(bits);
+            if (c->pc[k] < ahead) ahead = c->pc[k];
+        }
+        if ((group & (group - 1)) == 0) {
+            do {
+                lane_step(l, c, lead);
+            } while (c->remaining[lead] > 0 && c->pc[lead] < ahead);
+        } else {
+            group_run(l, c, group, (uint16_t) lowest, ahead);
+        }
+        pending = 0;
+        for (uint32_t bits = c->live; bits != 0; bits &= bits - 1) {
+            int k = __builtin_ctz(bits);
+            if (c->remaining[k] > 0) pending |= 1u << k;
+        }
+    }
+}
+
+void lanes_run_frame(chip8_lanes* l) {
+    // The same as vm_run_frame: up to the instruction where the timers next count down
+    l->budget = (l->ips - l->timer_acc + TIMER_HZ - 1) / TIMER_HZ;
+    for (uint32_t n = 0; n < l->chunk_count; n++) {
+        chunk_run_frame(l, &l->chunks[n]);
+    }
+    l->cycles += l->budget;
+    l->timer_acc += l->budget * TIMER_HZ;
+    while (l->timer_acc >= l->ips) {
+        l->timer_acc -= l->ips;
+        for (uint32_t n = 0; n < l->chunk_count; n++) {
+            lane_chunk* c = &l->chunks[n];
+            // Stopped lanes keep their timers where they were
+            lane_mask live_mask;
+            lane_mask_of(&live_mask, c->live);
+            lane_u8 live = (lane_u8) live_mask;
+            c->delay -= (lane_u8) (c->delay > 0) & live & 1;
+            c->sound -= (lane_u8) (c->sound > 0) & live & 1;
+        }
+    }
+}
+
+chip8_lanes* lanes_new(uint32_t count, uint32_t instructions_per_second, const uint8_t program[], int program_len) {
+    chip8_lanes* l = malloc(sizeof(chip8_lanes));
+    // The starting memory, with the font, is whatever a VM starts with
+    chip8_vm* vm = malloc(sizeof(chip8_vm));
+    if (l == NULL || vm == NULL || count == 0) {
+        free(l);
+        free(vm);
+        return NULL;
+    }
+    l->count = count;
+    l->chunk_count = (count + LANE_WIDTH - 1) / LANE_WIDTH;
+    l->allocation = malloc(l->chunk_count * sizeof(lane_chunk) + CHUNK_ALIGN);
+    if (l->allocation == NULL) {
+        free(l);
+        free(vm);
+        return NULL;
+    }
+    l->chunks = (lane_chunk*) (((uintptr_t) l->allocation + CHUNK_ALIGN - 1) & ~(uintptr_t) (CHUNK_ALIGN - 1));
+    memset(vm, 0, sizeof(chip8_vm));
+    vm_load_program_mode(vm, MODE_CHIP8, instructions_per_second, program, program_len);
+    l->ips = vm->ips;
+    l->timer_acc = 0;
+    l->cycles = 0;
+    l->budget = 0;
+    for (uint32_t a = 0; a < RAM_SIZE; a++) {
+        uint16_t opcode = (uint16_t) (vm->ram[a] << 8) | vm->ram[(a + 1) & (RAM_SIZE - 1)];
+        l->icache[a] = decode_instruction(opcode, MODE_CHIP8);
+    }
+    for (uint32_t n = 0; n < l->chunk_count; n++) {
+        lane_chunk* c = &l->chunks[n];
+        memset(c, 0, sizeof(lane_chunk));
+        uint32_t lanes = count - n * LANE_WIDTH < LANE_WIDTH ? count - n * LANE_WIDTH : LANE_WIDTH;
+        c->live = lanes == 32 ? UINT32_MAX : (1u << lanes) - 1;
+        c->pc = (lane_u16) {0} + PROGRAM_START;
+        c->rng = (lane_u32) {0} + RNG_SEED;
+        for (int k = 0; k < LANE_WIDTH; k++) {
+            c->key_released[k] = NO_KEY;
+            memcpy(c->ram[k], vm->ram, RAM_SIZE);
+        }
+    }
+    free(vm);
+    return l;
+}
+
+void lanes_free(chip8_lanes* l) {
+    if (l == NULL) return;
+    free(l->allocation);
+    free(l);
+}
+
+uint32_t lanes_count(const chip8_lanes* l) {
+    return l->count;
+}
+
+void lanes_seed(chip8_lanes* l, uint32_t lane, uint32_t seed) {
+    l->chunks[lane / LANE_WIDTH].rng[lane % LANE_WIDTH] = seed != 0 ? seed : RNG_SEED;
+}
+
+void lanes_set_keys(chip8_lanes* l, uint32_t lane, uint16_t keys) {
+    lane_chunk* c = &l->chunks[lane / LANE_WIDTH];
+    int k = lane % LANE_WIDTH;
+    uint16_t released = c->keys[k] & ~keys;
+    c->keys[k] = keys;
+    if (released != 0 && c->waiting[k]) c->key_released[k] = (int8_t) __builtin_ctz(released);
+}
+
+tick_result lanes_result(const chip8_lanes* l, uint32_t lane) {
+    return (tick_result) l->chunks[lane / LANE_WIDTH].result[lane % LANE_WIDTH];
+}
+
+void lanes_export(const chip8_lanes* l, uint32_t lane, chip8_vm* vm) {
+    const lane_chunk* c = &l->chunks[lane / LANE_WIDTH];
+    int k = lane % LANE_WIDTH;
+    bool live = (c->live >> k) & 1;
+    vm_load_program_mode(vm, MODE_CHIP8, l->ips, NULL, 0);
+    memcpy(vm->ram, c->ram[k], RAM_SIZE);
+    for (int r = 0; r < 16; r++) {
+        vm->reg[r] = c->reg[r][k];
+    }
+    vm->i = c->i[k];
+    vm->pc = c->pc[k];
+    vm->delay = c->delay[k];
+    vm->sound = c->sound[k];
+    vm->waiting_for_keypress = c->waiting[k];
+    vm->key_released = c->key_released[k];
+    vm->keys = c->keys[k];
+    vm->stack.ptr = c->sp[k];
+    memcpy(vm->stack.stack, c->stack[k], sizeof(c->stack[k]));
+    vm->cycles = live ? l->cycles : c->stop_cycles[k];
+    vm->timer_acc = live ? l->timer_acc : c->stop_timer_acc[k];
+    vm->idle_cycles = c->idle[k];
+    vm->rng = c->rng[k];
+    for (int y = 0; y < SCREEN_HEIGHT; y++) {
+        vm->fb.planes[0][y][0] = c->fb[k][y];
+    }
+}
+
+uint64_t lanes_cycles(const chip8_lanes* l, uint32_t lane, uint64_t* idle) {
+    const lane_chunk* c = &l->chunks[lane / LANE_WIDTH];
+    int k = lane % LANE_WIDTH;
+    *idle = c->idle[k];
+    return (c->live >> k) & 1 ? l->cycles : c->stop_cycles[k];
+}
+
+uint64_t lanes_screen_hash(const chip8_lanes* l, uint32_t lane) {
+    const lane_chunk* c = &l->chunks[lane / LANE_WIDTH];
+    framebuffer fb;
+    set_screen_size(&fb, SCREEN_WIDTH, SCREEN_HEIGHT);
+    for (int y = 0; y < SCREEN_HEIGHT; y++) {
+        fb.planes[0][y][0] = c->fb[lane % LANE_WIDTH][y];
+    }
+    return screen_hash(&fb);
+}
@@ -0,0 +1,42 @@
+#ifndef CHIP8_LANES_H
+#define CHIP8_LANES_H
+
+#include <stdint.h>
+#include "vm.h"
+
+/*
+ * Many copies of one CHIP-8 program run side by side, for searches and training runs that try
+ * thousands of input streams. The copies (lanes) are kept in structure-of-arrays form, 32 to a
+ * chunk, so an instruction the lanes of a chunk are all at is decoded once and run on all of
+ * them with vector operations. When their paths split, the lanes furthest behind run first,
+ * so they join up again where the paths meet.
+ *
+ * A lane behaves exactly like a chip8_vm loaded with the same program and seed, with its keys
+ * set before each frame and vm_run_frame called without any backends: lanes_export gives that
+ * VM's state. Plain CHIP-8 only.
+ */
+typedef struct chip8_lanes chip8_lanes;
+
+// NULL if out of memory
+chip8_lanes* lanes_new(uint32_t count, uint32_t instructions_per_second, const uint8_t program[], int program_len);
+void lanes_free(chip8_lanes* l);
+uint32_t lanes_count(const chip8_lanes* l);
+// Reseeds RAND in one lane, like vm_seed
+void lanes_seed(chip8_lanes* l, uint32_t lane, uint32_t seed);
+// Holds keys down in one lane from the next frame on, the lowest key let go answering a waiting Fx0A
+void lanes_set_keys(chip8_lanes* l, uint32_t lane, uint16_t keys);
+// Runs every lane up to and including the next timer tick, like vm_run_frame
+void lanes_run_frame(chip8_lanes* l);
+// SUCCESS, or the error the lane stopped on. Stopped lanes don't run again.
+tick_result lanes_result(const chip8_lanes* l, uint32_t lane);
+// Loads one lane's state into vm, leaving its backends and engine alone
+void lanes_export(const chip8_lanes* l, uint32_t lane, chip8_vm* vm);
+/*
+ * One lane's vm->cycles, setting idle to its vm->idle_cycles, without exporting it. Lanes only
+ * count jumps to themselves and key waits as idle; delay timer polls that vm_skip_idle would
+ * skip run instruction by instruction.
+ */
+uint64_t lanes_cycles(const chip8_lanes* l, uint32_t lane, uint64_t* idle);
+uint64_t lanes_screen_hash(const chip8_lanes* l, uint32_t lane);
+
+#endif
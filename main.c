@@ -2,431 +2,771 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include "vm.h"
+#include "rom.h"
+#include "savestate.h"
+#include "movie.h"
+#include "corpus.h"
+#ifdef CHIP8_PROFILE
+#include "profile.h"
+#endif
+#ifdef CHIP8_HAVE_JIT
+#include "jit.h"
+#endif
+#ifdef CHIP8_HAVE_CAPTURE
+#include "capture.h"
+#endif
+#ifdef CHIP8_HAVE_DEBUGGER
+#include "debug.h"
+#endif
+#ifdef CHIP8_HAVE_SDL
 #include <SDL.h>
-#include "instruction.c"
-#include "graphics.c"
+#include "graphics.h"
+#include "keymap.h"
+#include "audio.h"
+#endif
 
-const SDL_Scancode KEYS[16] = {
-        SDL_SCANCODE_1, SDL_SCANCODE_2, SDL_SCANCODE_3, SDL_SCANCODE_4,
-        SDL_SCANCODE_Q, SDL_SCANCODE_W, SDL_SCANCODE_E, SDL_SCANCODE_R,
-        SDL_SCANCODE_A, SDL_SCANCODE_S, SDL_SCANCODE_D, SDL_SCANCODE_F,
-        SDL_SCANCODE_Z, SDL_SCANCODE_X, SDL_SCANCODE_C, SDL_SCANCODE_V
-};
+#ifdef CHIP8_PROFILE
+// Set by --profile
+static chip8_profile* profile = NULL;
+static const char* profile_path = NULL;
+#endif
 
-typedef struct {
-    uint16_t stack[256];
-    uint8_t ptr;
-} callstack;
+#ifdef CHIP8_HAVE_CAPTURE
+// Set by --capture, gets every emulated frame
+static capture* video = NULL;
+#endif
 
-callstack new_callstack() {
-    callstack stack;
-    stack.ptr = 0;
-    return stack;
-}
+#ifdef CHIP8_HAVE_DEBUGGER
+// Set by --debug, looked at between frames
+static chip8_debugger* debugger = NULL;
+#endif
 
-int callstack_push(callstack* stack, uintptr_t addr) {
-    if (stack->ptr == 255) return -1;
-    stack->stack[stack->ptr] = addr;
-    return stack->ptr++;
-}
+#ifdef CHIP8_HAVE_SDL
+// Keyboard samples per frame in the window, see --polls
+#define DEFAULT_POLLS 4
 
-int callstack_pop(callstack* stack) {
-    if (stack->ptr == 0) return -1;
-    return stack->stack[--stack->ptr];
-}
+// Emulated frames per shown frame that F6 and F7 step through, see --speed. 0 is unlimited.
+static const double SPEEDS[] = {0.25, 0.5, 1, 2, 4, 8, 16, 32, 0};
+#define SPEED_COUNT (sizeof(SPEEDS) / sizeof(SPEEDS[0]))
+#define NORMAL_SPEED 2
+#define UNLIMITED_SPEED (SPEED_COUNT - 1)
 
-uint8_t rand_byte() {
-    return rand() % 256;
-}
+#ifdef CHIP8_PROFILE
+// Times stmt into the profile section, on the performance counter
+#define SDL_PROFILED(section, stmt) do { \
+        uint64_t start_ = SDL_GetPerformanceCounter(); \
+        stmt; \
+        double elapsed_ = (double) (SDL_GetPerformanceCounter() - start_) / SDL_GetPerformanceFrequency(); \
+        if (profile != NULL) profile_add_time(profile, section, elapsed_); \
+    } while (0)
 
-typedef enum {
-    SUCCESS,
-    ERR_STACK_OVERFLOW,
-    ERR_STACK_UNDERFLOW,
-    ERR_INVALID,
-} tick_result;
+// Like SDL_PROFILED, for work done inside vm_run_frame, so it comes back out of the emulation time
+#define SDL_PROFILED_IN_FRAME(section, stmt) do { \
+        uint64_t start_ = SDL_GetPerformanceCounter(); \
+        stmt; \
+        double elapsed_ = (double) (SDL_GetPerformanceCounter() - start_) / SDL_GetPerformanceFrequency(); \
+        if (profile != NULL) { \
+            profile_add_time(profile, section, elapsed_); \
+            profile_add_time(profile, PROFILE_EMULATION, -elapsed_); \
+        } \
+    } while (0)
+#else
+#define SDL_PROFILED(section, stmt) stmt
+#define SDL_PROFILED_IN_FRAME(section, stmt) stmt
+#endif
 
-#define DIGIT_BASE_ADDR 0
-#define DIGIT_LEN 5
-static uint8_t DIGIT_SPRITES[80] = {0xF0, 0x90, 0x90, 0x90, 0xF0, \
-0x20, 0x60, 0x20, 0x20, 0x70, \
-0xF0, 0x10, 0xF0, 0x80, 0xF0, \
-0xF0, 0x10, 0xF0, 0x10, 0xF0, \
-0x90, 0x90, 0xF0, 0x10, 0x10, \
-0xF0, 0x80, 0xF0, 0x10, 0xF0, \
-0xF0, 0x80, 0xF0, 0x90, 0xF0, \
-0xF0, 0x10, 0x20, 0x40, 0x40, \
-0xF0, 0x90, 0xF0, 0x90, 0xF0, \
-0xF0, 0x90, 0xF0, 0x10, 0xF0, \
-0xF0, 0x90, 0xF0, 0x90, 0x90, \
-0xE0, 0x90, 0xE0, 0x90, 0xE0, \
-0xF0, 0x80, 0x80, 0x80, 0xF0, \
-0xE0, 0x90, 0x90, 0x90, 0xE0, \
-0xF0, 0x80, 0xF0, 0x80, 0xF0, \
-0xF0, 0x80, 0xF0, 0x80, 0x80};
+// Requests from the window thread to the emulation thread, bits of sdl_shared.commands
+#define COMMAND_SAVE_STATE 1u
+#define COMMAND_LOAD_STATE 2u
+#define COMMAND_QUIT 4u
 
-typedef struct vm {
-    uint8_t ram[4096];
-    uint8_t reg[16];
-    uint16_t i;
-    uint16_t pc;
-    uint8_t tpu;
-    uint8_t delay;
-    uint8_t sound;
-    bool waiting_for_keypress;
-    SDL_Scancode* key_released;
-    callstack stack;
-    fps_clock clock;
+/*
+ * What the window thread and the emulation thread share. The window owns SDL's events
+ * and the renderer, and the emulation thread owns the VM; everything that crosses over
+ * is a word written and read atomically, or a frame in the triple buffer, so neither side
+ * ever waits for the other.
+ */
+typedef struct {
+    // Window side
+    key_map map;
     sdl_handle* gfx;
-} chip8_vm;
+    // Emulation side
+    chip8_vm* vm;
+    fps_clock clock;
+    movie* rec;
+    rewind_buffer* rw;
+    const char* state_path;
+    // NULL without sound
+    sdl_audio* audio;
+    /*
+     * Whether polls wait for their share of the frame, which only makes sense at normal speed.
+     * Otherwise they read the keyboard as the window last saw it.
+     */
+    bool paced;
+    // Shared: frames going to the window, and in the other direction the CHIP-8 keys held,
+    // the key last released (or NO_KEY), the SPEEDS step, whether Backspace is held and commands
+    frame_exchange frames;
+    uint32_t keys;
+    int32_t released;
+    uint32_t speed;
+    uint32_t rewinding;
+    uint32_t commands;
+} sdl_shared;
+
+#define SHARED_LOAD(field) __atomic_load_n(&(field), __ATOMIC_ACQUIRE)
+#define SHARED_STORE(field, value) __atomic_store_n(&(field), (value), __ATOMIC_RELEASE)
+
+/*
+ * Sees key events as SDL queues them on the window thread, so their timestamps and taps
+ * shorter than a poll aren't lost, and wakes an idle emulation thread for them.
+ */
+int sdl_key_watch(void* ctx, SDL_Event* e) {
+    sdl_shared* s = ctx;
+    if (e->type != SDL_KEYDOWN && e->type != SDL_KEYUP) return 1;
+    SDL_Scancode scancode = e->key.keysym.scancode;
+    if (scancode < 0 || scancode >= SDL_NUM_SCANCODES || s->map.key_of[scancode] == NO_KEY) return 1;
+    if (e->key.repeat) return 1;
+    if (e->type == SDL_KEYDOWN) latency_press(&s->gfx->latency, e->key.timestamp);
+    if (e->type == SDL_KEYUP) SHARED_STORE(s->released, s->map.key_of[scancode]);
+    SHARED_STORE(s->keys, key_map_sample(&s->map));
+    SDL_SemPost(s->clock.wake);
+    return 1;
+}
 
-void vm_load_program(chip8_vm* vm, sdl_handle* gfx, uint8_t ticks_per_update, const uint8_t program[], int program_len) {
-    for (int i = 0; i < 16; i++){
-        vm->reg[i] = 0;
+/*
+ * Input poll on the emulation thread. Polls after the first wait for their share of the
+ * frame to pass in real time, so a key pressed part way through a frame reaches the program
+ * within the same frame instead of the next one.
+ */
+void sdl_poll(void* ctx, chip8_vm* vm, uint32_t part) {
+    sdl_shared* s = ctx;
+    if (s->audio != NULL) audio_sync(s->audio, vm);
+    if (s->paced && part > 0) {
+        SDL_PROFILED_IN_FRAME(PROFILE_SLEEP, fps_clock_wait_part(&s->clock, part, vm->input.polls_per_frame));
     }
-    vm->i = 0;
-    vm->delay = 0;
-    vm->sound = 0;
-    vm->waiting_for_keypress = false;
-    vm->key_released = NULL;
-    vm->tpu = ticks_per_update;
-    vm->stack = new_callstack();
-    vm->clock = new_fps_clock(60);
-    vm->gfx = gfx;
-    // Chip-8 programs are loaded at address 0x200
-    vm->pc = 0x200;
-    for (int i = 0; i < program_len; i++) {
-        vm->ram[i+0x200] = program[i];
+    vm->keys = (uint16_t) SHARED_LOAD(s->keys);
+    int8_t released = (int8_t) __atomic_exchange_n(&s->released, NO_KEY, __ATOMIC_ACQ_REL);
+    // Only a release while the program is waiting for one answers Fx0A
+    if (!vm->waiting_for_keypress) released = NO_KEY;
+    if (released != NO_KEY) vm->key_released = released;
+    if (s->rec != NULL) movie_record_input(s->rec, vm->keys, released);
+}
+
+// Finds the SPEEDS step for --speed, which is a multiplier such as 0.5 or 4, or "max"
+static bool parse_speed(const char* arg, size_t* speed) {
+    if (strcmp(arg, "max") == 0) {
+        *speed = UNLIMITED_SPEED;
+        return true;
     }
-    // Load the digit sprites into memory
-    for (int i = 0; i < DIGIT_LEN * 16; i++) {
-        vm->ram[i + DIGIT_BASE_ADDR] = DIGIT_SPRITES[i];
+    double multiplier = strtod(arg, NULL);
+    for (size_t k = 0; k < UNLIMITED_SPEED; k++) {
+        if (SPEEDS[k] == multiplier) {
+            *speed = k;
+            return true;
+        }
     }
+    return false;
 }
 
-tick_result vm_tick(chip8_vm* vm) {
-    // Load the next two bytes that make up the instruction
-    uint16_t raw_inst = (((uint16_t) vm->ram[vm->pc]) << 8) + (uint16_t) vm->ram[vm->pc+1];
-    instruction inst = decode_instruction(raw_inst);
-    vm->pc += 2;
-    switch (inst.tag) {
-        case CLEAR:
-            clear_screen(vm->gfx);
-            break;
-        case LOAD:
-            vm->reg[inst.reg1] = inst.data;
-            break;
-        case MOV:
-            vm->reg[inst.reg1] = vm->reg[inst.reg2];
-            break;
-        case ADD_NUM:
-            vm->reg[inst.reg1] += inst.data;
-            break;
-        case ADD_REG: {
-            uint16_t x = (uint16_t) vm->reg[inst.reg1];
-            uint16_t y = (uint16_t) vm->reg[inst.reg2];
-            uint16_t res = x + y;
-            if (res > 255) {
-                res = res % 256;
-                vm->reg[0xF] = 0x01;
-            } else {
-                vm->reg[0xF] = 0x00;
-            }
-            vm->reg[inst.reg1] = (uint8_t) res;
-            break;
-        }
-        case SUB_REG: {
-            uint8_t x = vm->reg[inst.reg1];
-            uint8_t y = vm->reg[inst.reg2];
-            uint8_t res = x - y;
-            if (x > y) {
-                vm->reg[0xF] = 0x01;
-            } else {
-                vm->reg[0xF] = 0x00;
-            }
-            vm->reg[inst.reg1] = res;
-            break;
+/*
+ * Runs the frames due this tick at the given speed step and hands the last one to the
+ * window: the frames before it still run their timers and polls, and leave their changes
+ * marked in fb->dirty_rows for it. At unlimited speed frames run until most of the tick is
+ * used up. Returns how many frames ran.
+ */
+static uint32_t run_frames(sdl_shared* s, size_t speed, double* credit) {
+    chip8_vm* vm = s->vm;
+    uint32_t due = 1;
+    uint64_t deadline = 0;
+    if (speed == UNLIMITED_SPEED) {
+        // Leave a quarter of the tick for the commands and the sleep
+        deadline = SDL_GetPerformanceCounter() + SDL_GetPerformanceFrequency() * 3 / (4 * TIMER_HZ);
+    } else {
+        *credit += SPEEDS[speed];
+        due = (uint32_t) *credit;
+        *credit -= due;
+    }
+    uint32_t frames = 0;
+    tick_result res = SUCCESS;
+    SDL_PROFILED(PROFILE_EMULATION, {
+        while (speed == UNLIMITED_SPEED ? SDL_GetPerformanceCounter() < deadline : frames < due) {
+            res = vm_run_frame(vm);
+            // Stopped by the debugger part way through, the rest of the frame runs when it carries on
+            if (res == STOPPED) break;
+            frames++;
+            if (s->rec != NULL) movie_record_frame(s->rec, vm);
+#ifdef CHIP8_HAVE_CAPTURE
+            // Frames that are never shown still go in, so the capture plays at the emulated speed
+            if (video != NULL) capture_frame(video, &vm->fb);
+#endif
+            // An error would likely repeat every frame
+            if (res != SUCCESS) break;
         }
-        case SUB_FROM: {
-            uint8_t x = vm->reg[inst.reg1];
-            uint8_t y = vm->reg[inst.reg2];
-            uint8_t res = y - x;
-            if (y > x) {
-                vm->reg[0xF] = 0x01;
-            } else {
-                vm->reg[0xF] = 0x00;
-            }
-            vm->reg[inst.reg1] = res;
-            break;
+    });
+    if (res != SUCCESS && res != STOPPED) puts(tick_result_str(res));
+    if (s->audio != NULL) audio_sync(s->audio, vm);
+    if (frames > 0 || res == STOPPED) SDL_PROFILED(PROFILE_DISPLAY, frame_exchange_publish(&s->frames, &vm->fb));
+    return frames;
+}
+
+// The emulation thread: runs frames at 60 Hz, whatever the window is doing, until told to quit
+static int emulation_main(void* ctx) {
+    sdl_shared* s = ctx;
+    chip8_vm* vm = s->vm;
+    // Fraction of a frame carried over between ticks below normal speed
+    double credit = 0;
+    // What the audio clock was last started at, -1 before it has been
+    double audio_speed = -1;
+    for (;;) {
+        uint32_t commands = __atomic_exchange_n(&s->commands, 0, __ATOMIC_ACQ_REL);
+        if (commands & COMMAND_QUIT) break;
+        if (commands & COMMAND_SAVE_STATE && !vm_save_state_file(vm, s->state_path)) {
+            printf("Error saving state to \"%s\"\n", s->state_path);
         }
-        case AND:
-            vm->reg[inst.reg1] &= vm->reg[inst.reg2];
-            break;
-        case OR:
-            vm->reg[inst.reg1] |= vm->reg[inst.reg2];
-            break;
-        case XOR:
-            vm->reg[inst.reg1] ^= vm->reg[inst.reg2];
-            break;
-        case RSHIFT: {
-            uint8_t y = vm->reg[inst.reg2];
-            vm->reg[inst.reg1] = y >> 1;
-            vm->reg[0xF] = y & 0b1;
-            break;
+        if (commands & COMMAND_LOAD_STATE && s->rec == NULL) {
+            if (!vm_load_state_file(vm, s->state_path)) printf("Error loading state from \"%s\"\n", s->state_path);
+            if (s->rw != NULL) rewind_push(s->rw, vm);
+            audio_speed = -1;
+            frame_exchange_publish(&s->frames, &vm->fb);
         }
-        case LSHIFT: {
-            uint8_t y = vm->reg[inst.reg2];
-            vm->reg[inst.reg1] = y << 1;
-            vm->reg[0xF] = (y & 0b10000000) >> 7;
-            break;
+        uint64_t cycles_before = vm->cycles;
+        uint64_t idle_before = vm->idle_cycles;
+        size_t run_speed = SHARED_LOAD(s->speed);
+        s->paced = run_speed == NORMAL_SPEED;
+        bool rewinding = s->rw != NULL && SHARED_LOAD(s->rewinding);
+        bool paused = false;
+#ifdef CHIP8_HAVE_DEBUGGER
+        if (debugger != NULL) paused = !debug_poll(debugger, vm, 0);
+#endif
+        // Rewinding and pausing go silent like unlimited speed, and the clock restarts wherever the VM is after
+        double speed_now = rewinding || paused ? 0 : SPEEDS[run_speed];
+        if (s->audio != NULL && speed_now != audio_speed) audio_rebase(s->audio, vm, speed_now);
+        audio_speed = speed_now;
+        if (rewinding) {
+            rewind_step(s->rw, vm);
+            // Neither a release nor a press from before the jump back is answered by this state
+            SHARED_STORE(s->released, NO_KEY);
+            frame_exchange_publish(&s->frames, &vm->fb);
+        } else if (!paused) {
+            // Rewinding steps back over what was shown, so in turbo one step skips several frames
+            if (run_frames(s, run_speed, &credit) > 0 && s->rw != NULL) rewind_push(s->rw, vm);
         }
-        case RAND:
-            vm->reg[inst.reg1] = rand_byte() & inst.data;
-            break;
-        case JMP:
-            vm->pc = inst.data;
-            break;
-        case JMP_REL:
-            vm->pc = inst.data + vm->reg[0];
-            break;
-        case CALL:
-            if (callstack_push(&vm->stack, vm->pc) < 0) return ERR_STACK_OVERFLOW;
-            vm->pc = inst.data;
-            break;
-        case RET:
-            int16_t ret_addr = callstack_pop(&vm->stack);
-            if (ret_addr < 0) return ERR_STACK_UNDERFLOW;
-            vm->pc = ret_addr;
-            break;
-        case SKP_EQ:
-            if (vm->reg[inst.reg1] == inst.data) vm->pc += 2;
-            break;
-        case SKP_NEQ:
-            if (vm->reg[inst.reg1] != inst.data) vm->pc += 2;
-            break;
-        case SKP_EQ_REG:
-            if (vm->reg[inst.reg1] == vm->reg[inst.reg2]) vm->pc += 2;
-            break;
-        case SKP_NEQ_REG:
-            if (vm->reg[inst.reg1] != vm->reg[inst.reg2]) vm->pc += 2;
-            break;
-        case SET_DELAY:
-            vm->delay = vm->reg[inst.reg1];
-            break;
-        case STORE_DELAY:
-            vm->reg[inst.reg1] = vm->delay;
-            break;
-        case SET_SOUND:
-            vm->sound = (vm->reg[inst.reg1] > 1) ? vm->reg[inst.reg1] : 0;
-            break;
-        case WAIT_FOR_KEY:
-            if (!vm->waiting_for_keypress) {
-                vm->waiting_for_keypress = true;
+        // Mostly spent in idle loops (or rewinding), so there's no need to wake up exactly on time
+        bool idle = (vm->idle_cycles - idle_before) * 2 >= vm->cycles - cycles_before;
+        SDL_PROFILED(PROFILE_SLEEP, fps_clock_tick(&s->clock, idle));
+    }
+    fps_clock_report(&s->clock);
+    return 0;
+}
+
+/*
+ * The windowed main loop, on the thread that owns the window. It handles events and shows
+ * frames as the emulation thread finishes them, waiting at most a millisecond for events
+ * so input reaches the emulation promptly and SDL stamps events close to when they happened.
+ * Holding Backspace rewinds one step per frame, F5 saves the state to state_path, F9 loads
+ * it back and F3 toggles the latency overlay. F6 and F7 step the speed down and up from
+ * speed (an index into SPEEDS), and holding Tab runs at unlimited speed. Above normal speed
+ * one frame is shown per tick.
+ * The keyboard is read through keys polls times per frame, and the sound timer plays
+ * through audio unless it's NULL.
+ * When rec is given every poll's input goes into it, and rewinding and loading are off
+ * since the movie has to be one unbroken run.
+ */
+void vm_run(chip8_vm* vm, sdl_handle* gfx, const char* state_path, movie* rec, const key_map* keys,
+            uint32_t polls, size_t speed, sdl_audio* audio) {
+    bool quit = false;
+    SDL_Event e;
+    static sdl_shared s;
+    s.map = *keys;
+    s.gfx = gfx;
+    s.vm = vm;
+    s.rec = rec;
+    s.rw = rec == NULL ? rewind_new(DEFAULT_REWIND_BYTES) : NULL;
+    s.state_path = state_path;
+    s.audio = audio;
+    frame_exchange_init(&s.frames, &vm->fb);
+    s.keys = 0;
+    s.released = NO_KEY;
+    s.speed = (uint32_t) speed;
+    s.rewinding = false;
+    s.commands = 0;
+    s.clock = new_fps_clock(TIMER_HZ);
+    s.clock.wake = SDL_CreateSemaphore(0);
+    vm->input.ctx = &s;
+    vm->input.poll = sdl_poll;
+    vm->input.polls_per_frame = polls;
+    display_screen(gfx, frame_exchange_front(&s.frames));
+    puts("Starting main loop");
+    SDL_Thread* emulation = SDL_CreateThread(emulation_main, "emulation", &s);
+    if (emulation == NULL) {
+        printf("Emulation thread could not be started! SDL_Error: %s\n", SDL_GetError());
+        exit(1);
+    }
+    SDL_AddEventWatch(sdl_key_watch, &s);
+    while (!quit) {
+        bool got = SDL_WaitEventTimeout(&e, 1) != 0;
+        while (got && !quit) {
+            if (e.type == SDL_QUIT) quit = true;
+            if (e.type == SDL_WINDOWEVENT) {
+                // The window contents may have been lost, so show the frame again even if nothing changed
+                gfx->redraw = true;
             }
-            if (vm->key_released != NULL) {
-                uint8_t code;
-                switch (*vm->key_released) {
-                    case SDL_SCANCODE_1:
-                        code = 0x0;
-                        break;
-                    case SDL_SCANCODE_2:
-                        code = 0x1;
-                        break;
-                    case SDL_SCANCODE_3:
-                        code = 0x2;
-                        break;
-                    case SDL_SCANCODE_4:
-                        code = 0x3;
-                        break;
-                    case SDL_SCANCODE_Q:
-                        code = 0x4;
-                        break;
-                    case SDL_SCANCODE_W:
-                        code = 0x5;
-                        break;
-                    case SDL_SCANCODE_E:
-                        code = 0x6;
-                        break;
-                    case SDL_SCANCODE_R:
-                        code = 0x7;
-                        break;
-                    case SDL_SCANCODE_A:
-                        code = 0x8;
-                        break;
-                    case SDL_SCANCODE_S:
-                        code = 0x9;
-                        break;
-                    case SDL_SCANCODE_D:
-                        code = 0xa;
-                        break;
-                    case SDL_SCANCODE_F:
-                        code = 0xb;
-                        break;
-                    case SDL_SCANCODE_Z:
-                        code = 0xc;
-                        break;
-                    case SDL_SCANCODE_X:
-                        code = 0xd;
-                        break;
-                    case SDL_SCANCODE_C:
-                        code = 0xe;
-                        break;
-                    case SDL_SCANCODE_V:
-                        code = 0xf;
-                        break;
-                    default:
-                        puts("Invalid keycode received in wait_for_key!!!");
-                        code = 0x0;
-                        break;
-                }
-                vm->key_released = NULL;
-                vm->waiting_for_keypress = false;
-            } else {
-                // If a key has not been released change vm->pc to point at this same instruction
-                // so the VM loops until a key is released
-                vm->pc -= 2;
+            if (e.type == SDL_KEYDOWN && e.key.keysym.scancode == SDL_SCANCODE_F5) {
+                __atomic_fetch_or(&s.commands, COMMAND_SAVE_STATE, __ATOMIC_ACQ_REL);
             }
-            break;
-        case SKP_IF_KEY: {
-            const uint8_t *state = SDL_GetKeyboardState(NULL);
-            if (state[KEYS[vm->reg[inst.reg1]]]) {
-                vm->pc += 2;
+            if (e.type == SDL_KEYDOWN && e.key.keysym.scancode == SDL_SCANCODE_F9) {
+                __atomic_fetch_or(&s.commands, COMMAND_LOAD_STATE, __ATOMIC_ACQ_REL);
             }
-            break;
+            if (e.type == SDL_KEYDOWN && e.key.keysym.scancode == SDL_SCANCODE_F3) toggle_overlay(gfx);
+            if (e.type == SDL_KEYDOWN && e.key.keysym.scancode == SDL_SCANCODE_F6 && speed > 0) speed--;
+            if (e.type == SDL_KEYDOWN && e.key.keysym.scancode == SDL_SCANCODE_F7 && speed < UNLIMITED_SPEED) speed++;
+            got = SDL_PollEvent(&e) != 0;
         }
-        case SKP_IF_NOT_KEY: {
-            const uint8_t *state = SDL_GetKeyboardState(NULL);
-            if (!state[KEYS[vm->reg[inst.reg1]]]) {
-                vm->pc += 2;
-            }
-            break;
+        // Also catches keys let go without an event of their own, e.g. when the window loses focus
+        SHARED_STORE(s.keys, key_map_sample(&s.map));
+        const uint8_t* state = SDL_GetKeyboardState(NULL);
+        size_t run_speed = state[SDL_SCANCODE_TAB] ? UNLIMITED_SPEED : speed;
+        SHARED_STORE(s.speed, (uint32_t) run_speed);
+        show_speed(gfx, SPEEDS[run_speed]);
+        bool rewinding = rec == NULL && state[SDL_SCANCODE_BACKSPACE];
+        SHARED_STORE(s.rewinding, rewinding);
+        // No press from before the jump back is answered by the rewound state
+        if (rewinding) gfx->latency.waiting = false;
+        framebuffer* fb = frame_exchange_take(&s.frames);
+        if (fb != NULL || gfx->redraw) display_screen(gfx, fb != NULL ? fb : frame_exchange_front(&s.frames));
+    }
+    SDL_DelEventWatch(sdl_key_watch, &s);
+    __atomic_fetch_or(&s.commands, COMMAND_QUIT, __ATOMIC_ACQ_REL);
+    SDL_SemPost(s.clock.wake);
+    SDL_WaitThread(emulation, NULL);
+    SDL_DestroySemaphore(s.clock.wake);
+    latency_report(&gfx->latency);
+    rewind_free(s.rw);
+}
+#endif
+
+/*
+ * Runs the VM for a fixed number of frames as fast as possible, with no window,
+ * input, or frame pacing, then prints the final screen hash and the speed.
+ * The run is recorded into rec if it's given.
+ */
+int vm_run_headless(chip8_vm* vm, long frames, movie* rec) {
+    tick_result res = SUCCESS;
+    long frame = 0;
+    clock_t start = clock();
+    while (frame < frames) {
+#ifdef CHIP8_HAVE_DEBUGGER
+        // Waits here while the debugger has the VM paused
+        if (debugger != NULL && !debug_poll(debugger, vm, 100)) continue;
+#endif
+        if (rec != NULL) movie_record_input(rec, 0, NO_KEY);
+        res = vm_run_frame(vm);
+        // Stopped by the debugger part way through, the rest of the frame runs when it carries on
+        if (res == STOPPED) continue;
+        if (res != SUCCESS) break;
+        if (rec != NULL) movie_record_frame(rec, vm);
+#ifdef CHIP8_HAVE_CAPTURE
+        if (video != NULL) capture_frame(video, &vm->fb);
+#endif
+        frame++;
+    }
+    double elapsed = (double) (clock() - start) / CLOCKS_PER_SEC;
+#ifdef CHIP8_PROFILE
+    if (profile != NULL) profile_add_time(profile, PROFILE_EMULATION, elapsed);
+#endif
+    if (res != SUCCESS) printf("error: %s (pc=%#05x, frame %ld)\n", tick_result_str(res), vm->pc, frame);
+    printf("frames: %ld\n", frame);
+    printf("cycles: %llu\n", (unsigned long long) (vm->cycles - vm->idle_cycles));
+    printf("idle cycles skipped: %llu\n", (unsigned long long) vm->idle_cycles);
+    printf("seconds: %.6f\n", elapsed);
+    printf("cycles/sec: %.0f\n", elapsed > 0 ? (vm->cycles - vm->idle_cycles) / elapsed : 0.0);
+    printf("hash: %016llx\n", (unsigned long long) screen_hash(&vm->fb));
+    return res == SUCCESS ? 0 : 2;
+}
+
+/*
+ * Plays a movie back headless as fast as possible, checking the screen at every
+ * recorded checkpoint. Errors are reported and skipped over like in the window,
+ * so the replay follows the recorded run.
+ */
+int vm_run_replay(chip8_vm* vm, movie* m) {
+    uint64_t expected;
+    int mismatches = 0;
+    clock_t start = clock();
+    while (movie_play_input(m, vm)) {
+        tick_result res = vm_run_frame(vm);
+        if (res != SUCCESS) printf("error: %s (pc=%#05x, frame %u)\n", tick_result_str(res), vm->pc, m->played);
+#ifdef CHIP8_HAVE_CAPTURE
+        if (video != NULL) capture_frame(video, &vm->fb);
+#endif
+        if (!movie_check_frame(m, vm, &expected)) {
+            printf("MISMATCH after frame %u: hash %016llx, recorded %016llx\n", m->played,
+                   (unsigned long long) screen_hash(&vm->fb), (unsigned long long) expected);
+            if (++mismatches == 10) break;
         }
-        case LOAD_I:
-            vm->i = inst.data;
-            break;
-        case ADD_I:
-            vm->i += vm->reg[inst.reg1];
-            break;
-        case DRAW: {
-            uint8_t x = vm->reg[inst.reg1];
-            uint8_t y = vm->reg[inst.reg2];
-            bool changed = draw_sprite(vm->gfx, x, y, &vm->ram[vm->i], (uint8_t) inst.data);
-            vm->reg[0xF] = changed ? 0x1 : 0x0;
-            break;
+    }
+    double elapsed = (double) (clock() - start) / CLOCKS_PER_SEC;
+#ifdef CHIP8_PROFILE
+    if (profile != NULL) profile_add_time(profile, PROFILE_EMULATION, elapsed);
+#endif
+    printf("frames: %u\n", m->played);
+    printf("checkpoints: %d, %d mismatched\n", m->next_checkpoint, mismatches);
+    printf("seconds: %.6f (%.0fx realtime)\n", elapsed, elapsed > 0 ? m->played / (elapsed * TIMER_HZ) : 0.0);
+    printf("hash: %016llx\n", (unsigned long long) screen_hash(&vm->fb));
+    return mismatches == 0 ? 0 : 3;
+}
+
+#ifdef CHIP8_HAVE_JIT
+/*
+ * Runs the ROM on the interpreter and the JIT side by side in randomly sized
+ * slices, so block boundaries move around, and checks the two VMs agree after
+ * every slice. Both VMs start from the same RNG seed, so RAND agrees too.
+ */
+int vm_run_lockstep(const uint8_t* rom, long rom_size, chip8_mode mode, uint32_t ips, long frames) {
+    static chip8_vm ref, jitted;
+    chip8_jit* jit = jit_new();
+    if (jit == NULL) {
+        puts("ERROR: could not allocate JIT code buffer");
+        return 1;
+    }
+    vm_load_program_mode(&ref, mode, ips, rom, rom_size);
+    vm_load_program_mode(&jitted, mode, ips, rom, rom_size);
+    jit_attach(jit, &jitted);
+    uint32_t slice_seed = 1;
+    uint64_t remaining = (uint64_t) frames * ref.ips / TIMER_HZ;
+    while (remaining > 0) {
+        slice_seed = slice_seed * 1103515245 + 12345;
+        uint32_t slice = 1 + (slice_seed >> 16) % 64;
+        if (slice > remaining) slice = remaining;
+        remaining -= slice;
+        uint16_t pc = ref.pc;
+        tick_result ref_res = vm_run_cycles(&ref, slice);
+        tick_result jit_res = vm_run_cycles(&jitted, slice);
+        const char* diff = vm_state_diff(&ref, &jitted);
+        if (ref_res != jit_res || diff != NULL) {
+            printf("MISMATCH at cycle %llu, %u instructions from pc=%#05x: %s\n",
+                   (unsigned long long) ref.cycles, slice, pc, diff != NULL ? diff : "result");
+            jit_free(jit);
+            return 1;
         }
-        case LOAD_DIGIT_SPRITE:
-            vm->i = DIGIT_BASE_ADDR + DIGIT_LEN * vm->reg[inst.reg1];
-            break;
-        case STORE_BCD: {
-            uint8_t x = vm->reg[inst.reg1];
-            vm->ram[vm->i] = x / 100;
-            vm->ram[vm->i + 1] = (x / 10) % 10;
-            vm->ram[vm->i + 2] = x % 10;
-            break;
+        if (ref_res != SUCCESS) {
+            printf("both stopped: %s (cycle %llu)\n", tick_result_str(ref_res), (unsigned long long) ref.cycles);
+            jit_free(jit);
+            return 0;
         }
-        case SAVE_REG:
-            for (int j = 0; j <= inst.reg1; j++) {
-                vm->ram[vm->i + j] = vm->reg[j];
-            }
-            vm->i += inst.reg1 + 1;
-            break;
-        case RESTORE_REG:
-            for (int j = 0; j <= inst.reg1; j++) {
-                vm->reg[j] = vm->ram[vm->i + j];
-            }
-            vm->i += inst.reg1 + 1;
-            break;
-        case INVALID:
-        default:
-            printf("!!! INVALID INSTRUCTION %#04x !!!", raw_inst);
-            return ERR_INVALID;
     }
-    return SUCCESS;
+    printf("JIT matched the interpreter for %ld frames (%llu cycles)\n", frames, (unsigned long long) ref.cycles);
+    jit_free(jit);
+    return 0;
 }
+#endif
 
-tick_result vm_run_frame(chip8_vm* vm) {
-    tick_result res;
-    for (int i = 0; i < vm->tpu; i++) {
-        res = vm_tick(vm);
-        if (res != SUCCESS) return res;
+/*
+ * Prints the profile and writes its folded stacks when running with --profile, finishes
+ * the --capture file and closes the --debug socket. Returns status, or 1 if the capture couldn't be written,
+ * so it can wrap the final return of a run.
+ */
+int finish_run(chip8_vm* vm, int status) {
+    // Only the profile needs the VM
+    (void) vm;
+#ifdef CHIP8_HAVE_DEBUGGER
+    debug_close(debugger);
+#endif
+#ifdef CHIP8_HAVE_CAPTURE
+    if (video != NULL && !capture_close(video)) {
+        puts("Error writing capture");
+        if (status == 0) status = 1;
+    }
+#endif
+#ifdef CHIP8_PROFILE
+    if (profile != NULL) {
+        profile_report(profile, vm, stdout);
+        if (!profile_write_folded(profile, vm, profile_path)) {
+            printf("Error writing profile to \"%s\"\n", profile_path);
+        }
     }
-    if (vm-> sound > 0) vm->sound--;
-    if (vm->delay > 0) vm->delay--;
-    display_screen(vm->gfx);
-    fps_clock_tick(&vm->clock);
-    return SUCCESS;
+#endif
+    return status;
 }
 
-uint8_t* read_binary_file(char *path, long* size_out) {
-    FILE* file = fopen(path, "rb");
-    if (file == NULL) {
-        printf("Error opening file \"%s\"", path);
-        return NULL;
-    }
-    // Get file size by seeking to the end of the file
-    fseek(file, 0, SEEK_END);
-    long size = ftell(file);
-    rewind(file);
-    uint8_t* buf = malloc(size);
-    fread(buf, sizeof(uint8_t), size, file);
-    if (ferror(file)) return NULL;
-    *size_out = size;
-    return buf;
+void usage(const char* prog) {
+    printf("usage: %s [--ips N] [--seed N] [--headless] [--frames N] [--load-state FILE] [--save-state FILE] ROM\n", prog);
+    printf("       %s [--mode chip8|schip|xochip] ... ROM\n", prog);
+    printf("       %s [--record MOVIE] ... ROM\n", prog);
+    printf("       %s --replay MOVIE ROM\n", prog);
+    printf("       %s --corpus FILE ... NAME|@HASH, or --corpus FILE --replay MOVIE without a ROM\n", prog);
+#ifdef CHIP8_HAVE_SDL
+    printf("       %s [--polls N] [--keymap FILE] [--speed 0.25|0.5|1|2|4|8|16|32|max] [--mute] ... ROM\n", prog);
+#endif
+#ifdef CHIP8_HAVE_JIT
+    printf("       %s [--jit] [--jit-verify] ...\n", prog);
+#endif
+#ifdef CHIP8_PROFILE
+    printf("       %s [--profile FOLDED_FILE] ...\n", prog);
+#endif
+#ifdef CHIP8_HAVE_CAPTURE
+    printf("       %s [--capture FILE.y4m|PATTERN%%05d.png] [--capture-scale N] ...\n", prog);
+#endif
+#ifdef CHIP8_HAVE_DEBUGGER
+    printf("       %s [--debug PORT|SOCKET_PATH] ...\n", prog);
+#endif
 }
 
-void vm_run(chip8_vm* vm) {
-    bool quit = false;
-    SDL_Event e;
-    tick_result res;
-    puts("Starting main loop");
-    while (!quit) {
-        while (SDL_PollEvent(&e) != 0) {
-            if (e.type == SDL_QUIT) {
-                quit = true;
-                break;
+int main(int argc, char *argv[]) {
+    char* rom_path = NULL;
+    bool headless = false;
+    long frames = 600;
+    uint32_t ips = DEFAULT_IPS;
+    uint32_t seed = RNG_SEED;
+    chip8_mode mode = MODE_CHIP8;
+    char* record_path = NULL;
+    char* replay_path = NULL;
+    char* load_state_path = NULL;
+    char* save_state_path = NULL;
+    char* corpus_path = NULL;
+#ifdef CHIP8_HAVE_SDL
+    uint32_t polls = DEFAULT_POLLS;
+    size_t speed = NORMAL_SPEED;
+    bool mute = false;
+    char* keymap_path = NULL;
+#endif
+#ifdef CHIP8_HAVE_JIT
+    bool use_jit = false;
+    bool jit_verify = false;
+#endif
+#ifdef CHIP8_HAVE_CAPTURE
+    char* capture_path = NULL;
+    // Output pixels per display pixel, 0 for the window's size
+    uint32_t capture_scale = 0;
+#endif
+#ifdef CHIP8_HAVE_DEBUGGER
+    char* debug_addr = NULL;
+#endif
+    for (int a = 1; a < argc; a++) {
+        if (strcmp(argv[a], "--headless") == 0) {
+            headless = true;
+        } else if (strcmp(argv[a], "--frames") == 0 && a + 1 < argc) {
+            frames = strtol(argv[++a], NULL, 10);
+        } else if (strcmp(argv[a], "--ips") == 0 && a + 1 < argc) {
+            ips = strtoul(argv[++a], NULL, 10);
+        } else if (strcmp(argv[a], "--seed") == 0 && a + 1 < argc) {
+            seed = strtoul(argv[++a], NULL, 0);
+        } else if (strcmp(argv[a], "--mode") == 0 && a + 1 < argc) {
+            if (!chip8_mode_parse(argv[++a], &mode)) {
+                usage(argv[0]);
+                return 1;
             }
-            if ((e.type == SDL_KEYUP) && vm->waiting_for_keypress) {
-                for (int i = 0; i < 16; i++) {
-                    if (e.key.keysym.scancode == KEYS[i]) {
-                        vm->key_released = &KEYS[i];
-                    }
-                }
+        } else if (strcmp(argv[a], "--record") == 0 && a + 1 < argc) {
+            record_path = argv[++a];
+        } else if (strcmp(argv[a], "--replay") == 0 && a + 1 < argc) {
+            replay_path = argv[++a];
+        } else if (strcmp(argv[a], "--load-state") == 0 && a + 1 < argc) {
+            load_state_path = argv[++a];
+        } else if (strcmp(argv[a], "--save-state") == 0 && a + 1 < argc) {
+            save_state_path = argv[++a];
+        } else if (strcmp(argv[a], "--corpus") == 0 && a + 1 < argc) {
+            corpus_path = argv[++a];
+#ifdef CHIP8_HAVE_SDL
+        } else if (strcmp(argv[a], "--polls") == 0 && a + 1 < argc) {
+            polls = strtoul(argv[++a], NULL, 10);
+            if (polls < 1) polls = 1;
+        } else if (strcmp(argv[a], "--mute") == 0) {
+            mute = true;
+        } else if (strcmp(argv[a], "--speed") == 0 && a + 1 < argc) {
+            if (!parse_speed(argv[++a], &speed)) {
+                usage(argv[0]);
+                return 1;
             }
+        } else if (strcmp(argv[a], "--keymap") == 0 && a + 1 < argc) {
+            keymap_path = argv[++a];
+#endif
+#ifdef CHIP8_PROFILE
+        } else if (strcmp(argv[a], "--profile") == 0 && a + 1 < argc) {
+            profile_path = argv[++a];
+#endif
+#ifdef CHIP8_HAVE_CAPTURE
+        } else if (strcmp(argv[a], "--capture") == 0 && a + 1 < argc) {
+            capture_path = argv[++a];
+        } else if (strcmp(argv[a], "--capture-scale") == 0 && a + 1 < argc) {
+            capture_scale = strtoul(argv[++a], NULL, 10);
+            if (capture_scale < 1) capture_scale = 1;
+#endif
+#ifdef CHIP8_HAVE_DEBUGGER
+        } else if (strcmp(argv[a], "--debug") == 0 && a + 1 < argc) {
+            debug_addr = argv[++a];
+#endif
+#ifdef CHIP8_HAVE_JIT
+        } else if (strcmp(argv[a], "--jit") == 0) {
+            use_jit = true;
+        } else if (strcmp(argv[a], "--jit-verify") == 0) {
+            jit_verify = true;
+#endif
+        } else if (argv[a][0] == '-') {
+            usage(argv[0]);
+            return 1;
+        } else {
+            rom_path = argv[a];
         }
-        res = vm_run_frame(vm);
-        switch (res) {
-            case ERR_INVALID:
-                puts("Invalid instruction!!!");
-                break;
-            case ERR_STACK_OVERFLOW:
-                puts("Stack Overflow!!!");
-                break;
-            case ERR_STACK_UNDERFLOW:
-                puts("Stack Underflow!!!");
-                break;
-            default:
-                break;
+    }
+    movie* replay = NULL;
+    if (replay_path != NULL) {
+        replay = movie_load(replay_path);
+        if (replay == NULL) {
+            printf("Error reading movie \"%s\"\n", replay_path);
+            return 1;
         }
     }
-}
-
-int main(int argc, char *argv[]) {
-    if (argc < 2) {
+    // A movie names its ROM by hash, so with a corpus the ROM can be left out
+    if (rom_path == NULL && (corpus_path == NULL || replay == NULL)) {
         puts("ERROR: ROM path not given");
+        usage(argv[0]);
         return 1;
     }
-    char* rom_path = argv[1];
     long rom_size;
-    uint8_t* rom = read_binary_file(rom_path, &rom_size);
-    if (rom == NULL) {
-        printf("Error reading \"%s\"", rom_path);
+    const uint8_t* rom;
+    if (corpus_path != NULL) {
+        rom_corpus* corpus = corpus_open(corpus_path);
+        if (corpus == NULL) {
+            printf("Error reading corpus \"%s\"\n", corpus_path);
+            return 1;
+        }
+        long found = rom_path != NULL ? corpus_find(corpus, rom_path) : corpus_find_hash(corpus, replay->rom_hash);
+        if (found < 0) {
+            printf("ERROR: \"%s\" is not in the corpus\n", rom_path != NULL ? rom_path : replay_path);
+            return 1;
+        }
+        rom = corpus_rom_data(corpus, (uint32_t) found, &rom_size);
+    } else {
+        rom = read_binary_file(rom_path, &rom_size);
+        if (rom == NULL) {
+            printf("Error reading \"%s\"\n", rom_path);
+            return 1;
+        }
+    }
+    // Replays run in the mode they were recorded in, whatever --mode says
+    if (replay != NULL) mode = replay->mode;
+    if (rom_size > MODE_MAX_ROM_SIZE(mode)) {
+        printf("ERROR: the ROM is %ld bytes, only %d fit in %s memory\n", rom_size, MODE_MAX_ROM_SIZE(mode),
+               chip8_mode_str(mode));
         return 1;
     }
+#ifdef CHIP8_HAVE_JIT
+    if (jit_verify) {
+        return vm_run_lockstep(rom, rom_size, mode, ips, frames);
+    }
+#endif
+    if (replay != NULL) {
+        if (replay->rom_hash != rom_hash(rom, rom_size)) {
+            printf("ERROR: \"%s\" was recorded with a different ROM\n", replay_path);
+            return 1;
+        }
+        ips = replay->ips;
+        seed = replay->seed;
+    }
+    if (record_path != NULL && load_state_path != NULL) {
+        puts("ERROR: a movie has to start from the ROM, not a save state");
+        return 1;
+    }
+    static chip8_vm vm;
+    vm_load_program_mode(&vm, mode, ips, rom, rom_size);
+    vm_seed(&vm, seed);
+#ifdef CHIP8_PROFILE
+    if (profile_path != NULL) {
+        profile = profile_new();
+        vm.profile = profile;
+#ifdef CHIP8_HAVE_JIT
+        // Only the interpreter has profiling hooks
+        if (use_jit) puts("--profile runs on the interpreter, ignoring --jit");
+        use_jit = false;
+#endif
+    }
+#endif
+#ifdef CHIP8_HAVE_JIT
+    if (use_jit) {
+        chip8_jit* jit = jit_new();
+        if (jit == NULL) {
+            puts("ERROR: could not allocate JIT code buffer");
+            return 1;
+        }
+        jit_attach(jit, &vm);
+    }
+#endif
+    if (load_state_path != NULL && !vm_load_state_file(&vm, load_state_path)) {
+        printf("Error loading state from \"%s\"\n", load_state_path);
+        return 1;
+    }
+#ifdef CHIP8_HAVE_CAPTURE
+    if (capture_path != NULL) {
+        // Runs that aren't paced to real time wait for the writer, the window drops frames instead of stalling
+        // Sized for hires on SUPER-CHIP and XO-CHIP, which is the window's size in half as big pixels
+        uint32_t width = mode == MODE_CHIP8 ? SCREEN_WIDTH : FB_MAX_WIDTH;
+        uint32_t height = mode == MODE_CHIP8 ? SCREEN_HEIGHT : FB_MAX_HEIGHT;
+        uint32_t scale_x = capture_scale > 0 ? capture_scale : PIXEL_WIDTH * SCREEN_WIDTH / width;
+        uint32_t scale_y = capture_scale > 0 ? capture_scale : PIXEL_HEIGHT * SCREEN_HEIGHT / height;
+        video = capture_open(capture_path, width * scale_x, height * scale_y, headless || replay != NULL);
+        if (video == NULL) {
+            printf("Error creating capture \"%s\"\n", capture_path);
+            return 1;
+        }
+    }
+#endif
+#ifdef CHIP8_HAVE_DEBUGGER
+    if (debug_addr != NULL) {
+        // Frames the debugger stops part way through would break up a movie's frames
+        if (record_path != NULL || replay != NULL) {
+            puts("ERROR: --debug can't be used with --record or --replay");
+            return 1;
+        }
+        debugger = debug_open(debug_addr);
+        if (debugger == NULL) return 1;
+    }
+#endif
+    if (replay != NULL) {
+        return finish_run(&vm, vm_run_replay(&vm, replay));
+    }
+    if (headless) {
+        // Nothing to poll without a window, so headless movies poll once per frame
+        movie* rec = record_path != NULL ? movie_new(rom, rom_size, seed, mode, vm.ips, 1) : NULL;
+        int status = vm_run_headless(&vm, frames, rec);
+        if (rec != NULL && !movie_save(rec, record_path)) {
+            printf("Error saving movie to \"%s\"\n", record_path);
+            return 1;
+        }
+        if (save_state_path != NULL && !vm_save_state_file(&vm, save_state_path)) {
+            printf("Error saving state to \"%s\"\n", save_state_path);
+            return 1;
+        }
+        return finish_run(&vm, status);
+    }
+#ifdef CHIP8_HAVE_SDL
+    static key_map keys;
+    key_map_default(&keys);
+    if (keymap_path != NULL && !key_map_load(&keys, keymap_path)) {
+        printf("Error reading key map \"%s\"\n", keymap_path);
+        return 1;
+    }
+    movie* rec = record_path != NULL ? movie_new(rom, rom_size, seed, mode, vm.ips, polls) : NULL;
+    // F5/F9 in the window use --save-state if given, otherwise ROM.state
+    char default_state_path[4096];
+    if (save_state_path == NULL) {
+        snprintf(default_state_path, sizeof(default_state_path), "%s.state", rom_path);
+        save_state_path = default_state_path;
+    }
     sdl_handle h = graphics_init();
-    clear_screen(&h);
-    display_screen(&h);
-    chip8_vm vm;
-    vm_load_program(&vm, &h, 700, rom, rom_size);
-    vm_run(&vm);
-    return 0;
+    static sdl_audio audio;
+    bool have_audio = !mute && audio_open(&audio, &vm, polls);
+    vm_run(&vm, &h, save_state_path, rec, &keys, polls, speed, have_audio ? &audio : NULL);
+    if (have_audio) audio_close(&audio);
+    if (rec != NULL && !movie_save(rec, record_path)) {
+        printf("Error saving movie to \"%s\"\n", record_path);
+        return 1;
+    }
+    return finish_run(&vm, 0);
+#else
+    puts("ERROR: built without SDL, only --headless is supported");
+    return 1;
+#endif
 }
@@ -0,0 +1,174 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include "movie.h"
+#include "rom.h"
+
+movie* movie_new(const uint8_t* rom, long rom_len, uint32_t seed, chip8_mode mode, uint32_t ips, uint32_t polls) {
+    movie* m = calloc(1, sizeof(movie));
+    if (m == NULL) return NULL;
+    m->rom_hash = rom_hash(rom, rom_len);
+    m->seed = seed;
+    m->mode = mode;
+    m->ips = ips;
+    m->polls = polls > 0 ? polls : 1;
+    return m;
+}
+
+void movie_free(movie* m) {
+    if (m == NULL) return;
+    free(m->inputs);
+    free(m->checkpoints);
+    free(m);
+}
+
+static void add_input(movie* m, uint32_t poll, uint16_t keys, int8_t released) {
+    if (m->input_len == m->input_cap) {
+        m->input_cap = m->input_cap ? m->input_cap * 2 : 256;
+        m->inputs = realloc(m->inputs, m->input_cap * sizeof(movie_input));
+    }
+    m->inputs[m->input_len].poll = poll;
+    m->inputs[m->input_len].keys = keys;
+    m->inputs[m->input_len].released = released;
+    m->input_len++;
+}
+
+static void add_checkpoint(movie* m, uint32_t frames, uint64_t hash) {
+    if (m->checkpoint_len == m->checkpoint_cap) {
+        m->checkpoint_cap = m->checkpoint_cap ? m->checkpoint_cap * 2 : 256;
+        m->checkpoints = realloc(m->checkpoints, m->checkpoint_cap * sizeof(movie_checkpoint));
+    }
+    m->checkpoints[m->checkpoint_len].frames = frames;
+    m->checkpoints[m->checkpoint_len].hash = hash;
+    m->checkpoint_len++;
+}
+
+void movie_record_input(movie* m, uint16_t keys, int8_t released) {
+    // Only changes are stored, an entry lasts until the next one
+    if (keys != m->keys || released != NO_KEY || m->polled == 0) {
+        add_input(m, m->polled, keys, released);
+        m->keys = keys;
+    }
+    m->polled++;
+}
+
+void movie_record_frame(movie* m, const chip8_vm* vm) {
+    m->frames++;
+    m->last_hash = screen_hash(&vm->fb);
+    if (m->frames % MOVIE_CHECKPOINT_FRAMES == 0) add_checkpoint(m, m->frames, m->last_hash);
+}
+
+bool movie_save(const movie* m, const char* path) {
+    FILE* file = fopen(path, "w");
+    if (file == NULL) return false;
+    fprintf(file, "chip8-movie %d\n", MOVIE_VERSION);
+    fprintf(file, "rom %016" PRIx64 "\n", m->rom_hash);
+    fprintf(file, "seed %" PRIu32 "\n", m->seed);
+    fprintf(file, "mode %s\n", chip8_mode_str(m->mode));
+    fprintf(file, "ips %" PRIu32 "\n", m->ips);
+    fprintf(file, "polls %" PRIu32 "\n", m->polls);
+    fprintf(file, "frames %" PRIu32 "\n", m->frames);
+    // Inputs and checkpoints are interleaved in frame order to keep the file readable
+    int c = 0;
+    for (int k = 0; k < m->input_len; k++) {
+        const movie_input* in = &m->inputs[k];
+        for (; c < m->checkpoint_len && m->checkpoints[c].frames * m->polls <= in->poll; c++) {
+            fprintf(file, "hash %" PRIu32 " %016" PRIx64 "\n", m->checkpoints[c].frames, m->checkpoints[c].hash);
+        }
+        fprintf(file, "keys %" PRIu32 " %04x\n", in->poll, in->keys);
+        if (in->released != NO_KEY) fprintf(file, "release %" PRIu32 " %d\n", in->poll, in->released);
+    }
+    for (; c < m->checkpoint_len; c++) {
+        fprintf(file, "hash %" PRIu32 " %016" PRIx64 "\n", m->checkpoints[c].frames, m->checkpoints[c].hash);
+    }
+    bool final_saved = m->checkpoint_len > 0 && m->checkpoints[m->checkpoint_len - 1].frames == m->frames;
+    if (m->frames > 0 && !final_saved) {
+        fprintf(file, "hash %" PRIu32 " %016" PRIx64 "\n", m->frames, m->last_hash);
+    }
+    return fclose(file) == 0;
+}
+
+movie* movie_load(const char* path) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) return NULL;
+    movie* m = calloc(1, sizeof(movie));
+    if (m != NULL) m->polls = 1;
+    char line[256];
+    int version = -1;
+    bool ok = m != NULL;
+    while (ok && fgets(line, sizeof(line), file) != NULL) {
+        char key[16];
+        uint64_t a, b;
+        int fields = sscanf(line, "%15s %" SCNu64 " %" SCNx64, key, &a, &b);
+        if (fields <= 0 || key[0] == '#') continue;
+        if (strcmp(key, "chip8-movie") == 0 && fields >= 2) {
+            version = (int) a;
+        } else if (strcmp(key, "rom") == 0) {
+            ok = sscanf(line, "rom %" SCNx64, &m->rom_hash) == 1;
+        } else if (strcmp(key, "seed") == 0 && fields >= 2) {
+            m->seed = (uint32_t) a;
+        } else if (strcmp(key, "mode") == 0) {
+            char name[16];
+            ok = sscanf(line, "mode %15s", name) == 1 && chip8_mode_parse(name, &m->mode);
+        } else if (strcmp(key, "ips") == 0 && fields >= 2) {
+            m->ips = (uint32_t) a;
+        } else if (strcmp(key, "polls") == 0 && fields >= 2) {
+            m->polls = (uint32_t) a;
+            ok = m->polls > 0;
+        } else if (strcmp(key, "frames") == 0 && fields >= 2) {
+            m->frames = (uint32_t) a;
+        } else if (strcmp(key, "keys") == 0 && fields == 3) {
+            add_input(m, (uint32_t) a, (uint16_t) b, NO_KEY);
+        } else if (strcmp(key, "release") == 0 && fields >= 2) {
+            int released;
+            ok = sscanf(line, "release %*u %d", &released) == 1 && m->input_len > 0
+                 && m->inputs[m->input_len - 1].poll == a;
+            if (ok) m->inputs[m->input_len - 1].released = (int8_t) (released & 0xF);
+        } else if (strcmp(key, "hash") == 0 && fields == 3) {
+            add_checkpoint(m, (uint32_t) a, b);
+        } else {
+            ok = false;
+        }
+    }
+    fclose(file);
+    if (!ok || version < 1 || version > MOVIE_VERSION) {
+        movie_free(m);
+        return NULL;
+    }
+    return m;
+}
+
+static void movie_poll(void* ctx, chip8_vm* vm, uint32_t part) {
+    movie* m = ctx;
+    (void) part;
+    for (; m->next_input < m->input_len && m->inputs[m->next_input].poll <= m->polled; m->next_input++) {
+        const movie_input* in = &m->inputs[m->next_input];
+        m->keys = in->keys;
+        if (in->released != NO_KEY) vm->key_released = in->released;
+    }
+    vm->keys = m->keys;
+    m->polled++;
+}
+
+bool movie_play_input(movie* m, chip8_vm* vm) {
+    if (m->played >= m->frames) return false;
+    vm->input.ctx = m;
+    vm->input.poll = movie_poll;
+    vm->input.polls_per_frame = m->polls;
+    return true;
+}
+
+bool movie_check_frame(movie* m, const chip8_vm* vm, uint64_t* expected) {
+    m->played++;
+    bool match = true;
+    for (; m->next_checkpoint < m->checkpoint_len && m->checkpoints[m->next_checkpoint].frames <= m->played;
+           m->next_checkpoint++) {
+        const movie_checkpoint* cp = &m->checkpoints[m->next_checkpoint];
+        if (cp->frames == m->played && cp->hash != screen_hash(&vm->fb)) {
+            *expected = cp->hash;
+            match = false;
+        }
+    }
+    return match;
+}
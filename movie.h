@@ -0,0 +1,91 @@
+#ifndef CHIP8_MOVIE_H
+#define CHIP8_MOVIE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "vm.h"
+
+/*
+ * Input movies. A movie records everything a run depends on besides the ROM: the RNG
+ * seed, the instruction set, the CPU speed, the keys seen at each input poll and the keys released for
+ * WAIT_FOR_KEY, plus screen hashes at checkpoints so a replay can tell where it went
+ * off track. Saved as text:
+ *
+ *   chip8-movie 3
+ *   rom <hash of the ROM>
+ *   seed <n>
+ *   mode <chip8|schip|xochip>
+ *   ips <n>
+ *   polls <n>                   input polls per frame
+ *   frames <n>
+ *   keys <poll> <hex mask>      keys held from this poll on, counting frame * polls + part
+ *   release <poll> <key>        key released before this poll while waiting for one
+ *   hash <frames> <hex hash>    screen hash once this many frames have run
+ *
+ * Version 1 files have no polls line and poll once per frame, and versions before 3 have
+ * no mode line and run as plain CHIP-8, so they still load.
+ */
+#define MOVIE_VERSION 3
+#define MOVIE_CHECKPOINT_FRAMES 60
+
+typedef struct {
+    // Input poll the entry starts at, frame * polls + part
+    uint32_t poll;
+    uint16_t keys;
+    int8_t released;
+} movie_input;
+
+typedef struct {
+    uint32_t frames;
+    uint64_t hash;
+} movie_checkpoint;
+
+typedef struct {
+    uint64_t rom_hash;
+    uint32_t seed;
+    chip8_mode mode;
+    uint32_t ips;
+    uint32_t polls;
+    // Length of the movie in frames
+    uint32_t frames;
+    movie_input* inputs;
+    int input_len;
+    int input_cap;
+    movie_checkpoint* checkpoints;
+    int checkpoint_len;
+    int checkpoint_cap;
+    // Screen hash after the last recorded frame, saved as the final checkpoint
+    uint64_t last_hash;
+    // Input polls recorded or played so far
+    uint32_t polled;
+    // Playback position: frames played so far, and the next entries to use
+    uint32_t played;
+    int next_input;
+    int next_checkpoint;
+    uint16_t keys;
+} movie;
+
+movie* movie_new(const uint8_t* rom, long rom_len, uint32_t seed, chip8_mode mode, uint32_t ips, uint32_t polls);
+void movie_free(movie* m);
+bool movie_save(const movie* m, const char* path);
+// Returns NULL if the file can't be read or isn't a movie this version can play
+movie* movie_load(const char* path);
+
+// Recording: call at every input poll, with the keys held and the key released (or NO_KEY)
+void movie_record_input(movie* m, uint16_t keys, int8_t released);
+// Recording: call after running each frame
+void movie_record_frame(movie* m, const chip8_vm* vm);
+
+/*
+ * Playback: call before running each frame. Points vm's input at the movie, which then
+ * hands the VM the recorded keys at each poll. Returns false once every recorded frame
+ * has been played.
+ */
+bool movie_play_input(movie* m, chip8_vm* vm);
+/*
+ * Playback: call after running each frame. Returns false if the screen doesn't match the
+ * checkpoint recorded for this frame, and sets *expected to the recorded hash.
+ */
+bool movie_check_frame(movie* m, const chip8_vm* vm, uint64_t* expected);
+
+#endif
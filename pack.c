@@ -0,0 +1,134 @@
+// nftw is an XSI extension
+#define _XOPEN_SOURCE 700
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ftw.h>
+#include <sys/stat.h>
+#include "vm.h"
+#include "rom.h"
+#include "corpus.h"
+
+/*
+ * chip8_pack builds a packed ROM corpus (see corpus.h) from directories and files.
+ * Files in a directory are named by their path starting at that directory, e.g.
+ * "ROMS/IBM_Logo.ch8" for ROMS or ../ROMS, and files given on the command line by
+ * their file name. Files that are empty or don't fit in memory are
+ * skipped, and --ext keeps only files with that extension.
+ */
+
+typedef struct {
+    corpus_builder* builder;
+    const char* ext;
+    // Length of the path to the parent of the directory being walked, stripped from names
+    size_t root_len;
+    long files;
+    long added;
+    long duplicates;
+    long skipped;
+    long unreadable;
+    long collisions;
+    uint64_t bytes;
+} pack_state;
+
+// nftw has no context argument
+static pack_state pack;
+
+static bool has_ext(const char* path, const char* ext) {
+    size_t len = strlen(path), ext_len = strlen(ext);
+    return len >= ext_len && strcmp(path + len - ext_len, ext) == 0;
+}
+
+static void pack_file(const char* path, const char* name) {
+    if (pack.ext != NULL && !has_ext(path, pack.ext)) return;
+    pack.files++;
+    long len;
+    uint8_t* rom = read_binary_file(path, &len);
+    if (rom == NULL) {
+        fprintf(stderr, "skipping %s: could not read it\n", path);
+        pack.unreadable++;
+        return;
+    }
+    switch (corpus_builder_add(pack.builder, name, rom, len)) {
+        case CORPUS_ADDED:
+            pack.added++;
+            pack.bytes += len;
+            break;
+        case CORPUS_DUPLICATE:
+            pack.duplicates++;
+            break;
+        case CORPUS_BAD_SIZE:
+            pack.skipped++;
+            break;
+        case CORPUS_HASH_COLLISION:
+            fprintf(stderr, "skipping %s: another ROM has the same hash\n", path);
+            pack.collisions++;
+            break;
+    }
+    free(rom);
+}
+
+static int visit(const char* path, const struct stat* st, int type, struct FTW* ftw) {
+    (void) st;
+    (void) ftw;
+    if (type == FTW_F) pack_file(path, path + pack.root_len);
+    return 0;
+}
+
+void usage(const char* prog) {
+    printf("usage: %s [--ext EXT] OUT DIR_OR_FILE...\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+    const char* out_path = NULL;
+    const char** inputs = malloc(argc * sizeof(char*));
+    int input_count = 0;
+    for (int a = 1; a < argc; a++) {
+        if (strcmp(argv[a], "--ext") == 0 && a + 1 < argc) {
+            pack.ext = argv[++a];
+        } else if (argv[a][0] == '-') {
+            usage(argv[0]);
+            return 1;
+        } else if (out_path == NULL) {
+            out_path = argv[a];
+        } else {
+            inputs[input_count++] = argv[a];
+        }
+    }
+    if (out_path == NULL || input_count == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    pack.builder = corpus_builder_new();
+    for (int k = 0; k < input_count; k++) {
+        struct stat st;
+        if (stat(inputs[k], &st) != 0) {
+            fprintf(stderr, "skipping %s: no such file or directory\n", inputs[k]);
+            continue;
+        }
+        if (S_ISDIR(st.st_mode)) {
+            size_t len = strlen(inputs[k]);
+            while (len > 1 && inputs[k][len - 1] == '/') len--;
+            while (len > 0 && inputs[k][len - 1] != '/') len--;
+            pack.root_len = len;
+            nftw(inputs[k], visit, 32, FTW_PHYS);
+        } else {
+            const char* slash = strrchr(inputs[k], '/');
+            pack_file(inputs[k], slash != NULL ? slash + 1 : inputs[k]);
+        }
+    }
+    free(inputs);
+    if (!corpus_builder_write(pack.builder, out_path)) {
+        fprintf(stderr, "Error writing \"%s\"\n", out_path);
+        return 1;
+    }
+    corpus_builder_free(pack.builder);
+    printf("%ld files: %ld ROMs (%llu bytes), %ld duplicates, %ld empty or too big (over %d bytes)",
+           pack.files, pack.added, (unsigned long long) pack.bytes, pack.duplicates, pack.skipped, XO_MAX_ROM_SIZE);
+    if (pack.unreadable > 0) printf(", %ld unreadable", pack.unreadable);
+    if (pack.collisions > 0) printf(", %ld hash collisions", pack.collisions);
+    printf("\n");
+    return 0;
+}
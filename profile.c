@@ -0,0 +1,164 @@
+#include <stdlib.h>
+#include <string.h>
+#include "profile.h"
+
+chip8_profile* profile_new() {
+    chip8_profile* prof = calloc(1, sizeof(chip8_profile));
+    if (prof == NULL) return NULL;
+    // Node 0 is the top level of the program, outside any call
+    prof->node_count = 1;
+    return prof;
+}
+
+void profile_free(chip8_profile* prof) {
+    free(prof);
+}
+
+// Charges the instructions since the last switch to the current stack
+static void profile_switch(chip8_profile* prof, uint64_t now) {
+    prof->nodes[prof->node].self += now - prof->node_start;
+    prof->node_start = now;
+}
+
+void profile_call(chip8_profile* prof, uint16_t target, uint64_t now) {
+    prof->call_counts[target]++;
+    profile_switch(prof, now);
+    if (prof->lost_depth > 0) {
+        prof->lost_depth++;
+        return;
+    }
+    profile_node* current = &prof->nodes[prof->node];
+    if (current->last_child != 0 && current->last_target == target) {
+        prof->node = current->last_child;
+        return;
+    }
+    uint32_t slot = (prof->node * 31u + target) % PROFILE_HASH_SIZE;
+    while (prof->lookup[slot] != 0) {
+        profile_node* n = &prof->nodes[prof->lookup[slot] - 1];
+        if (n->parent == prof->node && n->target == target) {
+            current->last_target = target;
+            current->last_child = prof->lookup[slot] - 1;
+            prof->node = current->last_child;
+            return;
+        }
+        slot = (slot + 1) % PROFILE_HASH_SIZE;
+    }
+    if (prof->node_count == PROFILE_MAX_NODES) {
+        prof->lost_depth = 1;
+        return;
+    }
+    profile_node* n = &prof->nodes[prof->node_count];
+    n->parent = prof->node;
+    n->target = target;
+    n->self = 0;
+    n->last_child = 0;
+    current->last_target = target;
+    current->last_child = (uint16_t) prof->node_count;
+    prof->lookup[slot] = (uint16_t) (prof->node_count + 1);
+    prof->node = (uint16_t) prof->node_count++;
+}
+
+void profile_ret(chip8_profile* prof, uint64_t now) {
+    profile_switch(prof, now);
+    if (prof->lost_depth > 0) {
+        prof->lost_depth--;
+    } else if (prof->node != 0) {
+        prof->node = prof->nodes[prof->node].parent;
+    }
+}
+
+void profile_add_time(chip8_profile* prof, profile_section section, double seconds) {
+    prof->seconds[section] += seconds;
+}
+
+static const uint64_t* sort_counts;
+
+// Sorts indices by descending count
+static int by_count(const void* a, const void* b) {
+    uint64_t x = sort_counts[*(const uint16_t*) a];
+    uint64_t y = sort_counts[*(const uint16_t*) b];
+    return (x < y) - (x > y);
+}
+
+// Fills order with the indices of counts, hottest first, and returns how many are non-zero
+static int sort_by_count(const uint64_t* counts, int len, uint16_t* order) {
+    int used = 0;
+    for (int k = 0; k < len; k++) {
+        if (counts[k] != 0) order[used++] = (uint16_t) k;
+    }
+    sort_counts = counts;
+    qsort(order, used, sizeof(uint16_t), by_count);
+    return used;
+}
+
+static double percent(uint64_t part, uint64_t total) {
+    return total > 0 ? 100.0 * part / total : 0.0;
+}
+
+void profile_report(chip8_profile* prof, const chip8_vm* vm, FILE* out) {
+    static uint16_t order[XO_RAM_SIZE];
+    uint64_t total = 0;
+    for (int k = 0; k < INSTRUCTION_TAG_COUNT; k++) {
+        total += prof->op_counts[k];
+    }
+    profile_switch(prof, vm->cycles - vm->idle_cycles);
+
+    fprintf(out, "=== profile: %llu instructions ===\n", (unsigned long long) total);
+    double host = 0;
+    for (int k = 0; k < PROFILE_SECTION_COUNT; k++) {
+        host += prof->seconds[k];
+    }
+    if (host > 0) {
+        const char* names[PROFILE_SECTION_COUNT] = {"emulation", "display_screen", "fps_clock sleep"};
+        fprintf(out, "host time:\n");
+        for (int k = 0; k < PROFILE_SECTION_COUNT; k++) {
+            fprintf(out, "  %-18s %10.3f s %6.2f%%\n", names[k], prof->seconds[k], 100 * prof->seconds[k] / host);
+        }
+    }
+
+    fprintf(out, "instructions by opcode:\n");
+    int used = sort_by_count(prof->op_counts, INSTRUCTION_TAG_COUNT, order);
+    for (int k = 0; k < used; k++) {
+        uint64_t n = prof->op_counts[order[k]];
+        fprintf(out, "  %-18s %14llu %6.2f%%\n", instruction_tag_str(order[k]), (unsigned long long) n,
+                percent(n, total));
+    }
+
+    fprintf(out, "hottest addresses:\n");
+    used = sort_by_count(prof->pc_counts, XO_RAM_SIZE, order);
+    for (int k = 0; k < used && k < 20; k++) {
+        uint16_t pc = order[k];
+        uint16_t opcode = (uint16_t) (vm->ram[pc] << 8 | vm->ram[(pc + 1) & vm->addr_mask]);
+        uint64_t n = prof->pc_counts[pc];
+        fprintf(out, "  %#05x  %04x %-18s %14llu %6.2f%%\n", pc, opcode,
+                instruction_tag_str(decode_instruction(opcode, vm->mode).tag), (unsigned long long) n, percent(n, total));
+    }
+
+    used = sort_by_count(prof->call_counts, XO_RAM_SIZE, order);
+    if (used > 0) fprintf(out, "call targets:\n");
+    for (int k = 0; k < used && k < 20; k++) {
+        fprintf(out, "  %#05x %14llu calls\n", order[k], (unsigned long long) prof->call_counts[order[k]]);
+    }
+}
+
+// Writes the frames of node, outermost first
+static void write_stack(const chip8_profile* prof, FILE* out, uint16_t node) {
+    if (node == 0) {
+        fputs("main", out);
+        return;
+    }
+    write_stack(prof, out, prof->nodes[node].parent);
+    fprintf(out, ";sub_%03x", prof->nodes[node].target);
+}
+
+bool profile_write_folded(chip8_profile* prof, const chip8_vm* vm, const char* path) {
+    FILE* out = fopen(path, "w");
+    if (out == NULL) return false;
+    profile_switch(prof, vm->cycles - vm->idle_cycles);
+    for (int k = 0; k < prof->node_count; k++) {
+        if (prof->nodes[k].self == 0) continue;
+        write_stack(prof, out, (uint16_t) k);
+        fprintf(out, " %llu\n", (unsigned long long) prof->nodes[k].self);
+    }
+    return fclose(out) == 0;
+}
@@ -0,0 +1,68 @@
+#ifndef CHIP8_PROFILE_H
+#define CHIP8_PROFILE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "vm.h"
+
+/*
+ * Opcode and address profiler. Only built with the CMake option CHIP8_PROFILE; without it
+ * the hooks in the interpreter compile to nothing. The interpreter counts every instruction
+ * by tag and by address. CALL and RET move through a tree of call stacks, and the
+ * instructions run between two of them are charged to the stack that was current, so
+ * stack attribution costs nothing per instruction.
+ */
+
+#define PROFILE_MAX_NODES 4096
+#define PROFILE_HASH_SIZE 8192
+
+typedef enum {
+    PROFILE_EMULATION,
+    PROFILE_DISPLAY,
+    PROFILE_SLEEP,
+    PROFILE_SECTION_COUNT,
+} profile_section;
+
+// A call stack: the stack of its caller plus one more call to target
+typedef struct {
+    uint16_t parent;
+    uint16_t target;
+    // Instructions run with exactly this stack
+    uint64_t self;
+    // The last call made from this stack, to skip the hash lookup when a loop makes the same call
+    uint16_t last_target;
+    uint16_t last_child;
+} profile_node;
+
+struct chip8_profile {
+    uint64_t op_counts[INSTRUCTION_TAG_COUNT];
+    // By address, big enough for the XO-CHIP address space
+    uint64_t pc_counts[XO_RAM_SIZE];
+    uint64_t call_counts[XO_RAM_SIZE];
+    profile_node nodes[PROFILE_MAX_NODES];
+    int node_count;
+    uint16_t node;
+    // Calls made once the node table was full, so the matching returns can be ignored
+    int lost_depth;
+    // Instruction count when node became current
+    uint64_t node_start;
+    // Node id + 1 by hash of (parent, target), 0 for an empty slot
+    uint16_t lookup[PROFILE_HASH_SIZE];
+    // Host time, in seconds
+    double seconds[PROFILE_SECTION_COUNT];
+};
+
+chip8_profile* profile_new();
+void profile_free(chip8_profile* prof);
+// target is already wrapped to the VM's memory; now is the number of instructions run so far,
+// i.e. vm->cycles - vm->idle_cycles
+void profile_call(chip8_profile* prof, uint16_t target, uint64_t now);
+void profile_ret(chip8_profile* prof, uint64_t now);
+void profile_add_time(chip8_profile* prof, profile_section section, double seconds);
+// Text summary: host time split, opcode mix, hottest addresses and call targets
+void profile_report(chip8_profile* prof, const chip8_vm* vm, FILE* out);
+// One "main;sub_206;sub_2a0 count" line per call stack, for flamegraph.pl and friends
+bool profile_write_folded(chip8_profile* prof, const chip8_vm* vm, const char* path);
+
+#endif
@@ -0,0 +1,617 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <string.h>
+#include <ctype.h>
+#include "vm.h"
+#include "rom.h"
+
+/*
+ * chip8_aot translates a ROM into a C file for aot.h. It follows the program's control flow
+ * from 0x200 through jumps, calls, returns and both sides of skips, and resolves BNNN when
+ * the register was loaded with a constant earlier in the same block, or else takes the jumps
+ * in the table BNNN points at. Every address something branches to starts a basic block,
+ * which becomes a label in one big function, with the registers and I kept in locals.
+ *
+ * Instructions that write memory, wait for keys or talk to the audio backend aren't
+ * translated: blocks end before them and aot_step runs them on the interpreter, as it does
+ * code the translation didn't reach.
+ */
+
+#define MAX_BLOCK 64
+
+typedef struct {
+    chip8_mode mode;
+    const uint8_t* rom;
+    uint32_t rom_len;
+    // PROGRAM_START + rom_len
+    uint32_t end;
+    bool visited[XO_RAM_SIZE];
+    bool leader[XO_RAM_SIZE];
+    bool queued[XO_RAM_SIZE];
+    uint16_t work[XO_RAM_SIZE];
+    int work_len;
+    // Instructions in the block starting at each address, 0 for none
+    uint8_t block_len[XO_RAM_SIZE];
+    // Bytes the block was built from, which it checks once the program has written to its code
+    uint16_t block_bytes[XO_RAM_SIZE];
+    uint8_t code_map[XO_RAM_SIZE / 8];
+    // For vm_idle_loop_at
+    chip8_vm vm;
+    FILE* out;
+    long blocks;
+    long translated;
+    long unresolved;
+} translator;
+
+static translator tr;
+
+static bool in_rom(uint32_t addr, uint32_t size) {
+    return addr >= PROGRAM_START && addr + size <= tr.end;
+}
+
+static uint16_t opcode_at(uint32_t addr) {
+    return (uint16_t) (tr.vm.ram[addr & 0xFFFF] << 8 | tr.vm.ram[(addr + 1) & 0xFFFF]);
+}
+
+static instruction decode_at(uint32_t addr) {
+    return decode_instruction(opcode_at(addr), tr.mode);
+}
+
+static uint32_t inst_size(instruction inst) {
+    return inst.tag == LOAD_I_LONG ? 4 : 2;
+}
+
+static bool is_skip(instruction_tag tag) {
+    return tag == SKP_EQ || tag == SKP_NEQ || tag == SKP_EQ_REG || tag == SKP_NEQ_REG
+           || tag == SKP_IF_KEY || tag == SKP_IF_NOT_KEY;
+}
+
+static bool ends_block(instruction_tag tag) {
+    return tag == JMP || tag == JMP_REL || tag == CALL || tag == RET || is_skip(tag);
+}
+
+// Instructions left to aot_step, which keeps vm->cycles exact for the audio backend and tracks writes
+static bool interpreted(instruction_tag tag) {
+    switch (tag) {
+        case WAIT_FOR_KEY:
+        case SET_SOUND:
+        case STORE_BCD:
+        case SAVE_REG:
+        case SAVE_RANGE:
+        case LOAD_PATTERN:
+        case SET_PITCH:
+        case EXIT:
+        case INVALID:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Where a skip goes when it's taken, past all 4 bytes of an XO-CHIP F000 NNNN
+static uint32_t skip_target(uint32_t next) {
+    if (tr.mode == MODE_XOCHIP && opcode_at(next) == 0xF000) return next + 4;
+    return next + 2;
+}
+
+/*
+ * Whether the instruction at addr can be translated, with everything its translation depends
+ * on inside the ROM, so the block's check of its bytes covers it.
+ */
+static bool translatable(uint32_t addr, instruction inst) {
+    if (!in_rom(addr, inst_size(inst)) || interpreted(inst.tag)) return false;
+    return !(is_skip(inst.tag) && tr.mode == MODE_XOCHIP && !in_rom(addr + 2, 2));
+}
+
+static void add_target(uint32_t addr) {
+    addr &= 0xFFFF;
+    if (!in_rom(addr, 2)) return;
+    tr.leader[addr] = true;
+    if (tr.queued[addr]) return;
+    tr.queued[addr] = true;
+    tr.work[tr.work_len++] = (uint16_t) addr;
+}
+
+// Follows what translated code does to the registers, so BNNN can be resolved. -1 is unknown.
+static void track(instruction inst, int known[16]) {
+    switch (inst.tag) {
+        case LOAD:
+            known[inst.reg1] = inst.data;
+            break;
+        case ADD_NUM:
+            if (known[inst.reg1] >= 0) known[inst.reg1] = (known[inst.reg1] + inst.data) & 0xFF;
+            break;
+        case MOV:
+            known[inst.reg1] = known[inst.reg2];
+            break;
+        case ADD_REG:
+        case SUB_REG:
+        case SUB_FROM:
+        case RSHIFT:
+        case LSHIFT:
+            known[0xF] = -1;
+            known[inst.reg1] = -1;
+            break;
+        case AND:
+        case OR:
+        case XOR:
+        case RAND:
+        case STORE_DELAY:
+            known[inst.reg1] = -1;
+            break;
+        case DRAW:
+            known[0xF] = -1;
+            break;
+        case RESTORE_REG:
+        case RESTORE_FLAGS:
+            for (int j = 0; j <= inst.reg1; j++) known[j] = -1;
+            break;
+        case RESTORE_RANGE:
+            for (int j = 0; j < 16; j++) {
+                if ((j >= inst.reg1 && j <= inst.reg2) || (j >= inst.reg2 && j <= inst.reg1)) known[j] = -1;
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+// Adds the jump table BNNN points at: the entries are JMPs, one after the other
+static void add_jump_table(uint32_t base) {
+    add_target(base);
+    for (uint32_t t = base; t < base + 256 && in_rom(t, 2) && decode_at(t).tag == JMP; t += 2) {
+        add_target(t);
+    }
+}
+
+// Walks the code reachable from the start of the program, marking where blocks have to start
+static void discover(void) {
+    add_target(PROGRAM_START);
+    while (tr.work_len > 0) {
+        uint32_t addr = tr.work[--tr.work_len];
+        int known[16];
+        for (int r = 0; r < 16; r++) known[r] = -1;
+        // Code is traced once, from wherever got there first
+        while (in_rom(addr, 2) && !tr.visited[addr]) {
+            tr.visited[addr] = true;
+            instruction inst = decode_at(addr);
+            uint32_t next = addr + inst_size(inst);
+            if (inst.tag == JMP) {
+                add_target(inst.data);
+            } else if (inst.tag == CALL) {
+                add_target(inst.data);
+                add_target(next);
+            } else if (inst.tag == JMP_REL) {
+                if (known[inst.reg1] >= 0) {
+                    add_target(inst.data + known[inst.reg1]);
+                } else {
+                    add_jump_table(inst.data);
+                }
+            } else if (is_skip(inst.tag)) {
+                add_target(next);
+                add_target(skip_target(next));
+            } else if (inst.tag == RET || inst.tag == EXIT || inst.tag == INVALID) {
+                // Nowhere known to go next
+            } else if (interpreted(inst.tag)) {
+                add_target(next);
+            } else {
+                track(inst, known);
+                addr = next;
+                continue;
+            }
+            break;
+        }
+    }
+}
+
+static void mark_code(uint32_t addr, uint32_t len) {
+    for (uint32_t k = addr; k < addr + len; k++) {
+        uint32_t offset = k - PROGRAM_START;
+        tr.code_map[offset >> 3] |= (uint8_t) (1 << (offset & 7));
+    }
+}
+
+/*
+ * Decides where every block ends, in address order so a block cut off at MAX_BLOCK
+ * instructions can make the rest a block of its own.
+ */
+static void plan_blocks(void) {
+    for (uint32_t start = PROGRAM_START; start < tr.end; start++) {
+        if (!tr.leader[start] || vm_idle_loop_at(&tr.vm, (uint16_t) start)) continue;
+        uint32_t addr = start;
+        uint32_t count = 0;
+        uint32_t bytes_end = start;
+        while (true) {
+            instruction inst = decode_at(addr);
+            if ((count > 0 && tr.leader[addr]) || !translatable(addr, inst)) break;
+            if (count == MAX_BLOCK) {
+                tr.leader[addr] = true;
+                break;
+            }
+            uint32_t next = addr + inst_size(inst);
+            count++;
+            bytes_end = next;
+            // The instruction a skip may step over decides where it lands on XO-CHIP
+            if (is_skip(inst.tag) && tr.mode == MODE_XOCHIP) bytes_end = next + 2;
+            addr = next;
+            if (ends_block(inst.tag)) break;
+        }
+        if (count == 0) continue;
+        tr.block_len[start] = (uint8_t) count;
+        tr.block_bytes[start] = (uint16_t) (bytes_end - start);
+        mark_code(start, bytes_end - start);
+        tr.blocks++;
+        tr.translated += count;
+    }
+}
+
+static void out(const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    vfprintf(tr.out, fmt, args);
+    va_end(args);
+    fputc('\n', tr.out);
+}
+
+// Writes a jump to addr: straight to its block if it has one, else through aot_step
+static void emit_goto(const char* indent, uint32_t addr) {
+    addr &= 0xFFFF;
+    if (tr.block_len[addr] > 0) {
+        out("%sgoto b_%04x;", indent, addr);
+    } else {
+        out("%svm->pc = 0x%04x;", indent, addr);
+        out("%sgoto slow;", indent);
+    }
+}
+
+// The instruction at index j of a k instruction block fails; it isn't counted, like in vm_execute
+static void emit_error(const char* cond, uint32_t j, uint32_t k, uint32_t next, const char* result) {
+    out("    if (%s) {", cond);
+    out("        SYNC_OUT();");
+    out("        vm->cycles -= %u;", k - j);
+    out("        vm->pc = 0x%04x;", next & 0xFFFF);
+    out("        return %s;", result);
+    out("    }");
+}
+
+static void emit_skip(instruction inst, uint32_t next) {
+    char cond[64];
+    // A register compared with itself always skips, or never does
+    if ((inst.tag == SKP_EQ_REG || inst.tag == SKP_NEQ_REG) && inst.reg1 == inst.reg2) {
+        emit_goto("    ", inst.tag == SKP_EQ_REG ? skip_target(next) : next);
+        return;
+    }
+    switch (inst.tag) {
+        case SKP_EQ:
+            snprintf(cond, sizeof(cond), "v%x == 0x%02x", inst.reg1, inst.data);
+            break;
+        case SKP_NEQ:
+            snprintf(cond, sizeof(cond), "v%x != 0x%02x", inst.reg1, inst.data);
+            break;
+        case SKP_EQ_REG:
+            snprintf(cond, sizeof(cond), "v%x == v%x", inst.reg1, inst.reg2);
+            break;
+        case SKP_NEQ_REG:
+            snprintf(cond, sizeof(cond), "v%x != v%x", inst.reg1, inst.reg2);
+            break;
+        case SKP_IF_KEY:
+            snprintf(cond, sizeof(cond), "(vm->keys >> (v%x & 0xF)) & 1", inst.reg1);
+            break;
+        default:
+            snprintf(cond, sizeof(cond), "!((vm->keys >> (v%x & 0xF)) & 1)", inst.reg1);
+            break;
+    }
+    out("    if (%s) {", cond);
+    emit_goto("        ", skip_target(next));
+    out("    }");
+    emit_goto("    ", next);
+}
+
+static void emit_block(uint32_t start) {
+    uint32_t k = tr.block_len[start];
+    int known[16];
+    for (int r = 0; r < 16; r++) known[r] = -1;
+    out("b_%04x:", start);
+    out("    BLOCK(0x%04x, %u, %u);", start, k, tr.block_bytes[start]);
+    uint32_t addr = start;
+    for (uint32_t j = 0; j < k; j++) {
+        instruction inst = decode_at(addr);
+        uint32_t next = addr + inst_size(inst);
+        uint8_t x = inst.reg1, y = inst.reg2;
+        out("    // %04x: %04x %s", addr, opcode_at(addr), instruction_tag_str(inst.tag));
+        switch (inst.tag) {
+            case CLEAR:
+                out("    clear_planes(&vm->fb, vm->planes);");
+                break;
+            case LOAD:
+                out("    v%x = 0x%02x;", x, inst.data);
+                break;
+            case MOV:
+                out("    v%x = v%x;", x, y);
+                break;
+            case ADD_NUM:
+                out("    v%x += 0x%02x;", x, inst.data);
+                break;
+            case ADD_REG:
+                out("    { unsigned sum = v%x + v%x; vf = sum > 0xFF; v%x = (uint8_t) sum; }", x, y, x);
+                break;
+            case SUB_REG:
+                out("    { uint8_t x = v%x, y = v%x; vf = x > y; v%x = x - y; }", x, y, x);
+                break;
+            case SUB_FROM:
+                out("    { uint8_t x = v%x, y = v%x; vf = y > x; v%x = y - x; }", x, y, x);
+                break;
+            case AND:
+                out("    v%x &= v%x;", x, y);
+                break;
+            case OR:
+                out("    v%x |= v%x;", x, y);
+                break;
+            case XOR:
+                out("    v%x ^= v%x;", x, y);
+                break;
+            case RSHIFT:
+                out("    { uint8_t y = v%x; v%x = y >> 1; vf = y & 1; }", y, x);
+                break;
+            case LSHIFT:
+                out("    { uint8_t y = v%x; v%x = y << 1; vf = y >> 7; }", y, x);
+                break;
+            case RAND:
+                out("    v%x = rand_byte(vm) & 0x%02x;", x, inst.data);
+                break;
+            case LOAD_I:
+                out("    i = 0x%03x;", inst.data);
+                break;
+            case LOAD_I_LONG:
+                out("    i = 0x%04x;", opcode_at(addr + 2));
+                break;
+            case ADD_I:
+                out("    i += v%x;", x);
+                break;
+            case LOAD_DIGIT_SPRITE:
+                out("    i = DIGIT_BASE_ADDR + DIGIT_LEN * v%x;", x);
+                break;
+            case LOAD_BIG_DIGIT_SPRITE:
+                out("    i = BIG_DIGIT_BASE_ADDR + BIG_DIGIT_LEN * (v%x & 0xF);", x);
+                break;
+            case SET_DELAY:
+                out("    vm->delay = v%x;", x);
+                break;
+            case STORE_DELAY:
+                out("    v%x = vm->delay;", x);
+                break;
+            case DRAW:
+                out("    vf = vm_draw(vm, v%x, v%x, i, %u);", x, y, inst.data);
+                break;
+            case RESTORE_REG:
+                for (int r = 0; r <= x; r++) {
+                    out("    v%x = vm->ram[(i + %d) & 0x%x];", r, r, tr.vm.addr_mask);
+                }
+                // SUPER-CHIP leaves I where it was
+                if (tr.mode != MODE_SCHIP) out("    i += %d;", x + 1);
+                break;
+            case RESTORE_RANGE: {
+                int step = x <= y ? 1 : -1;
+                for (int n = 0, r = x; ; n++, r += step) {
+                    out("    v%x = vm->ram[(i + %d) & 0x%x];", r, n, tr.vm.addr_mask);
+                    if (r == y) break;
+                }
+                break;
+            }
+            case SAVE_FLAGS:
+                for (int r = 0; r <= x; r++) out("    vm->flags[%d] = v%x;", r, r);
+                break;
+            case RESTORE_FLAGS:
+                for (int r = 0; r <= x; r++) out("    v%x = vm->flags[%d];", r, r);
+                break;
+            case SCROLL_DOWN:
+                out("    scroll_down(&vm->fb, vm->planes, %u);", inst.data);
+                break;
+            case SCROLL_UP:
+                out("    scroll_up(&vm->fb, vm->planes, %u);", inst.data);
+                break;
+            case SCROLL_RIGHT:
+                out("    scroll_right(&vm->fb, vm->planes, 4);");
+                break;
+            case SCROLL_LEFT:
+                out("    scroll_left(&vm->fb, vm->planes, 4);");
+                break;
+            case LORES:
+                out("    set_screen_size(&vm->fb, SCREEN_WIDTH, SCREEN_HEIGHT);");
+                break;
+            case HIRES:
+                out("    set_screen_size(&vm->fb, FB_MAX_WIDTH, FB_MAX_HEIGHT);");
+                break;
+            case SELECT_PLANES:
+                out("    vm->planes = 0x%x;", x & ALL_PLANES);
+                break;
+            case JMP:
+                emit_goto("    ", inst.data);
+                break;
+            case JMP_REL:
+                if (known[x] >= 0) {
+                    emit_goto("    ", inst.data + known[x]);
+                } else {
+                    out("    vm->pc = (uint16_t) (0x%03x + v%x);", inst.data, x);
+                    out("    goto dispatch;");
+                    tr.unresolved++;
+                }
+                break;
+            case CALL:
+                emit_error("vm->stack.ptr == 255", j, k, next, "ERR_STACK_OVERFLOW");
+                out("    vm->stack.stack[vm->stack.ptr++] = 0x%04x;", next & 0xFFFF);
+                emit_goto("    ", inst.data);
+                break;
+            case RET:
+                emit_error("vm->stack.ptr == 0", j, k, next, "ERR_STACK_UNDERFLOW");
+                out("    vm->pc = vm->stack.stack[--vm->stack.ptr];");
+                out("    goto dispatch;");
+                break;
+            default:
+                emit_skip(inst, next);
+                break;
+        }
+        track(inst, known);
+        addr = next;
+        // Blocks that don't end in a branch run into the next block, or into code left to the interpreter
+        if (j == k - 1 && !ends_block(inst.tag)) emit_goto("    ", addr);
+    }
+}
+
+static void emit_bytes(const char* name, const uint8_t* bytes, uint32_t len) {
+    fprintf(tr.out, "static const uint8_t %s[%u] = {", name, len);
+    for (uint32_t k = 0; k < len; k++) {
+        fprintf(tr.out, "%s0x%02x,", k % 16 == 0 ? "\n    " : " ", bytes[k]);
+    }
+    out("\n};");
+    out("");
+}
+
+static void emit_program(const char* name, const char* rom_path) {
+    static const char* MODE_MACROS[] = {"MODE_CHIP8", "MODE_SCHIP", "MODE_XOCHIP"};
+    out("// Generated by chip8_aot from %s (%u bytes, %s mode). Regenerate it rather than editing it.",
+        rom_path, tr.rom_len, chip8_mode_str(tr.mode));
+    out("#include \"aot.h\"");
+    out("");
+    emit_bytes("rom", tr.rom, tr.rom_len);
+    emit_bytes("code_map", tr.code_map, (tr.rom_len + 7) / 8);
+    out("#define SYNC_OUT() do { \\");
+    for (int r = 0; r < 16; r++) out("        vm->reg[0x%x] = v%x; \\", r, r);
+    out("        vm->i = i; \\");
+    out("    } while (0)");
+    out("#define SYNC_IN() do { \\");
+    for (int r = 0; r < 16; r++) out("        v%x = vm->reg[0x%x]; \\", r, r);
+    out("        i = vm->i; \\");
+    out("    } while (0)");
+    out("// Runs the block at addr if there's budget for all of it and its bytes are still the ones translated");
+    out("#define BLOCK(addr, count, len) \\");
+    out("    if (budget < (count) || (aot->modified && !aot_intact(aot, vm, addr, len))) { \\");
+    out("        vm->pc = (addr); \\");
+    out("        goto slow; \\");
+    out("    } \\");
+    out("    budget -= (count); \\");
+    out("    vm->cycles += (count)");
+    out("");
+    out("static tick_result execute(chip8_aot* aot, chip8_vm* vm, uint32_t n) {");
+    out("    uint32_t budget = n;");
+    out("    tick_result res;");
+    fprintf(tr.out, "    uint8_t");
+    for (int r = 0; r < 16; r++) fprintf(tr.out, " v%x%s", r, r < 15 ? "," : ";\n");
+    out("    uint16_t i;");
+    out("    SYNC_IN();");
+    out("dispatch:");
+    out("    switch (vm->pc) {");
+    for (uint32_t addr = PROGRAM_START; addr < tr.end; addr++) {
+        if (tr.block_len[addr] > 0) out("        case 0x%04x: goto b_%04x;", addr, addr);
+    }
+    out("        default: goto slow;");
+    out("    }");
+    out("slow:");
+    out("    SYNC_OUT();");
+    out("    if (budget == 0) return SUCCESS;");
+    out("    res = aot_step(aot, vm, &budget);");
+    out("    if (res != SUCCESS) return res;");
+    out("    SYNC_IN();");
+    out("    goto dispatch;");
+    for (uint32_t addr = PROGRAM_START; addr < tr.end; addr++) {
+        if (tr.block_len[addr] == 0) continue;
+        emit_block(addr);
+    }
+    out("}");
+    out("");
+    out("const chip8_aot_program %s = {\"%s\", %s, rom, %u, code_map, execute};", name, name,
+        MODE_MACROS[tr.mode], tr.rom_len);
+    out("");
+    out("#ifdef CHIP8_AOT_MAIN");
+    out("int main(int argc, char* argv[]) {");
+    out("    return aot_main(&%s, argc, argv);", name);
+    out("}");
+    out("#endif");
+}
+
+// "aot_" and the ROM's file name, with anything that can't be in a C identifier made a _
+static void default_name(const char* path, char* name, size_t size) {
+    const char* base = strrchr(path, '/');
+    base = base != NULL ? base + 1 : path;
+    size_t n = (size_t) snprintf(name, size, "aot_%s", base);
+    char* dot = strrchr(name, '.');
+    if (dot != NULL && dot > name + 4) *dot = '\0';
+    for (size_t k = 0; k < n && name[k] != '\0'; k++) {
+        if (!isalnum((unsigned char) name[k])) name[k] = '_';
+    }
+}
+
+void usage(const char* prog) {
+    printf("usage: %s [--mode chip8|schip|xochip] [--name NAME] [-o OUT.c] ROM\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+    const char* rom_path = NULL;
+    const char* out_path = NULL;
+    const char* name = NULL;
+    chip8_mode mode = MODE_CHIP8;
+    for (int a = 1; a < argc; a++) {
+        if (strcmp(argv[a], "--mode") == 0 && a + 1 < argc) {
+            if (!chip8_mode_parse(argv[++a], &mode)) {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[a], "--name") == 0 && a + 1 < argc) {
+            name = argv[++a];
+        } else if (strcmp(argv[a], "-o") == 0 && a + 1 < argc) {
+            out_path = argv[++a];
+        } else if (argv[a][0] == '-' || rom_path != NULL) {
+            usage(argv[0]);
+            return 1;
+        } else {
+            rom_path = argv[a];
+        }
+    }
+    if (rom_path == NULL) {
+        usage(argv[0]);
+        return 1;
+    }
+    long rom_size;
+    uint8_t* rom = read_binary_file(rom_path, &rom_size);
+    if (rom == NULL) {
+        printf("Error reading \"%s\"\n", rom_path);
+        return 1;
+    }
+    if (rom_size == 0 || rom_size > MODE_MAX_ROM_SIZE(mode)) {
+        printf("ERROR: the ROM is %ld bytes, between 1 and %d fit in %s memory\n", rom_size,
+               MODE_MAX_ROM_SIZE(mode), chip8_mode_str(mode));
+        return 1;
+    }
+    char default_buf[256];
+    if (name == NULL) {
+        default_name(rom_path, default_buf, sizeof(default_buf));
+        name = default_buf;
+    }
+    tr.mode = mode;
+    tr.rom = rom;
+    tr.rom_len = (uint32_t) rom_size;
+    tr.end = PROGRAM_START + tr.rom_len;
+    vm_load_program_mode(&tr.vm, mode, DEFAULT_IPS, rom, (int) rom_size);
+    discover();
+    plan_blocks();
+
+    tr.out = out_path != NULL ? fopen(out_path, "w") : stdout;
+    if (tr.out == NULL) {
+        printf("Error writing \"%s\"\n", out_path);
+        return 1;
+    }
+    emit_program(name, rom_path);
+    bool ok = !ferror(tr.out);
+    if (out_path != NULL && fclose(tr.out) != 0) ok = false;
+    if (!ok) {
+        fprintf(stderr, "Error writing \"%s\"\n", out_path != NULL ? out_path : "stdout");
+        return 1;
+    }
+    fprintf(stderr, "%s: %ld blocks, %ld instructions translated, %ld computed jumps left to dispatch\n",
+            name, tr.blocks, tr.translated, tr.unresolved);
+    free(rom);
+    return 0;
+}
@@ -0,0 +1,35 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include "rom.h"
+
+uint8_t* read_binary_file(const char* path, long* size_out) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) return NULL;
+    // Get file size by seeking to the end of the file
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    rewind(file);
+    uint8_t* buf = malloc(size > 0 ? size : 1);
+    if (buf == NULL || size < 0) {
+        free(buf);
+        fclose(file);
+        return NULL;
+    }
+    if (fread(buf, sizeof(uint8_t), size, file) != (size_t) size) {
+        free(buf);
+        fclose(file);
+        return NULL;
+    }
+    fclose(file);
+    *size_out = size;
+    return buf;
+}
+
+uint64_t rom_hash(const uint8_t* rom, long len) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (long k = 0; k < len; k++) {
+        hash ^= rom[k];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
@@ -0,0 +1,11 @@
+#ifndef CHIP8_ROM_H
+#define CHIP8_ROM_H
+
+#include <stdint.h>
+
+// Reads a whole file into a malloc'd buffer. Returns NULL if it can't be read.
+uint8_t* read_binary_file(const char* path, long* size_out);
+// 64-bit FNV-1a of a ROM's bytes. Movies and ROM corpora identify ROMs by it.
+uint64_t rom_hash(const uint8_t* rom, long len);
+
+#endif
@@ -0,0 +1,320 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "savestate.h"
+
+typedef struct {
+    uint8_t* p;
+} writer;
+
+typedef struct {
+    const uint8_t* p;
+} reader;
+
+static void put8(writer* w, uint8_t v) {
+    *w->p++ = v;
+}
+
+static void put16(writer* w, uint16_t v) {
+    put8(w, v & 0xFF);
+    put8(w, v >> 8);
+}
+
+static void put32(writer* w, uint32_t v) {
+    put16(w, v & 0xFFFF);
+    put16(w, v >> 16);
+}
+
+static void put64(writer* w, uint64_t v) {
+    put32(w, v & 0xFFFFFFFF);
+    put32(w, v >> 32);
+}
+
+static void put_bytes(writer* w, const uint8_t* src, size_t len) {
+    memcpy(w->p, src, len);
+    w->p += len;
+}
+
+static uint8_t get8(reader* r) {
+    return *r->p++;
+}
+
+static uint16_t get16(reader* r) {
+    uint16_t lo = get8(r);
+    return lo | (uint16_t) get8(r) << 8;
+}
+
+static uint32_t get32(reader* r) {
+    uint32_t lo = get16(r);
+    return lo | (uint32_t) get16(r) << 16;
+}
+
+static uint64_t get64(reader* r) {
+    uint64_t lo = get32(r);
+    return lo | (uint64_t) get32(r) << 32;
+}
+
+static void get_bytes(reader* r, uint8_t* dst, size_t len) {
+    memcpy(dst, r->p, len);
+    r->p += len;
+}
+
+void vm_save_state(const chip8_vm* vm, uint8_t state[SAVESTATE_SIZE]) {
+    writer w = {state};
+    put_bytes(&w, (const uint8_t*) SAVESTATE_MAGIC, 4);
+    put32(&w, SAVESTATE_VERSION);
+    put8(&w, vm->mode);
+    // All of XO-CHIP's memory, whatever the mode, so every state has the same size
+    put_bytes(&w, vm->ram, XO_RAM_SIZE);
+    put_bytes(&w, vm->reg, 16);
+    put16(&w, vm->i);
+    put16(&w, vm->pc);
+    put32(&w, vm->ips);
+    put32(&w, vm->timer_acc);
+    put8(&w, vm->delay);
+    put8(&w, vm->sound);
+    put8(&w, vm->waiting_for_keypress);
+    put8(&w, (uint8_t) vm->key_released);
+    put8(&w, vm->stack.ptr);
+    for (int k = 0; k < 256; k++) {
+        put16(&w, vm->stack.stack[k]);
+    }
+    put64(&w, vm->cycles);
+    put32(&w, vm->rng);
+    put16(&w, vm->fb.width);
+    put16(&w, vm->fb.height);
+    for (int p = 0; p < FB_PLANES; p++) {
+        for (int y = 0; y < FB_MAX_HEIGHT; y++) {
+            for (int x = 0; x < FB_ROW_WORDS; x++) {
+                put64(&w, vm->fb.planes[p][y][x]);
+            }
+        }
+    }
+    put8(&w, vm->planes);
+    put_bytes(&w, vm->flags, FLAG_COUNT);
+    put8(&w, vm->pitch);
+    put_bytes(&w, vm->pattern, PATTERN_BYTES);
+}
+
+// Where the screen size is in a state: after the header, memory, registers, timers, keys, stack, cycles and rng
+#define SCREEN_SIZE_OFFSET (4 + 4 + 1 + XO_RAM_SIZE + 16 + 2 + 2 + 4 + 4 + 5 + 256 * 2 + 8 + 4)
+
+// Only the display sizes the mode can switch to, which everything that uses the screen relies on
+static bool valid_screen_size(chip8_mode mode, const uint8_t* state) {
+    reader r = {state + SCREEN_SIZE_OFFSET};
+    uint16_t width = get16(&r);
+    uint16_t height = get16(&r);
+    if (width == SCREEN_WIDTH && height == SCREEN_HEIGHT) return true;
+    return mode != MODE_CHIP8 && width == FB_MAX_WIDTH && height == FB_MAX_HEIGHT;
+}
+
+bool vm_load_state(chip8_vm* vm, const uint8_t* state, size_t len) {
+    reader r = {state};
+    if (len != SAVESTATE_SIZE || memcmp(state, SAVESTATE_MAGIC, 4) != 0) return false;
+    r.p += 4;
+    if (get32(&r) != SAVESTATE_VERSION) return false;
+    chip8_mode mode = (chip8_mode) get8(&r);
+    if ((unsigned) mode >= CHIP8_MODE_COUNT) return false;
+    if (!valid_screen_size(mode, state)) return false;
+    vm->mode = mode;
+    vm->addr_mask = mode == MODE_XOCHIP ? XO_RAM_SIZE - 1 : RAM_SIZE - 1;
+    get_bytes(&r, vm->ram, XO_RAM_SIZE);
+    get_bytes(&r, vm->reg, 16);
+    vm->i = get16(&r);
+    vm->pc = get16(&r);
+    vm->ips = get32(&r);
+    if (vm->ips == 0) vm->ips = DEFAULT_IPS;
+    vm->timer_acc = get32(&r) % vm->ips;
+    vm->delay = get8(&r);
+    vm->sound = get8(&r);
+    vm->waiting_for_keypress = get8(&r) != 0;
+    vm->key_released = (int8_t) get8(&r);
+    vm->stack.ptr = get8(&r);
+    for (int k = 0; k < 256; k++) {
+        vm->stack.stack[k] = get16(&r);
+    }
+    vm->cycles = get64(&r);
+    vm->rng = get32(&r);
+    vm->fb.width = get16(&r);
+    vm->fb.height = get16(&r);
+    for (int p = 0; p < FB_PLANES; p++) {
+        for (int y = 0; y < FB_MAX_HEIGHT; y++) {
+            for (int x = 0; x < FB_ROW_WORDS; x++) {
+                vm->fb.planes[p][y][x] = get64(&r);
+            }
+        }
+    }
+    vm->fb.dirty_rows = ALL_ROWS_DIRTY;
+    vm->planes = get8(&r) & ALL_PLANES;
+    get_bytes(&r, vm->flags, FLAG_COUNT);
+    vm->pitch = get8(&r);
+    get_bytes(&r, vm->pattern, PATTERN_BYTES);
+    // Everything derived from the old memory is stale now
+    for (int k = 0; k < ICACHE_SIZE; k++) {
+        vm->icache[k].tag = UNDECODED;
+    }
+    if (vm->engine.flush != NULL) vm->engine.flush(vm->engine.ctx);
+    return true;
+}
+
+bool vm_save_state_file(const chip8_vm* vm, const char* path) {
+    uint8_t state[SAVESTATE_SIZE];
+    vm_save_state(vm, state);
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) return false;
+    bool ok = fwrite(state, 1, SAVESTATE_SIZE, file) == SAVESTATE_SIZE;
+    if (fclose(file) != 0) ok = false;
+    return ok;
+}
+
+bool vm_load_state_file(chip8_vm* vm, const char* path) {
+    uint8_t state[SAVESTATE_SIZE];
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) return false;
+    size_t len = fread(state, 1, SAVESTATE_SIZE, file);
+    // A longer file isn't a save state of this version either
+    if (fgetc(file) != EOF) len = 0;
+    fclose(file);
+    return vm_load_state(vm, state, len);
+}
+
+static size_t put_varint(uint8_t* out, size_t v) {
+    size_t n = 0;
+    while (v >= 0x80) {
+        out[n++] = (uint8_t) (v | 0x80);
+        v >>= 7;
+    }
+    out[n++] = (uint8_t) v;
+    return n;
+}
+
+static size_t get_varint(const uint8_t* in, size_t* v) {
+    size_t n = 0;
+    int shift = 0;
+    *v = 0;
+    do {
+        *v |= (size_t) (in[n] & 0x7F) << shift;
+        shift += 7;
+    } while (in[n++] & 0x80);
+    return n;
+}
+
+/*
+ * Encodes a XOR b as alternating runs: a varint count of zero bytes, a varint count of
+ * literal bytes, then the literal bytes. Returns the encoded length.
+ */
+static size_t delta_encode(const uint8_t* a, const uint8_t* b, uint8_t* out) {
+    size_t n = 0, k = 0;
+    while (k < SAVESTATE_SIZE) {
+        size_t zeros_start = k;
+        while (k < SAVESTATE_SIZE && a[k] == b[k]) k++;
+        size_t literal_start = k;
+        while (k < SAVESTATE_SIZE && a[k] != b[k]) k++;
+        n += put_varint(out + n, literal_start - zeros_start);
+        n += put_varint(out + n, k - literal_start);
+        for (size_t j = literal_start; j < k; j++) {
+            out[n++] = a[j] ^ b[j];
+        }
+    }
+    return n;
+}
+
+// XORs an encoded delta into state
+static void delta_apply(uint8_t* state, const uint8_t* delta, size_t len) {
+    size_t n = 0, k = 0;
+    while (n < len) {
+        size_t zeros, literals;
+        n += get_varint(delta + n, &zeros);
+        n += get_varint(delta + n, &literals);
+        k += zeros;
+        for (size_t j = 0; j < literals; j++) {
+            state[k++] ^= delta[n++];
+        }
+    }
+}
+
+rewind_buffer* rewind_new(size_t capacity) {
+    rewind_buffer* rw = malloc(sizeof(rewind_buffer));
+    if (rw == NULL) return NULL;
+    rw->ring = malloc(capacity);
+    if (rw->ring == NULL) {
+        free(rw);
+        return NULL;
+    }
+    rw->capacity = capacity;
+    rw->start = 0;
+    rw->end = 0;
+    rw->used = 0;
+    rw->frames = 0;
+    rw->has_current = false;
+    return rw;
+}
+
+void rewind_free(rewind_buffer* rw) {
+    if (rw == NULL) return;
+    free(rw->ring);
+    free(rw);
+}
+
+static void ring_write(rewind_buffer* rw, size_t at, const uint8_t* src, size_t len) {
+    size_t first = rw->capacity - at < len ? rw->capacity - at : len;
+    memcpy(rw->ring + at, src, first);
+    memcpy(rw->ring, src + first, len - first);
+}
+
+static void ring_read(const rewind_buffer* rw, size_t at, uint8_t* dst, size_t len) {
+    size_t first = rw->capacity - at < len ? rw->capacity - at : len;
+    memcpy(dst, rw->ring + at, first);
+    memcpy(dst + first, rw->ring, len - first);
+}
+
+static uint32_t ring_read32(const rewind_buffer* rw, size_t at) {
+    uint8_t b[4];
+    ring_read(rw, at % rw->capacity, b, 4);
+    return b[0] | (uint32_t) b[1] << 8 | (uint32_t) b[2] << 16 | (uint32_t) b[3] << 24;
+}
+
+/*
+ * Records are framed as [length][delta][length], with 32 bit little endian lengths,
+ * so the oldest can be dropped from the front and the newest popped from the back.
+ */
+void rewind_push(rewind_buffer* rw, const chip8_vm* vm) {
+    uint8_t state[SAVESTATE_SIZE];
+    vm_save_state(vm, state);
+    if (rw->has_current) {
+        size_t len = delta_encode(rw->current, state, rw->scratch);
+        size_t record = len + 8;
+        if (record > rw->capacity) {
+            rw->start = rw->end = rw->used = 0;
+            rw->frames = 0;
+        } else {
+            while (rw->used + record > rw->capacity) {
+                size_t oldest = ring_read32(rw, rw->start) + 8;
+                rw->start = (rw->start + oldest) % rw->capacity;
+                rw->used -= oldest;
+                rw->frames--;
+            }
+            uint8_t header[4] = {len & 0xFF, (len >> 8) & 0xFF, (len >> 16) & 0xFF, len >> 24};
+            ring_write(rw, rw->end, header, 4);
+            ring_write(rw, (rw->end + 4) % rw->capacity, rw->scratch, len);
+            ring_write(rw, (rw->end + 4 + len) % rw->capacity, header, 4);
+            rw->end = (rw->end + record) % rw->capacity;
+            rw->used += record;
+            rw->frames++;
+        }
+    }
+    memcpy(rw->current, state, SAVESTATE_SIZE);
+    rw->has_current = true;
+}
+
+bool rewind_step(rewind_buffer* rw, chip8_vm* vm) {
+    if (rw->frames == 0) return false;
+    size_t len = ring_read32(rw, rw->end + rw->capacity - 4);
+    size_t record_start = (rw->end + rw->capacity - len - 8) % rw->capacity;
+    ring_read(rw, (record_start + 4) % rw->capacity, rw->scratch, len);
+    delta_apply(rw->current, rw->scratch, len);
+    rw->end = record_start;
+    rw->used -= len + 8;
+    rw->frames--;
+    return vm_load_state(vm, rw->current, SAVESTATE_SIZE);
+}
@@ -0,0 +1,56 @@
+#ifndef CHIP8_SAVESTATE_H
+#define CHIP8_SAVESTATE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "vm.h"
+
+/*
+ * Save states hold all emulated state of a chip8_vm in a fixed size, versioned,
+ * little endian format. Host side state (input/video backends, the execution engine,
+ * the instruction cache) is not saved and is rebuilt on load.
+ */
+#define SAVESTATE_MAGIC "C8SS"
+#define SAVESTATE_VERSION 2
+#define SAVESTATE_SIZE (4 + 4 + 1 + XO_RAM_SIZE + 16 + 2 + 2 + 4 + 4 + 1 + 1 + 1 + 1 \
+                        + 1 + 256 * 2 + 8 + 4 + 2 + 2 + FB_PLANES * FB_MAX_HEIGHT * FB_ROW_WORDS * 8 \
+                        + 1 + FLAG_COUNT + 1 + PATTERN_BYTES)
+
+void vm_save_state(const chip8_vm* vm, uint8_t state[SAVESTATE_SIZE]);
+// Returns false, leaving vm untouched, if state isn't a save state of this version
+bool vm_load_state(chip8_vm* vm, const uint8_t* state, size_t len);
+bool vm_save_state_file(const chip8_vm* vm, const char* path);
+bool vm_load_state_file(chip8_vm* vm, const char* path);
+
+/*
+ * Per-frame rewind history in a fixed size ring of bytes. Each frame is stored as the
+ * XOR of its save state with the next one, run-length encoded, so a frame where little
+ * changed costs a few dozen bytes. The oldest frames are dropped when the ring fills up.
+ */
+typedef struct {
+    uint8_t* ring;
+    size_t capacity;
+    // Offsets of the oldest record and of the end of the newest one
+    size_t start;
+    size_t end;
+    size_t used;
+    long frames;
+    bool has_current;
+    // Save state of the newest frame, which the deltas lead back from
+    uint8_t current[SAVESTATE_SIZE];
+    // Room for one encoded delta, which is at worst 1.5x the size of a save state
+    uint8_t scratch[SAVESTATE_SIZE * 2];
+} rewind_buffer;
+
+// One frame of history usually takes well under 64 bytes, so 4 MB keeps 10+ minutes at 60 fps
+#define DEFAULT_REWIND_BYTES (4 * 1024 * 1024)
+
+rewind_buffer* rewind_new(size_t capacity);
+void rewind_free(rewind_buffer* rw);
+// Records the VM's state as the newest frame
+void rewind_push(rewind_buffer* rw, const chip8_vm* vm);
+// Puts the VM back to the frame before the newest one and drops the newest. False if there is none.
+bool rewind_step(rewind_buffer* rw, chip8_vm* vm);
+
+#endif
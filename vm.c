@@ -0,0 +1,686 @@
+#include <stddef.h>
+#include <string.h>
+#include "vm.h"
+
+#ifdef CHIP8_PROFILE
+#include "profile.h"
+#define PROFILE_INSTRUCTION(vm, inst) do { \
+        if ((vm)->profile != NULL) { \
+            (vm)->profile->op_counts[(inst).tag]++; \
+            (vm)->profile->pc_counts[(vm)->pc & (vm)->addr_mask]++; \
+        } \
+    } while (0)
+// now counts idle loops fast-forwarded through, which the profile leaves out like op_counts does
+#define PROFILE_CALL(vm, target, now) do { \
+        if ((vm)->profile != NULL) profile_call((vm)->profile, (target) & (vm)->addr_mask, (now) - (vm)->idle_cycles); \
+    } while (0)
+#define PROFILE_RET(vm, now) do { if ((vm)->profile != NULL) profile_ret((vm)->profile, (now) - (vm)->idle_cycles); } while (0)
+#else
+#define PROFILE_INSTRUCTION(vm, inst)
+#define PROFILE_CALL(vm, target, now)
+#define PROFILE_RET(vm, now)
+#endif
+
+#if defined(CHIP8_THREADED_DISPATCH) && (defined(__GNUC__) || defined(__clang__))
+#define VM_USE_COMPUTED_GOTO
+#endif
+
+callstack new_callstack() {
+    callstack stack;
+    stack.ptr = 0;
+    return stack;
+}
+
+int callstack_push(callstack* stack, uint16_t addr) {
+    if (stack->ptr == 255) return -1;
+    stack->stack[stack->ptr] = addr;
+    return stack->ptr++;
+}
+
+int callstack_pop(callstack* stack) {
+    if (stack->ptr == 0) return -1;
+    return stack->stack[--stack->ptr];
+}
+
+uint8_t rand_byte(chip8_vm* vm) {
+    uint32_t x = vm->rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    vm->rng = x;
+    return x >> 24;
+}
+
+static uint8_t DIGIT_SPRITES[80] = {0xF0, 0x90, 0x90, 0x90, 0xF0, \
+0x20, 0x60, 0x20, 0x20, 0x70, \
+0xF0, 0x10, 0xF0, 0x80, 0xF0, \
+0xF0, 0x10, 0xF0, 0x10, 0xF0, \
+0x90, 0x90, 0xF0, 0x10, 0x10, \
+0xF0, 0x80, 0xF0, 0x10, 0xF0, \
+0xF0, 0x80, 0xF0, 0x90, 0xF0, \
+0xF0, 0x10, 0x20, 0x40, 0x40, \
+0xF0, 0x90, 0xF0, 0x90, 0xF0, \
+0xF0, 0x90, 0xF0, 0x10, 0xF0, \
+0xF0, 0x90, 0xF0, 0x90, 0x90, \
+0xE0, 0x90, 0xE0, 0x90, 0xE0, \
+0xF0, 0x80, 0x80, 0x80, 0xF0, \
+0xE0, 0x90, 0x90, 0x90, 0xE0, \
+0xF0, 0x80, 0xF0, 0x80, 0xF0, \
+0xF0, 0x80, 0xF0, 0x80, 0x80};
+
+static const uint8_t BIG_DIGIT_SPRITES[BIG_DIGIT_LEN * 16] = {
+0x3C, 0x7E, 0xE7, 0xC3, 0xC3, 0xC3, 0xC3, 0xE7, 0x7E, 0x3C,
+0x18, 0x38, 0x58, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x3C,
+0x3E, 0x7F, 0xC3, 0x06, 0x0C, 0x18, 0x30, 0x60, 0xFF, 0xFF,
+0x3C, 0x7E, 0xC3, 0x03, 0x0E, 0x0E, 0x03, 0xC3, 0x7E, 0x3C,
+0x06, 0x0E, 0x1E, 0x36, 0x66, 0xC6, 0xFF, 0xFF, 0x06, 0x06,
+0xFF, 0xFF, 0xC0, 0xC0, 0xFC, 0xFE, 0x03, 0xC3, 0x7E, 0x3C,
+0x3E, 0x7C, 0xE0, 0xC0, 0xFC, 0xFE, 0xC3, 0xC3, 0x7E, 0x3C,
+0xFF, 0xFF, 0x03, 0x06, 0x0C, 0x18, 0x30, 0x60, 0x60, 0x60,
+0x3C, 0x7E, 0xC3, 0xC3, 0x7E, 0x7E, 0xC3, 0xC3, 0x7E, 0x3C,
+0x3C, 0x7E, 0xC3, 0xC3, 0x7F, 0x3F, 0x03, 0x03, 0x3E, 0x7C,
+0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3,
+0xFE, 0xFF, 0xC3, 0xFE, 0xFE, 0xC3, 0xC3, 0xC3, 0xFF, 0xFE,
+0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C,
+0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC,
+0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF,
+0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0};
+
+void vm_load_program(chip8_vm* vm, uint32_t instructions_per_second, const uint8_t program[], int program_len) {
+    vm_load_program_mode(vm, MODE_CHIP8, instructions_per_second, program, program_len);
+}
+
+void vm_load_program_mode(chip8_vm* vm, chip8_mode mode, uint32_t instructions_per_second,
+                          const uint8_t program[], int program_len) {
+    vm->mode = mode;
+    vm->addr_mask = mode == MODE_XOCHIP ? XO_RAM_SIZE - 1 : RAM_SIZE - 1;
+    for (int i = 0; i < 16; i++){
+        vm->reg[i] = 0;
+    }
+    vm->i = 0;
+    vm->delay = 0;
+    vm->sound = 0;
+    vm->waiting_for_keypress = false;
+    vm->key_released = NO_KEY;
+    vm->keys = 0;
+    vm->ips = instructions_per_second > 0 ? instructions_per_second : DEFAULT_IPS;
+    vm->timer_acc = 0;
+    vm->stack = new_callstack();
+    vm->cycles = 0;
+    vm->idle_cycles = 0;
+    vm->rng = RNG_SEED;
+    set_screen_size(&vm->fb, SCREEN_WIDTH, SCREEN_HEIGHT);
+    vm->planes = 1;
+    for (int i = 0; i < FLAG_COUNT; i++) {
+        vm->flags[i] = 0;
+    }
+    vm->pitch = DEFAULT_PITCH;
+    // Four bits on, four off: a 500 Hz square wave at the default pitch
+    for (int i = 0; i < PATTERN_BYTES; i++) {
+        vm->pattern[i] = 0xF0;
+    }
+    // Chip-8 programs are loaded at address 0x200
+    vm->pc = PROGRAM_START;
+    if (program_len > MODE_MAX_ROM_SIZE(mode)) program_len = MODE_MAX_ROM_SIZE(mode);
+    for (int i = 0; i < program_len; i++) {
+        vm->ram[i+PROGRAM_START] = program[i];
+    }
+    for (int i = 0; i < ICACHE_SIZE; i++) {
+        vm->icache[i].tag = UNDECODED;
+    }
+    // Load the digit sprites into memory
+    for (int i = 0; i < DIGIT_LEN * 16; i++) {
+        vm->ram[i + DIGIT_BASE_ADDR] = DIGIT_SPRITES[i];
+    }
+    // Plain CHIP-8 programs can read the memory after the small digits, so it's left alone for them
+    if (mode != MODE_CHIP8) {
+        for (int i = 0; i < BIG_DIGIT_LEN * 16; i++) {
+            vm->ram[i + BIG_DIGIT_BASE_ADDR] = BIG_DIGIT_SPRITES[i];
+        }
+    }
+}
+
+void vm_seed(chip8_vm* vm, uint32_t seed) {
+    // xorshift never leaves 0, so that seed picks the default instead
+    vm->rng = seed != 0 ? seed : RNG_SEED;
+}
+
+static bool vm_key_down(const chip8_vm* vm, uint8_t key) {
+    return (vm->keys >> (key & 0xF)) & 1;
+}
+
+static uint16_t vm_read_opcode(const chip8_vm* vm, uint16_t addr) {
+    return (((uint16_t) vm->ram[addr & vm->addr_mask]) << 8) + (uint16_t) vm->ram[(addr + 1) & vm->addr_mask];
+}
+
+// Decodes the instruction at addr, through the cache when addr is in the program area
+static instruction vm_decode_at(chip8_vm* vm, uint16_t addr) {
+    uint16_t slot = addr - PROGRAM_START;
+    // Addresses below the program area wrap around to large values and miss the cache
+    if (slot < ICACHE_SIZE) {
+        if (vm->icache[slot].tag == UNDECODED) {
+            vm->icache[slot] = decode_instruction(vm_read_opcode(vm, addr), vm->mode);
+        }
+        return vm->icache[slot];
+    }
+    return decode_instruction(vm_read_opcode(vm, addr), vm->mode);
+}
+
+// Steps pc over the instruction it points at, which on XO-CHIP can be the 4 byte F000 NNNN
+static inline void vm_skip_next(chip8_vm* vm) {
+    if (vm->mode == MODE_XOCHIP && vm_read_opcode(vm, vm->pc) == 0xF000) vm->pc += 2;
+    vm->pc += 2;
+}
+
+static instruction vm_fetch(chip8_vm* vm) {
+    return vm_decode_at(vm, vm->pc);
+}
+
+/*
+ * Idle loops are recognised by shape:
+ *   addr: 1NNN to addr                      jump to self, spins forever
+ *   addr: 00FD                              SUPER-CHIP's exit, which stays put like a jump to self
+ *   addr: FX0A                              wait for a key release
+ *   addr: FX07, 3XKK or 4XKK, 1NNN to addr  poll the delay timer until it reaches (or leaves) KK
+ * Timers only count down and keys only change between vm_execute calls, so within one
+ * call every trip round these loops does exactly the same thing as the first.
+ */
+bool vm_idle_loop_at(chip8_vm* vm, uint16_t addr) {
+    instruction first = vm_decode_at(vm, addr);
+    if (first.tag == JMP) return first.data == addr;
+    if (first.tag == WAIT_FOR_KEY || first.tag == EXIT) return true;
+    if (first.tag != STORE_DELAY) return false;
+    instruction skip = vm_decode_at(vm, addr + 2);
+    instruction jump = vm_decode_at(vm, addr + 4);
+    return (skip.tag == SKP_EQ || skip.tag == SKP_NEQ) && skip.reg1 == first.reg1
+           && jump.tag == JMP && jump.data == addr;
+}
+
+uint32_t vm_skip_idle(chip8_vm* vm, uint32_t n) {
+    if (n == 0 || vm->engine.no_idle_skip || !vm_idle_loop_at(vm, vm->pc)) return 0;
+    instruction first = vm_decode_at(vm, vm->pc);
+    uint32_t skipped = 0;
+    if (first.tag == JMP || first.tag == EXIT) {
+        skipped = n;
+    } else if (first.tag == WAIT_FOR_KEY) {
+        if (vm->key_released != NO_KEY) return 0;
+        vm->waiting_for_keypress = true;
+        skipped = n;
+    } else {
+        instruction skip = vm_decode_at(vm, vm->pc + 2);
+        bool leaves = (skip.tag == SKP_EQ) == (vm->delay == skip.data);
+        // Whole trips round the loop only; the rest runs normally so the pc ends up where it would
+        if (leaves || n < 3) return 0;
+        vm->reg[first.reg1] = vm->delay;
+        skipped = n - n % 3;
+    }
+    vm->idle_cycles += skipped;
+    return skipped;
+}
+
+/*
+ * Stores a byte to ram, wrapping the address around like the 12 bit address bus,
+ * and drops the cached instructions that include it: the one starting there and
+ * the one starting a byte before.
+ */
+static void vm_write_ram(chip8_vm* vm, uint16_t addr, uint8_t value) {
+    addr &= vm->addr_mask;
+    vm->ram[addr] = value;
+    uint16_t slot = addr - PROGRAM_START;
+    if (slot < ICACHE_SIZE) vm->icache[slot].tag = UNDECODED;
+    slot--;
+    if (slot < ICACHE_SIZE) vm->icache[slot].tag = UNDECODED;
+}
+
+/*
+ * SUPER-CHIP and XO-CHIP sprites: DXY0 is 16x16, and each selected plane gets its own
+ * sprite, one after the other from addr. Returns what VF gets set to.
+ */
+static uint8_t vm_draw_planes(chip8_vm* vm, uint8_t x, uint8_t y, uint16_t addr, uint8_t n) {
+    bool wide = n == 0;
+    uint8_t rows = wide ? 16 : n;
+    int len = wide ? 32 : n;
+    uint8_t sprite[32];
+    int collided = 0;
+    for (int p = 0; p < FB_PLANES; p++) {
+        if (!((vm->planes >> p) & 1)) continue;
+        for (int j = 0; j < len; j++) {
+            sprite[j] = vm->ram[(addr + j) & vm->addr_mask];
+        }
+        // XO-CHIP wraps sprites round the edges, SUPER-CHIP clips them
+        collided += draw_plane_sprite(&vm->fb, p, x, y, sprite, rows, wide, vm->mode == MODE_XOCHIP);
+        addr += len;
+    }
+    // SUPER-CHIP's hires mode counts the rows that collided or fell off the bottom
+    if (vm->mode == MODE_SCHIP && vm->fb.width == FB_MAX_WIDTH) {
+        int clipped = y % vm->fb.height + rows - vm->fb.height;
+        return (uint8_t) (collided + (clipped > 0 ? clipped : 0));
+    }
+    return collided > 0;
+}
+
+uint8_t vm_draw(chip8_vm* vm, uint8_t x, uint8_t y, uint16_t addr, uint8_t n) {
+    if (vm->mode != MODE_CHIP8) return vm_draw_planes(vm, x, y, addr, n);
+    uint8_t wrapped[15];
+    const uint8_t* sprite = wrapped;
+    if (addr + n <= RAM_SIZE) {
+        sprite = &vm->ram[addr];
+    } else {
+        // Sprites running off the end of memory continue from address 0
+        for (int j = 0; j < n; j++) {
+            wrapped[j] = vm->ram[(addr + j) & (RAM_SIZE - 1)];
+        }
+    }
+    return draw_sprite(&vm->fb, x, y, sprite, n) ? 0x1 : 0x0;
+}
+
+// Tells the audio backend about a new pattern or pitch if it's being played
+static void vm_tone_changed(chip8_vm* vm, uint64_t cycle) {
+    if (vm->sound > 0 && vm->audio.update != NULL) vm->audio.update(vm->audio.ctx, vm, cycle);
+}
+
+/*
+ * The interpreter loop. Runs up to n instructions, stopping early on an error.
+ * With CHIP8_THREADED_DISPATCH on GCC/Clang every handler jumps straight to the next
+ * one through a table of label addresses, otherwise it falls back to a switch.
+ */
+tick_result vm_execute(chip8_vm* vm, uint32_t n) {
+    instruction inst;
+    uint32_t executed = 0;
+    tick_result result = SUCCESS;
+    if (n == 0) return SUCCESS;
+#define FAIL(err) do { result = (err); goto done; } while (0)
+#ifdef VM_USE_COMPUTED_GOTO
+    static const void* dispatch_table[] = {
+        [CLEAR] = &&op_CLEAR, [RET] = &&op_RET, [JMP] = &&op_JMP, [CALL] = &&op_CALL,
+        [SKP_EQ] = &&op_SKP_EQ, [SKP_NEQ] = &&op_SKP_NEQ, [SKP_EQ_REG] = &&op_SKP_EQ_REG,
+        [LOAD] = &&op_LOAD, [ADD_NUM] = &&op_ADD_NUM, [MOV] = &&op_MOV, [OR] = &&op_OR,
+        [AND] = &&op_AND, [XOR] = &&op_XOR, [ADD_REG] = &&op_ADD_REG, [SUB_REG] = &&op_SUB_REG,
+        [RSHIFT] = &&op_RSHIFT, [SUB_FROM] = &&op_SUB_FROM, [LSHIFT] = &&op_LSHIFT,
+        [SKP_NEQ_REG] = &&op_SKP_NEQ_REG, [LOAD_I] = &&op_LOAD_I, [JMP_REL] = &&op_JMP_REL,
+        [RAND] = &&op_RAND, [DRAW] = &&op_DRAW, [SKP_IF_KEY] = &&op_SKP_IF_KEY,
+        [SKP_IF_NOT_KEY] = &&op_SKP_IF_NOT_KEY, [STORE_DELAY] = &&op_STORE_DELAY,
+        [WAIT_FOR_KEY] = &&op_WAIT_FOR_KEY, [SET_DELAY] = &&op_SET_DELAY, [SET_SOUND] = &&op_SET_SOUND,
+        [ADD_I] = &&op_ADD_I, [LOAD_DIGIT_SPRITE] = &&op_LOAD_DIGIT_SPRITE, [STORE_BCD] = &&op_STORE_BCD,
+        [SAVE_REG] = &&op_SAVE_REG, [RESTORE_REG] = &&op_RESTORE_REG, [SCROLL_DOWN] = &&op_SCROLL_DOWN,
+        [SCROLL_RIGHT] = &&op_SCROLL_RIGHT, [SCROLL_LEFT] = &&op_SCROLL_LEFT, [EXIT] = &&op_EXIT,
+        [LORES] = &&op_LORES, [HIRES] = &&op_HIRES, [LOAD_BIG_DIGIT_SPRITE] = &&op_LOAD_BIG_DIGIT_SPRITE,
+        [SAVE_FLAGS] = &&op_SAVE_FLAGS, [RESTORE_FLAGS] = &&op_RESTORE_FLAGS, [SCROLL_UP] = &&op_SCROLL_UP,
+        [SAVE_RANGE] = &&op_SAVE_RANGE, [RESTORE_RANGE] = &&op_RESTORE_RANGE, [LOAD_I_LONG] = &&op_LOAD_I_LONG,
+        [SELECT_PLANES] = &&op_SELECT_PLANES, [LOAD_PATTERN] = &&op_LOAD_PATTERN, [SET_PITCH] = &&op_SET_PITCH,
+        [INVALID] = &&op_INVALID, [UNDECODED] = &&op_INVALID,
+    };
+#define OP(tag) op_##tag
+#define DISPATCH() do { \
+        inst = vm_fetch(vm); \
+        PROFILE_INSTRUCTION(vm, inst); \
+        vm->pc += 2; \
+        goto *dispatch_table[inst.tag]; \
+    } while (0)
+#define NEXT() do { if (++executed == n) goto done; DISPATCH(); } while (0)
+    DISPATCH();
+#else
+#define OP(tag) case tag
+#define NEXT() do { executed++; goto next; } while (0)
+next:
+    if (executed == n) goto done;
+    inst = vm_fetch(vm);
+    PROFILE_INSTRUCTION(vm, inst);
+    vm->pc += 2;
+    switch (inst.tag) {
+#endif
+        OP(CLEAR):
+            clear_planes(&vm->fb, vm->planes);
+            NEXT();
+        OP(LOAD):
+            vm->reg[inst.reg1] = inst.data;
+            NEXT();
+        OP(MOV):
+            vm->reg[inst.reg1] = vm->reg[inst.reg2];
+            NEXT();
+        OP(ADD_NUM):
+            vm->reg[inst.reg1] += inst.data;
+            NEXT();
+        OP(ADD_REG): {
+            uint16_t x = (uint16_t) vm->reg[inst.reg1];
+            uint16_t y = (uint16_t) vm->reg[inst.reg2];
+            uint16_t res = x + y;
+            if (res > 255) {
+                res = res % 256;
+                vm->reg[0xF] = 0x01;
+            } else {
+                vm->reg[0xF] = 0x00;
+            }
+            vm->reg[inst.reg1] = (uint8_t) res;
+            NEXT();
+        }
+        OP(SUB_REG): {
+            uint8_t x = vm->reg[inst.reg1];
+            uint8_t y = vm->reg[inst.reg2];
+            uint8_t res = x - y;
+            if (x > y) {
+                vm->reg[0xF] = 0x01;
+            } else {
+                vm->reg[0xF] = 0x00;
+            }
+            vm->reg[inst.reg1] = res;
+            NEXT();
+        }
+        OP(SUB_FROM): {
+            uint8_t x = vm->reg[inst.reg1];
+            uint8_t y = vm->reg[inst.reg2];
+            uint8_t res = y - x;
+            if (y > x) {
+                vm->reg[0xF] = 0x01;
+            } else {
+                vm->reg[0xF] = 0x00;
+            }
+            vm->reg[inst.reg1] = res;
+            NEXT();
+        }
+        OP(AND):
+            vm->reg[inst.reg1] &= vm->reg[inst.reg2];
+            NEXT();
+        OP(OR):
+            vm->reg[inst.reg1] |= vm->reg[inst.reg2];
+            NEXT();
+        OP(XOR):
+            vm->reg[inst.reg1] ^= vm->reg[inst.reg2];
+            NEXT();
+        OP(RSHIFT): {
+            uint8_t y = vm->reg[inst.reg2];
+            vm->reg[inst.reg1] = y >> 1;
+            vm->reg[0xF] = y & 0b1;
+            NEXT();
+        }
+        OP(LSHIFT): {
+            uint8_t y = vm->reg[inst.reg2];
+            vm->reg[inst.reg1] = y << 1;
+            vm->reg[0xF] = (y & 0b10000000) >> 7;
+            NEXT();
+        }
+        OP(RAND):
+            vm->reg[inst.reg1] = rand_byte(vm) & inst.data;
+            NEXT();
+        OP(JMP): {
+            uint16_t from = vm->pc - 2;
+            vm->pc = inst.data;
+            // Only jumps back to themselves or over a delay timer poll can close an idle loop
+            if (from == inst.data || from == inst.data + 4) executed += vm_skip_idle(vm, n - executed - 1);
+            NEXT();
+        }
+        OP(JMP_REL):
+            vm->pc = inst.data + vm->reg[inst.reg1];
+            NEXT();
+        OP(CALL):
+            if (callstack_push(&vm->stack, vm->pc) < 0) FAIL(ERR_STACK_OVERFLOW);
+            PROFILE_CALL(vm, inst.data, vm->cycles + executed + 1);
+            vm->pc = inst.data;
+            NEXT();
+        OP(RET): {
+            int ret_addr = callstack_pop(&vm->stack);
+            if (ret_addr < 0) FAIL(ERR_STACK_UNDERFLOW);
+            PROFILE_RET(vm, vm->cycles + executed + 1);
+            vm->pc = ret_addr;
+            NEXT();
+        }
+        OP(SKP_EQ):
+            if (vm->reg[inst.reg1] == inst.data) vm_skip_next(vm);
+            NEXT();
+        OP(SKP_NEQ):
+            if (vm->reg[inst.reg1] != inst.data) vm_skip_next(vm);
+            NEXT();
+        OP(SKP_EQ_REG):
+            if (vm->reg[inst.reg1] == vm->reg[inst.reg2]) vm_skip_next(vm);
+            NEXT();
+        OP(SKP_NEQ_REG):
+            if (vm->reg[inst.reg1] != vm->reg[inst.reg2]) vm_skip_next(vm);
+            NEXT();
+        OP(SET_DELAY):
+            vm->delay = vm->reg[inst.reg1];
+            NEXT();
+        OP(STORE_DELAY):
+            vm->reg[inst.reg1] = vm->delay;
+            NEXT();
+        OP(SET_SOUND): {
+            bool was_on = vm->sound > 0;
+            vm->sound = (vm->reg[inst.reg1] > 1) ? vm->reg[inst.reg1] : 0;
+            if ((vm->sound > 0) != was_on && vm->audio.update != NULL) {
+                vm->audio.update(vm->audio.ctx, vm, vm->cycles + executed + 1);
+            }
+            NEXT();
+        }
+        OP(WAIT_FOR_KEY):
+            if (!vm->waiting_for_keypress) {
+                vm->waiting_for_keypress = true;
+            }
+            if (vm->key_released != NO_KEY) {
+                vm->reg[inst.reg1] = (uint8_t) vm->key_released;
+                vm->key_released = NO_KEY;
+                vm->waiting_for_keypress = false;
+            } else {
+                // If a key has not been released change vm->pc to point at this same instruction
+                // so the VM loops until a key is released
+                vm->pc -= 2;
+                executed += vm_skip_idle(vm, n - executed - 1);
+            }
+            NEXT();
+        OP(SKP_IF_KEY):
+            if (vm_key_down(vm, vm->reg[inst.reg1])) {
+                vm_skip_next(vm);
+            }
+            NEXT();
+        OP(SKP_IF_NOT_KEY):
+            if (!vm_key_down(vm, vm->reg[inst.reg1])) {
+                vm_skip_next(vm);
+            }
+            NEXT();
+        OP(LOAD_I):
+            vm->i = inst.data;
+            NEXT();
+        OP(ADD_I):
+            vm->i += vm->reg[inst.reg1];
+            NEXT();
+        OP(DRAW):
+            vm->reg[0xF] = vm_draw(vm, vm->reg[inst.reg1], vm->reg[inst.reg2], vm->i, (uint8_t) inst.data);
+            NEXT();
+        OP(LOAD_DIGIT_SPRITE):
+            vm->i = DIGIT_BASE_ADDR + DIGIT_LEN * vm->reg[inst.reg1];
+            NEXT();
+        OP(STORE_BCD): {
+            uint8_t x = vm->reg[inst.reg1];
+            vm_write_ram(vm, vm->i, x / 100);
+            vm_write_ram(vm, vm->i + 1, (x / 10) % 10);
+            vm_write_ram(vm, vm->i + 2, x % 10);
+            NEXT();
+        }
+        OP(SAVE_REG):
+            for (int j = 0; j <= inst.reg1; j++) {
+                vm_write_ram(vm, vm->i + j, vm->reg[j]);
+            }
+            // SUPER-CHIP leaves I where it was
+            if (vm->mode != MODE_SCHIP) vm->i += inst.reg1 + 1;
+            NEXT();
+        OP(RESTORE_REG):
+            for (int j = 0; j <= inst.reg1; j++) {
+                vm->reg[j] = vm->ram[(vm->i + j) & vm->addr_mask];
+            }
+            if (vm->mode != MODE_SCHIP) vm->i += inst.reg1 + 1;
+            NEXT();
+        OP(SCROLL_DOWN):
+            scroll_down(&vm->fb, vm->planes, inst.data);
+            NEXT();
+        OP(SCROLL_UP):
+            scroll_up(&vm->fb, vm->planes, inst.data);
+            NEXT();
+        OP(SCROLL_RIGHT):
+            scroll_right(&vm->fb, vm->planes, 4);
+            NEXT();
+        OP(SCROLL_LEFT):
+            scroll_left(&vm->fb, vm->planes, 4);
+            NEXT();
+        OP(EXIT):
+            // The program is over, so it stays here showing its last screen
+            vm->pc -= 2;
+            executed += vm_skip_idle(vm, n - executed - 1);
+            NEXT();
+        OP(LORES):
+            set_screen_size(&vm->fb, SCREEN_WIDTH, SCREEN_HEIGHT);
+            NEXT();
+        OP(HIRES):
+            set_screen_size(&vm->fb, FB_MAX_WIDTH, FB_MAX_HEIGHT);
+            NEXT();
+        OP(LOAD_BIG_DIGIT_SPRITE):
+            vm->i = BIG_DIGIT_BASE_ADDR + BIG_DIGIT_LEN * (vm->reg[inst.reg1] & 0xF);
+            NEXT();
+        OP(SAVE_FLAGS):
+            for (int j = 0; j <= inst.reg1; j++) {
+                vm->flags[j] = vm->reg[j];
+            }
+            NEXT();
+        OP(RESTORE_FLAGS):
+            for (int j = 0; j <= inst.reg1; j++) {
+                vm->reg[j] = vm->flags[j];
+            }
+            NEXT();
+        OP(SAVE_RANGE): {
+            // Vx to Vy, in either direction, without moving I
+            int step = inst.reg1 <= inst.reg2 ? 1 : -1;
+            for (int j = 0, r = inst.reg1; ; j++, r += step) {
+                vm_write_ram(vm, vm->i + j, vm->reg[r]);
+                if (r == inst.reg2) break;
+            }
+            NEXT();
+        }
+        OP(RESTORE_RANGE): {
+            int step = inst.reg1 <= inst.reg2 ? 1 : -1;
+            for (int j = 0, r = inst.reg1; ; j++, r += step) {
+                vm->reg[r] = vm->ram[(vm->i + j) & vm->addr_mask];
+                if (r == inst.reg2) break;
+            }
+            NEXT();
+        }
+        OP(LOAD_I_LONG):
+            // The address is the next 2 bytes, which get stepped over like an instruction
+            vm->i = vm_read_opcode(vm, vm->pc);
+            vm->pc += 2;
+            NEXT();
+        OP(SELECT_PLANES):
+            vm->planes = inst.reg1 & ALL_PLANES;
+            NEXT();
+        OP(LOAD_PATTERN):
+            for (int j = 0; j < PATTERN_BYTES; j++) {
+                vm->pattern[j] = vm->ram[(vm->i + j) & vm->addr_mask];
+            }
+            vm_tone_changed(vm, vm->cycles + executed + 1);
+            NEXT();
+        OP(SET_PITCH):
+            vm->pitch = vm->reg[inst.reg1];
+            vm_tone_changed(vm, vm->cycles + executed + 1);
+            NEXT();
+        OP(INVALID):
+#ifndef VM_USE_COMPUTED_GOTO
+        default:
+#endif
+            FAIL(ERR_INVALID);
+#ifndef VM_USE_COMPUTED_GOTO
+    }
+#endif
+#undef OP
+#undef NEXT
+#undef DISPATCH
+#undef FAIL
+done:
+    vm->cycles += executed;
+    return result;
+}
+
+tick_result vm_tick(chip8_vm* vm) {
+    return vm_execute(vm, 1);
+}
+
+// Instructions left to run before the delay and sound timers next count down
+static uint64_t vm_cycles_until_timer(const chip8_vm* vm) {
+    return (vm->ips - vm->timer_acc + TIMER_HZ - 1) / TIMER_HZ;
+}
+
+tick_result vm_run_cycles(chip8_vm* vm, uint64_t n) {
+    while (n > 0) {
+        uint64_t until_timer = vm_cycles_until_timer(vm);
+        uint32_t slice = (uint32_t) (n < until_timer ? n : until_timer);
+        uint64_t before = vm->cycles;
+        tick_result res = SUCCESS;
+        // Idle loops already running when the slice starts are skipped before either engine sees them
+        uint32_t skipped = vm_skip_idle(vm, slice);
+        vm->cycles += skipped;
+        if (skipped == slice) {
+            // Nothing left to run
+        } else if (vm->engine.execute != NULL) {
+            res = vm->engine.execute(vm->engine.ctx, vm, slice - skipped);
+        } else {
+            res = vm_execute(vm, slice - skipped);
+        }
+        // Every instruction is worth TIMER_HZ, and the timers count down each time ips of them add up
+        vm->timer_acc += (uint32_t) (vm->cycles - before) * TIMER_HZ;
+        while (vm->timer_acc >= vm->ips) {
+            vm->timer_acc -= vm->ips;
+            if (vm->sound > 0 && --vm->sound == 0 && vm->audio.update != NULL) {
+                vm->audio.update(vm->audio.ctx, vm, vm->cycles);
+            }
+            if (vm->delay > 0) vm->delay--;
+        }
+        if (res != SUCCESS) return res;
+        n -= slice;
+    }
+    return SUCCESS;
+}
+
+tick_result vm_run_frame(chip8_vm* vm) {
+    uint64_t frame = vm_cycles_until_timer(vm);
+    uint32_t parts = vm->input.polls_per_frame > 0 ? vm->input.polls_per_frame : 1;
+    if (vm->input.poll == NULL) parts = 1;
+    uint64_t done = 0;
+    for (uint32_t part = 0; part < parts; part++) {
+        if (vm->input.poll != NULL) vm->input.poll(vm->input.ctx, vm, part);
+        // Part k ends k+1 parts of the way through the frame, so the parts add up exactly
+        uint64_t end = frame * (part + 1) / parts;
+        tick_result res = vm_run_cycles(vm, end - done);
+        if (res != SUCCESS) return res;
+        done = end;
+    }
+    if (vm->video.present != NULL) vm->video.present(vm->video.ctx, &vm->fb);
+    return SUCCESS;
+}
+
+const char* vm_state_diff(const chip8_vm* a, const chip8_vm* b) {
+    if (a->pc != b->pc) return "pc";
+    if (a->i != b->i) return "i";
+    if (memcmp(a->reg, b->reg, sizeof(a->reg)) != 0) return "reg";
+    if (a->delay != b->delay || a->sound != b->sound) return "timers";
+    if (a->stack.ptr != b->stack.ptr) return "stack pointer";
+    if (memcmp(a->stack.stack, b->stack.stack, a->stack.ptr * sizeof(uint16_t)) != 0) return "stack";
+    if (a->cycles != b->cycles) return "cycles";
+    if (a->mode != b->mode) return "mode";
+    // Only the memory the mode can address, which is all the program can have changed
+    if (memcmp(a->ram, b->ram, (size_t) a->addr_mask + 1) != 0) return "ram";
+    if (memcmp(&a->fb, &b->fb, sizeof(a->fb)) != 0) return "screen";
+    if (a->planes != b->planes || memcmp(a->flags, b->flags, sizeof(a->flags)) != 0) return "planes or flags";
+    return NULL;
+}
+
+const char* tick_result_str(tick_result res) {
+    switch (res) {
+        case SUCCESS:
+            return "Success";
+        case ERR_INVALID:
+            return "Invalid instruction!!!";
+        case ERR_STACK_OVERFLOW:
+            return "Stack Overflow!!!";
+        case ERR_STACK_UNDERFLOW:
+            return "Stack Underflow!!!";
+        case STOPPED:
+            return "Stopped";
+        default:
+            return "Unknown error!!!";
+    }
+}
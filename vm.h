@@ -0,0 +1,182 @@
+#ifndef CHIP8_VM_H
+#define CHIP8_VM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "instruction.h"
+#include "framebuffer.h"
+
+typedef struct {
+    uint16_t stack[256];
+    uint8_t ptr;
+} callstack;
+
+callstack new_callstack();
+int callstack_push(callstack* stack, uint16_t addr);
+int callstack_pop(callstack* stack);
+
+typedef enum {
+    SUCCESS,
+    ERR_STACK_OVERFLOW,
+    ERR_STACK_UNDERFLOW,
+    ERR_INVALID,
+    // Not an error: an engine (the debugger) stopped part way, and running on carries on from there
+    STOPPED,
+} tick_result;
+
+struct vm;
+
+/*
+ * Input, video and audio backends. The VM only talks to the outside world through these,
+ * so it can be driven by SDL, a script, or nothing at all.
+ * Any of the callbacks may be NULL: keys then stay as they were last set and frames aren't presented.
+ */
+typedef struct {
+    void* ctx;
+    // Called polls_per_frame times per frame, evenly spaced through its instructions and
+    // starting before the first, to update vm->keys and vm->key_released. part counts up from 0.
+    void (*poll)(void* ctx, struct vm* vm, uint32_t part);
+    // 0 means once per frame
+    uint32_t polls_per_frame;
+} chip8_input;
+
+typedef struct {
+    void* ctx;
+    // Called once at the end of every frame with the current screen.
+    // Clears fb->dirty_rows once the changed rows have been shown.
+    void (*present)(void* ctx, framebuffer* fb);
+} chip8_video;
+
+typedef struct {
+    void* ctx;
+    /*
+     * Called whenever the tone starts or stops (vm->sound becomes nonzero or reaches 0), and
+     * when vm->pattern or vm->pitch change while it plays. cycle is the instruction count it
+     * happened at, which vm->cycles may not have caught up with yet.
+     */
+    void (*update)(void* ctx, struct vm* vm, uint64_t cycle);
+} chip8_audio;
+
+typedef struct chip8_profile chip8_profile;
+
+/*
+ * Alternative execution engine (e.g. the JIT). When set, vm_run_frame hands the
+ * frame's instructions to it instead of the interpreter.
+ */
+typedef struct {
+    void* ctx;
+    // Runs n instructions like vm_execute, adding them to vm->cycles
+    tick_result (*execute)(void* ctx, struct vm* vm, uint32_t n);
+    // Drops anything derived from the VM's memory, after it was replaced wholesale (may be NULL)
+    void (*flush)(void* ctx);
+    // Set for engines that have to see every instruction, or to time idle loops as they'd run,
+    // so idle loops are never fast-forwarded
+    bool no_idle_skip;
+} chip8_engine;
+
+#define PROGRAM_START 0x200
+#define RAM_SIZE 4096
+// XO-CHIP has a 16 bit address space
+#define XO_RAM_SIZE 65536
+// The largest program that fits between PROGRAM_START and the end of memory
+#define MAX_ROM_SIZE (RAM_SIZE - PROGRAM_START)
+#define XO_MAX_ROM_SIZE (XO_RAM_SIZE - PROGRAM_START)
+#define MODE_MAX_ROM_SIZE(mode) ((mode) == MODE_XOCHIP ? XO_MAX_ROM_SIZE : MAX_ROM_SIZE)
+// Instructions are cached for every address in the program area that has a full opcode after it
+#define ICACHE_SIZE (RAM_SIZE - 1 - PROGRAM_START)
+
+#define DIGIT_BASE_ADDR 0
+#define DIGIT_LEN 5
+// SUPER-CHIP's 8x10 digits (and XO-CHIP's A-F), after the small ones
+#define BIG_DIGIT_BASE_ADDR (DIGIT_BASE_ADDR + DIGIT_LEN * 16)
+#define BIG_DIGIT_LEN 10
+// RPL user flags saved by FX75, 8 on SUPER-CHIP and 16 on XO-CHIP
+#define FLAG_COUNT 16
+// XO-CHIP's audio: a 128 bit pattern played at 4000 * 2^((pitch - 64) / 48) bits per second
+#define PATTERN_BYTES 16
+#define DEFAULT_PITCH 64
+#define NO_KEY (-1)
+
+#define RNG_SEED 0x2545F491u
+
+#define TIMER_HZ 60
+#define DEFAULT_IPS 700
+
+typedef struct vm {
+    // Only the first RAM_SIZE bytes are used outside XO-CHIP
+    uint8_t ram[XO_RAM_SIZE];
+    chip8_mode mode;
+    // Addresses wrap around past this: 12 bits, or 16 on XO-CHIP
+    uint16_t addr_mask;
+    uint8_t reg[16];
+    uint16_t i;
+    uint16_t pc;
+    // Emulated CPU speed, independent of the 60 Hz timers
+    uint32_t ips;
+    // Progress towards the next timer tick, in instructions * TIMER_HZ
+    uint32_t timer_acc;
+    uint8_t delay;
+    uint8_t sound;
+    bool waiting_for_keypress;
+    // CHIP-8 key released while waiting_for_keypress, or NO_KEY
+    int8_t key_released;
+    // Keys held down, bit k being CHIP-8 key k
+    uint16_t keys;
+    callstack stack;
+    uint64_t cycles;
+    // Instructions fast-forwarded through idle loops instead of being run, included in cycles
+    uint64_t idle_cycles;
+    // xorshift32 state for RAND, kept per VM so several can run on different threads
+    uint32_t rng;
+    framebuffer fb;
+    // Planes that drawing, clearing and scrolling work on, bit p for plane p (XO-CHIP's FN01)
+    uint8_t planes;
+    uint8_t flags[FLAG_COUNT];
+    // Tone played while the sound timer runs, set by XO-CHIP's F002 and FX3A
+    uint8_t pitch;
+    uint8_t pattern[PATTERN_BYTES];
+    // Pre-decoded instructions indexed by (address - PROGRAM_START), filled in lazily
+    instruction icache[ICACHE_SIZE];
+    chip8_input input;
+    chip8_video video;
+    chip8_audio audio;
+    chip8_engine engine;
+#ifdef CHIP8_PROFILE
+    // Interpreter profile, see profile.h. NULL when not profiling.
+    struct chip8_profile* profile;
+#endif
+} chip8_vm;
+
+// Programs longer than MAX_ROM_SIZE are cut off there; frontends should refuse them first
+void vm_load_program(chip8_vm* vm, uint32_t instructions_per_second, const uint8_t program[], int program_len);
+// As vm_load_program, running the program as mode. The limit is MODE_MAX_ROM_SIZE(mode).
+void vm_load_program_mode(chip8_vm* vm, chip8_mode mode, uint32_t instructions_per_second,
+                          const uint8_t program[], int program_len);
+// Reseeds RAND. Programs start from RNG_SEED after vm_load_program.
+void vm_seed(chip8_vm* vm, uint32_t seed);
+tick_result vm_tick(chip8_vm* vm);
+tick_result vm_execute(chip8_vm* vm, uint32_t n);
+// Runs n instructions, counting the timers down on the exact instructions where 1/60 s has passed
+tick_result vm_run_cycles(chip8_vm* vm, uint64_t n);
+// Runs up to and including the next timer tick, polling input along the way, then presents the screen
+tick_result vm_run_frame(chip8_vm* vm);
+// True if the code at addr is a loop that can only end on a timer tick or a key release
+bool vm_idle_loop_at(chip8_vm* vm, uint16_t addr);
+/*
+ * If pc is at an idle loop, fast-forwards through as much of the next n instructions as
+ * running them would spend going round it, leaving the VM exactly as if they had run
+ * (except for cycles, which the caller adds). Returns the number of instructions skipped,
+ * always 0 with vm->engine.no_idle_skip.
+ */
+uint32_t vm_skip_idle(chip8_vm* vm, uint32_t n);
+/*
+ * Draws the n row sprite at addr (16x16 for n = 0 outside CHIP-8) at x, y the way DXYN does
+ * in the VM's mode, and returns what VF gets set to. For engines that run DXYN themselves.
+ */
+uint8_t vm_draw(chip8_vm* vm, uint8_t x, uint8_t y, uint16_t addr, uint8_t n);
+// Returns the name of the first piece of emulated state that differs between a and b, or NULL
+const char* vm_state_diff(const chip8_vm* a, const chip8_vm* b);
+const char* tick_result_str(tick_result res);
+uint8_t rand_byte(chip8_vm* vm);
+
+#endif